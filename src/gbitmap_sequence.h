@@ -0,0 +1,122 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#pragma once
+#include "upng.h"
+
+#include <stdbool.h>
+
+/*
+    The gbitmap_sequence API of PebbleOS on top of aupng. GBitmap and resources come from
+    the firmware if UPNG_GBITMAP_HEADER names its header, otherwise the minimal definitions
+    below are used, which mirror the layout of the Pebble SDK.
+*/
+
+#ifdef UPNG_GBITMAP_HEADER
+#include UPNG_GBITMAP_HEADER
+#else
+
+typedef struct GPoint
+{
+	int16_t x;
+	int16_t y;
+} GPoint;
+
+typedef struct GSize
+{
+	int16_t w;
+	int16_t h;
+} GSize;
+
+typedef struct GRect
+{
+	GPoint origin;
+	GSize size;
+} GRect;
+
+// 2 bits per channel, alpha in the high bits
+typedef union GColor8
+{
+	uint8_t argb;
+} GColor8;
+
+typedef enum GBitmapFormat {
+	GBitmapFormat1Bit = 0,		/* rows padded to 4 bytes, least significant bit first */
+	GBitmapFormat8Bit,			/* one GColor8 per pixel */
+	GBitmapFormat1BitPalette,
+	GBitmapFormat2BitPalette,
+	GBitmapFormat4BitPalette,
+	GBitmapFormat8BitCircular
+} GBitmapFormat;
+
+typedef struct GBitmap
+{
+	void* addr;
+	uint16_t row_size_bytes;
+	GBitmapFormat format;
+	GRect bounds;
+	GColor8* palette;			/* for the palettized formats */
+} GBitmap;
+
+static inline uint8_t*			gbitmap_get_data			(const GBitmap* bitmap) { return (uint8_t*)bitmap->addr; }
+static inline uint16_t			gbitmap_get_bytes_per_row	(const GBitmap* bitmap) { return bitmap->row_size_bytes; }
+static inline GBitmapFormat		gbitmap_get_format			(const GBitmap* bitmap) { return bitmap->format; }
+static inline GRect				gbitmap_get_bounds			(const GBitmap* bitmap) { return bitmap->bounds; }
+static inline GColor8*			gbitmap_get_palette			(const GBitmap* bitmap) { return bitmap->palette; }
+
+#endif
+
+#ifndef PLAY_COUNT_INFINITE
+#define PLAY_COUNT_INFINITE UINT32_MAX
+#endif
+
+typedef struct GBitmapSequence GBitmapSequence;
+
+#ifdef UPNG_GBITMAP_HEADER
+GBitmapSequence*	gbitmap_sequence_create_with_resource		(uint32_t resource_id);
+#endif
+// takes ownership of the source like upng_new_from_source
+GBitmapSequence*	gbitmap_sequence_create_with_source			(upng_source source);
+void				gbitmap_sequence_destroy					(GBitmapSequence* sequence);
+// starts again at the first frame with no plays done
+bool				gbitmap_sequence_restart					(GBitmapSequence* sequence);
+// composites the next frame directly into the bitmap, which needs at least the size of the image and
+// GBitmapFormat8Bit, or the palettized format of the bit depth of an indexed image with binary alpha,
+// whose palette is filled then. returns false once all plays are done or on errors
+bool				gbitmap_sequence_update_bitmap_next_frame	(GBitmapSequence* sequence, GBitmap* bitmap, uint32_t* delay_ms);
+// composites the frame on screen at the given time since the start, returns false if all plays were
+// done already, frames in between are only decoded if they stay visible
+bool				gbitmap_sequence_update_bitmap_by_elapsed	(GBitmapSequence* sequence, GBitmap* bitmap, uint32_t elapsed_ms);
+// -1 before the first update
+int32_t				gbitmap_sequence_get_current_frame_idx		(const GBitmapSequence* sequence);
+uint32_t			gbitmap_sequence_get_current_frame_delay_ms	(const GBitmapSequence* sequence);
+// time since the start at which the current frame is shown
+uint32_t			gbitmap_sequence_get_elapsed_ms				(const GBitmapSequence* sequence);
+uint32_t			gbitmap_sequence_get_total_num_frames		(const GBitmapSequence* sequence);
+// PLAY_COUNT_INFINITE for animations which loop forever
+uint32_t			gbitmap_sequence_get_play_count				(const GBitmapSequence* sequence);
+void				gbitmap_sequence_set_play_count				(GBitmapSequence* sequence, uint32_t play_count);
+GSize				gbitmap_sequence_get_bitmap_size			(const GBitmapSequence* sequence);
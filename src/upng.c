@@ -108,16 +108,94 @@ static void upng_free_source(upng_t *upng)
     memset(&upng->source, 0, sizeof(upng->source));
 }
 
-/*search through the chunks, save information like palette, frames and texts*/
-static upng_error upng_process_chunks(upng_t* upng)
+int upng_frame_fits(const upng_t *upng, const upng_frame *frame)
+{
+    const upng_rect *image = &upng->defaultImage.rect;
+
+    /* the compositor writes at these offsets, so the sums must not wrap */
+    return frame->rect.x_offset >= 0 && frame->rect.y_offset >= 0 &&
+        frame->rect.width > 0 && frame->rect.height > 0 &&
+        frame->rect.width <= image->width && (unsigned)frame->rect.x_offset <= image->width - frame->rect.width &&
+        frame->rect.height <= image->height && (unsigned)frame->rect.y_offset <= image->height - frame->rect.height;
+}
+
+/* appends the compressed data of a data chunk to the frame */
+static int add_span(upng_t *upng, upng_frame *frame, unsigned long offset, unsigned long size)
+{
+    if (upng->span_count == upng->span_capacity)
+    {
+        unsigned capacity = upng->span_capacity > 0 ? upng->span_capacity * 2 : 16;
+        upng_source_span *spans = (upng_source_span*)UPNG_MEM_ALLOC(sizeof(upng_source_span) * capacity);
+        if (spans == NULL)
+            return 0;
+        if (upng->spans != NULL)
+        {
+            memcpy(spans, upng->spans, sizeof(upng_source_span) * upng->span_count);
+            UPNG_MEM_FREE(upng->spans);
+        }
+        upng->spans = spans;
+        upng->span_capacity = capacity;
+    }
+
+    /* the data chunks of a frame follow each other, so do their spans */
+    if (frame->data_chunks == 0)
+        frame->first_span = upng->span_count;
+    upng->spans[upng->span_count].offset = offset;
+    upng->spans[upng->span_count].size = size;
+    upng->span_count++;
+    frame->data_chunks++;
+    frame->compressed_size += size;
+    return 1;
+}
+
+/* frames before count are complete once the next one begins */
+static void complete_frames(upng_t *upng, unsigned count)
 {
-    unsigned long chunk_offset;
-    uint8_t chunk_header[12];
-    unsigned int cur_frame_index = FRAME_INDEX_NONE;
-    unsigned int next_sequence_number = 0;
+    if (count > upng->frame_count)
+        count = upng->frame_count;
+    while (upng->scanned_frames < count)
+        upng_classify_keyframe(upng, upng->scanned_frames++);
+}
+
+static int scan_reached(const upng_t *upng, unsigned frames)
+{
+    return upng->scan_done || (upng->scanned_default && upng->scanned_frames >= frames);
+}
+
+/* reads the keyword and text of a tEXt chunk, which are separated by a null byte */
+upng_error upng_read_text(upng_t *upng, upng_text *text)
+{
+    char *buffer = (char*)UPNG_MEM_ALLOC(text->length + 1);
+    char *terminator;
+
+    if (buffer == NULL)
+        return UPNG_ENOMEM;
+    if (!upng_source_copy(upng, text->offset, buffer, text->length))
+    {
+        UPNG_MEM_FREE(buffer);
+        return UPNG_EREAD;
+    }
+    terminator = (char*)memchr(buffer, '\0', text->length);
+    if (terminator == NULL)
+    {
+        UPNG_MEM_FREE(buffer);
+        return UPNG_EMALFORMED;
+    }
+    buffer[text->length] = '\0';
+
+    text->buffer = buffer;
+    text->keyword = buffer;
+    text->text = terminator + 1;
+    return UPNG_EOK;
+}
 
-    /* first byte of the first chunk after the header */
-    chunk_offset = 33;
+/*search through the chunks, save information like palette, frames and texts*/
+static upng_error upng_process_chunks(upng_t* upng, unsigned frames)
+{
+    unsigned long chunk_offset = upng->scan_offset;
+    const uint8_t *chunk_header = upng->scan_header;
+    upng_error error;
+    uint8_t crc[4];
 
     /* scan through the chunks, finding the size of all IDAT chunks, and also
         * verify general well-formed-ness */
@@ -129,8 +207,10 @@ static upng_error upng_process_chunks(upng_t* upng)
         /* make sure chunk header is not larger than the total compressed */
         CHECK_RET(upng, chunk_offset + 12 <= upng->source.size, UPNG_EMALFORMED);
 
-        /* read chunk header */
-        CHECK_RET(upng, upng->source.read(upng->source.user, chunk_offset, chunk_header, 12) == 12, UPNG_EREAD);
+        /* read length and type, unless the last scan stopped at this chunk */
+        if (!upng->scan_header_read)
+            CHECK_RET(upng, upng_source_copy(upng, chunk_offset, upng->scan_header, 8), UPNG_EREAD);
+        upng->scan_header_read = 1;
 
         /* get length; sanity check it */
         length = upng_chunk_length(chunk_header);
@@ -139,39 +219,65 @@ static upng_error upng_process_chunks(upng_t* upng)
         /* make sure chunk header+paylaod is not larger than the total compressed */
         CHECK_RET(upng, chunk_offset + length + 12 <= upng->source.size, UPNG_EMALFORMED);
 
+        /* a frame ends where the next one begins, the default image with the first chunk after its data,
+         * the scan stops before the chunk once everything requested is complete */
+        if (upng_chunk_type(chunk_header) == CHUNK_FCTL && upng->scan_frame != FRAME_INDEX_NONE)
+            complete_frames(upng, upng->scan_frame + 1);
+        if (upng_chunk_type(chunk_header) != CHUNK_IDAT && upng->defaultImage.data_chunks > 0)
+            upng->scanned_default = 1;
+        if (scan_reached(upng, frames))
+            return upng->error;
+
         /* parse chunks */
         if (upng_chunk_type(chunk_header) == CHUNK_IDAT)
         {
             /* make sure no IDAT chunk comes after a fcTL chunk */
-            CHECK_RET(upng, cur_frame_index == FRAME_INDEX_NONE || cur_frame_index == 0, UPNG_EMALFORMED);
+            CHECK_RET(upng, upng->scan_frame == FRAME_INDEX_NONE || upng->scan_frame == 0, UPNG_EMALFORMED);
 
-            if (upng->defaultImage.data_chunk_offset == 0)
+            CHECK_RET(upng, add_span(upng, &upng->defaultImage, chunk_data_offset, length), UPNG_ENOMEM);
+            if (upng->source.sequential)
             {
-                upng->defaultImage.data_chunk_offset = chunk_offset;
+                error = upng_payload_stream(upng, &upng->defaultImage, chunk_data_offset, length);
+                CHECK_RET(upng, error == UPNG_EOK, error);
             }
-            upng->defaultImage.compressed_size += length;
 
-            /* is the main image also the first animation frame? */
-            if (cur_frame_index == 0)
+            /* is the main image also the first animation frame? (keep its fcTL parameters) */
+            if (upng->scan_frame == 0)
             {
-                upng->frames[0] = upng->defaultImage;
+                upng->frames[0].first_span = upng->defaultImage.first_span;
+                upng->frames[0].data_chunks = upng->defaultImage.data_chunks;
+                upng->frames[0].compressed_size = upng->defaultImage.compressed_size;
+
+                /* the stored CRC identifies the payload without reading it */
+                CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset + length, crc, 4), UPNG_EREAD);
+                upng->frames[0].payload_crc = upng_crc32_combine(upng->frames[0].payload_crc,
+                    upng_payload_crc(MAKE_DWORD_PTR(crc), chunk_header + 4, 4, length), length);
             }
         }
         else if (upng_chunk_type(chunk_header) == CHUNK_FDAT)
         {
-            /* make sure the acTL chunk was already processed at this point */
-            CHECK_RET(upng, upng->frames != NULL, UPNG_EMALFORMED);
+            /* make sure the acTL and fcTL chunks were already processed at this point */
+            CHECK_RET(upng, upng->frames != NULL && upng->scan_frame != FRAME_INDEX_NONE, UPNG_EMALFORMED);
 
             /* check sequence number */
-            uint8_t sequence_number[4];
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, sequence_number, 4) == 4, UPNG_EREAD);
-            CHECK_RET(upng, next_sequence_number == MAKE_DWORD_PTR(sequence_number), UPNG_EMALFORMED);
-            next_sequence_number++;
-
-            upng_frame* frame = &upng->frames[cur_frame_index];
-            frame->compressed_size += length;
-            if (frame->data_chunk_offset == 0)
-                frame->data_chunk_offset = chunk_offset;
+            uint8_t prefix[8];
+            CHECK_RET(upng, length >= 4, UPNG_EMALFORMED);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, prefix + 4, 4), UPNG_EREAD);
+            CHECK_RET(upng, upng->scan_sequence == MAKE_DWORD_PTR(prefix + 4), UPNG_EMALFORMED);
+            upng->scan_sequence++;
+
+            upng_frame* frame = &upng->frames[upng->scan_frame];
+            CHECK_RET(upng, add_span(upng, frame, chunk_data_offset + 4, length - 4), UPNG_ENOMEM);
+            if (upng->source.sequential)
+            {
+                error = upng_payload_stream(upng, frame, chunk_data_offset + 4, length - 4);
+                CHECK_RET(upng, error == UPNG_EOK, error);
+            }
+
+            /* the CRC covers the chunk type and the sequence number as well */
+            memcpy(prefix, chunk_header + 4, 4);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset + length, crc, 4), UPNG_EREAD);
+            frame->payload_crc = upng_crc32_combine(frame->payload_crc, upng_payload_crc(MAKE_DWORD_PTR(crc), prefix, 8, length - 4), length - 4);
         }
         else if (upng_chunk_type(chunk_header) == CHUNK_ACTL)
         {
@@ -179,7 +285,7 @@ static upng_error upng_process_chunks(upng_t* upng)
             CHECK_RET(upng, upng->frames == NULL, UPNG_EMALFORMED);
 
             uint8_t data[8];
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, data, 8) == 8, UPNG_EREAD);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, data, 8), UPNG_EREAD);
 
             upng->frame_count = MAKE_DWORD_PTR(data);
             upng->play_count = MAKE_DWORD_PTR(data + 4);
@@ -195,15 +301,16 @@ static upng_error upng_process_chunks(upng_t* upng)
             CHECK_RET(upng, upng->frames != NULL, UPNG_EUNSUPPORTED);
 
             uint8_t data[26];
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, data, 26) == 26, UPNG_EREAD);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, data, 26), UPNG_EREAD);
 
             /* check sequence number */
             unsigned int sequence_number = MAKE_DWORD_PTR(data);
-            CHECK_RET(upng, next_sequence_number == sequence_number, UPNG_EMALFORMED);
-            next_sequence_number++;
+            CHECK_RET(upng, upng->scan_sequence == sequence_number, UPNG_EMALFORMED);
+            upng->scan_sequence++;
 
             /* read data into next frame structure */
-            upng_frame* frame = &upng->frames[++cur_frame_index];
+            CHECK_RET(upng, upng->scan_frame + 1 < upng->frame_count, UPNG_EMALFORMED);
+            upng_frame* frame = &upng->frames[++upng->scan_frame];
             frame->rect.width = MAKE_DWORD_PTR(data + 4);
             frame->rect.height = MAKE_DWORD_PTR(data + 8);
             frame->rect.x_offset = MAKE_DWORD_PTR(data + 12);
@@ -215,24 +322,29 @@ static upng_error upng_process_chunks(upng_t* upng)
             frame->compressed_size = 0;
 
             /* validate data */
-            CHECK_RET(upng, frame->rect.x_offset >= 0 && frame->rect.y_offset >= 0, UPNG_EMALFORMED);
-            CHECK_RET(upng, frame->rect.width > 0 && frame->rect.height > 0, UPNG_EMALFORMED);
-            CHECK_RET(upng, frame->rect.x_offset + frame->rect.width <= upng->defaultImage.rect.width, UPNG_EMALFORMED);
-            CHECK_RET(upng, frame->rect.y_offset + frame->rect.height <= upng->defaultImage.rect.height, UPNG_EMALFORMED);
+            CHECK_RET(upng, upng_frame_fits(upng, frame), UPNG_EMALFORMED);
             CHECK_RET(upng, frame->dispose_op <= UPNG_LAST_DISPOSE_OP, UPNG_EUNSUPPORTED);
             CHECK_RET(upng, frame->blend_op <= UPNG_LAST_BLEND_OP, UPNG_EUNSUPPORTED);
 
             /* the first frame has special requirements */
-            if (cur_frame_index == 0)
+            if (upng->scan_frame == 0)
             {
                 CHECK_RET(upng, frame->rect.x_offset == 0 && frame->rect.y_offset == 0, UPNG_EMALFORMED);
                 CHECK_RET(upng, frame->rect.width == upng->defaultImage.rect.width && frame->rect.height == upng->defaultImage.rect.height, UPNG_EMALFORMED);
             }
+            else if (frame->dispose_op == UPNG_DISPOSE_OP_PREVIOUS)
+            {
+                /* the compositor saves PREVIOUS rects into a single buffer of this size */
+                if (frame->rect.width > upng->save_width)
+                    upng->save_width = frame->rect.width;
+                if (frame->rect.height > upng->save_height)
+                    upng->save_height = frame->rect.height;
+            }
         }
         else if (upng_chunk_type(chunk_header) == CHUNK_OFFS)
         {
             uint8_t data[8];
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, data, 8) == 8, UPNG_EREAD);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, data, 8), UPNG_EREAD);
 
             upng->defaultImage.rect.x_offset = MAKE_DWORD_PTR(data);
             upng->defaultImage.rect.y_offset = MAKE_DWORD_PTR(data + 4);
@@ -247,7 +359,7 @@ static upng_error upng_process_chunks(upng_t* upng)
             }
             upng->palette = UPNG_MEM_ALLOC(length);
 
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, upng->palette, length) == length, UPNG_EREAD);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, upng->palette, length), UPNG_EREAD);
         }
         else if (upng_chunk_type(chunk_header) == CHUNK_tRNS)
         {
@@ -259,22 +371,15 @@ static upng_error upng_process_chunks(upng_t* upng)
             }
             upng->alpha = UPNG_MEM_ALLOC(length);
 
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, upng->alpha, length) == length, UPNG_EREAD);
+            CHECK_RET(upng, upng_source_copy(upng, chunk_data_offset, upng->alpha, length), UPNG_EREAD);
         }
         else if (upng_chunk_type(chunk_header) == CHUNK_TEXT)
         {
-            char* buffer = upng->text[upng->text_count].buffer = UPNG_MEM_ALLOC(length + 1);
-            CHECK_RET(upng, buffer != NULL, UPNG_ENOMEM);
-
-            CHECK_RET(upng, upng->source.read(upng->source.user, chunk_data_offset, buffer, length) == length, UPNG_EREAD);
-
-            // Split into keyword and text (separated by null byte)
-            char* terminator = (char*)memchr(buffer, '\0', length);
-            CHECK_RET(upng, terminator != NULL, UPNG_EMALFORMED);
-
-            upng->text[upng->text_count].keyword = buffer;
-            upng->text[upng->text_count].text = terminator + 1;
-            buffer[length] = '\0';
+            upng_text *text = &upng->text[upng->text_count];
+            text->offset = chunk_data_offset;
+            text->length = length;
+            error = upng_read_text(upng, text);
+            CHECK_RET(upng, error == UPNG_EOK, error);
 
             upng->text_count++;
         }
@@ -288,11 +393,45 @@ static upng_error upng_process_chunks(upng_t* upng)
         }
 
         chunk_offset += length + 12;
+        upng->scan_offset = chunk_offset;
+        upng->scan_header_read = 0;
     }
 
+    /* duplicates can only be told apart from frames with the same checksum once all are known */
+    upng->scan_done = 1;
+    complete_frames(upng, upng->frame_count);
+    upng_find_duplicates(upng);
     return upng->error;
 }
 
+upng_error upng_scan(upng_t *upng, unsigned frames, int required)
+{
+    if (upng->error != UPNG_EOK)
+        return upng->error;
+    /* chunks are scanned from the header on */
+    if (upng->scan_offset == 0)
+        return UPNG_EPARAM;
+    if (!scan_reached(upng, frames) && upng->scan_error == UPNG_EOK)
+    {
+        /* the error belongs to the chunk the scan stopped at, not to the frames before it */
+        upng_process_chunks(upng, frames);
+        upng->scan_error = upng->error;
+        upng->error = UPNG_EOK;
+    }
+    if (scan_reached(upng, frames))
+        return UPNG_EOK;
+    if (required)
+        upng->error = upng->scan_error;
+    return upng->scan_error;
+}
+
+upng_error upng_scan_chunks(upng_t *upng)
+{
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    return upng_scan(upng, FRAME_INDEX_NONE, 1);
+}
+
 /*read the information from the header and store it in the upng_Info. return value is error*/
 upng_error upng_header(upng_t *upng)
 {
@@ -313,7 +452,9 @@ upng_error upng_header(upng_t *upng)
         * better against the actual code below */
     uint8_t header[29];
     CHECK_RET(upng, upng->source.size >= 29, UPNG_ENOTPNG);
-    CHECK_RET(upng, upng->source.read(upng->source.user, 0, header, 29) == 29, UPNG_EREAD);
+    if (upng->source.map != NULL)
+        upng->mapped = (const uint8_t*)upng->source.map(upng->source.user, 0, upng->source.size);
+    CHECK_RET(upng, upng_source_copy(upng, 0, header, 29), UPNG_EREAD);
 
     /* check that PNG header matches expected value */
     static const uint8_t PNG_HEADER[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
@@ -338,10 +479,15 @@ upng_error upng_header(upng_t *upng)
     /* check that the filter method (byte 27) is 0 (only allowed value in spec) */
     CHECK_RET(upng, header[27] == 0, UPNG_EMALFORMED);
 
-    /* check that the interlace method (byte 27) is 0 (spec allows 1, meaning Adam7, but uPNG does not support it) */
-    CHECK_RET(upng, header[28] == 0, UPNG_EUNINTERLACED);
+    /* check that the interlace method (byte 28) is either 0 or 1 (Adam7) */
+    CHECK_RET(upng, header[28] <= 1, UPNG_EMALFORMED);
+    upng->interlace_method = header[28];
 
-    if (upng_process_chunks(upng) != UPNG_EOK)
+    /* only the chunks up to the end of the image data are needed to decode it, the frames after it are scanned
+     * once they are decoded or looked up, unless an index describes all of them */
+    upng->scan_offset = 33;
+    upng->scan_frame = FRAME_INDEX_NONE;
+    if (!upng_load_index(upng) && upng_scan(upng, 0, 1) != UPNG_EOK)
         return upng->error;
 
     upng->state = UPNG_HEADER;
@@ -363,103 +509,76 @@ upng_t *upng_new_from_source(upng_source source)
     upng->color_depth = 8;
     upng->format = UPNG_RGBA8;
     upng->current_frame = FRAME_INDEX_NONE;
+    upng->composed_frame = FRAME_INDEX_NONE;
+    upng->cached_frame = FRAME_INDEX_NONE;
+    upng->cache_delta_frame = FRAME_INDEX_NONE;
+    upng->shown_frame = FRAME_INDEX_NONE;
 
     upng->state = UPNG_NEW;
     upng->source = source;
+    upng_source_check_version(&upng->source);
 
     return upng;
 }
 
-typedef struct upng_byte_source_context
+upng_t *upng_new_from_index(upng_source source, const uint8_t *index, unsigned long size)
 {
-    void* buffer;
-    unsigned long size;
-} upng_byte_source_context;
-
-static unsigned long upng_byte_source_read(void* user, unsigned long offset, void* out_buffer, unsigned long read_size)
-{
-    upng_byte_source_context* context = (upng_byte_source_context*)user;
-    if (offset >= context->size)
-        return 0;
-
-    unsigned long bytes_to_copy = read_size;
-    if (offset + bytes_to_copy > context->size)
-        bytes_to_copy = context->size - offset;
-
-    memcpy(out_buffer, context->buffer + offset, bytes_to_copy);
-    return bytes_to_copy;
-}
+    upng_t *upng = upng_new_from_source(source);
+    if (upng == NULL)
+        return NULL;
 
-static void upng_byte_source_free(void* user)
-{
-    UPNG_MEM_FREE(user);
+    /* the index is only an optimization, without memory the chunks are scanned */
+    upng->index = size > 0 ? (uint8_t*)UPNG_MEM_ALLOC(size) : NULL;
+    if (upng->index != NULL)
+    {
+        memcpy(upng->index, index, size);
+        upng->index_size = size;
+    }
+    return upng;
 }
 
 upng_t *upng_new_from_bytes(uint8_t *raw_buffer, unsigned long size, uint8_t **out_buffer)
 {
-    upng_byte_source_context* context = (upng_byte_source_context*)UPNG_MEM_ALLOC(sizeof(upng_byte_source_context));
-    if (context == NULL)
+    upng_source source;
+    if (upng_source_from_bytes(&source, raw_buffer, size) != UPNG_EOK)
         return NULL;
-    context->buffer = raw_buffer;
-    context->size = size;
-
-    return upng_new_from_source((upng_source) {
-        .user = context,
-        .size = size,
-        .read = upng_byte_source_read,
-        .free = upng_byte_source_free
-    });
+    return upng_new_from_source(source);
 }
 
 #ifdef UPNG_USE_STDIO
-static unsigned long upng_file_source_read(void* user, unsigned long offset, void* out_buffer, unsigned long read_size)
-{
-    FILE* fp = (FILE*)user;
-    fseek(fp, 0, SEEK_END);
-    unsigned long size = ftell(fp);
-    if (offset >= size)
-        return 0;
-
-    unsigned long bytes_to_read = read_size;
-    if (offset + bytes_to_read > size)
-        bytes_to_read = size - offset;
-
-    fseek(fp, offset, SEEK_SET);
-    return fread(out_buffer, 1, bytes_to_read, fp);
-}
-
-static void upng_file_source_free(void* user)
-{
-    if (user != NULL)
-        fclose((FILE*)user);
-}
-
 upng_t *upng_new_from_file(const char *filename)
 {
-    FILE* fp = fopen(filename, "rb");
-    upng_t *upng = upng_new_from_source((upng_source) {
-        .user = fp,
-        .size = 0,
-        .read = upng_file_source_read,
-        .free = upng_file_source_free
-    });
-    if (upng == NULL)
-        return NULL;
+    upng_source source;
+    upng_error error = upng_source_new_file(filename, &source);
+    upng_t *upng;
 
-    if (upng->source.user == NULL)
+    /* chunk headers and small chunks are read through a few blocks */
+    if (error == UPNG_EOK && upng_source_add_block_cache(&source, UPNG_FILE_BLOCK_SIZE, UPNG_FILE_BLOCKS, 1) != UPNG_EOK)
     {
-        SET_ERROR(upng, UPNG_ENOTFOUND);
-        return upng;
+        source.free(source.user);
+        return NULL;
     }
+    if (error != UPNG_EOK)
+        memset(&source, 0, sizeof(source));
 
-    fseek(fp, 0, SEEK_END);
-    upng->source.size = ftell(fp);
+    upng = upng_new_from_source(source);
+    if (upng == NULL)
+        return NULL;
+    if (error != UPNG_EOK)
+        SET_ERROR(upng, error);
     return upng;
 }
 #endif
 
 void upng_free(upng_t *upng)
 {
+#ifdef UPNG_USE_THREADS
+    upng_prefetch_stop(upng);
+    upng_set_parallel_decode(upng, 0, 0);
+#endif
+    upng_payload_cancel_read(upng);
+    upng_free_streamed(upng);
+
     /* deallocate palette buffer, if necessary */
     if (upng->palette)
     {
@@ -477,10 +596,24 @@ void upng_free(upng_t *upng)
         UPNG_MEM_FREE(upng->frames);
     }
 
+    if (upng->spans)
+    {
+        UPNG_MEM_FREE(upng->spans);
+    }
+
+    if (upng->index)
+    {
+        UPNG_MEM_FREE(upng->index);
+    }
+
     if (upng->buffer)
     {
         UPNG_MEM_FREE(upng->buffer);
     }
+    upng_free_canvas(upng);
+    upng_free_cache(upng);
+    upng_free_raw_frames(upng);
+    upng_free_payloads(upng);
 
     /* deallocate source buffer, if necessary */
     upng_free_source(upng);
@@ -488,7 +621,10 @@ void upng_free(upng_t *upng)
     if (upng->text_count)
     {
         for (unsigned int i = 0; i < upng->text_count; i++)
-            UPNG_MEM_FREE(upng->text[i].buffer);
+        {
+            if (upng->text[i].buffer != NULL)
+                UPNG_MEM_FREE(upng->text[i].buffer);
+        }
     }
     upng->text_count = 0;
 
@@ -503,7 +639,9 @@ upng_error upng_reset(upng_t *upng)
     {
         UPNG_MEM_FREE(upng->buffer);
         upng->buffer = NULL;
+        upng->size = 0;
     }
+    upng_free_canvas(upng);
     return UPNG_EOK;
 }
 
@@ -601,12 +739,45 @@ const char* upng_get_text(const upng_t *upng, const char **text_out, unsigned in
 
 const uint8_t *upng_get_frame_buffer(const upng_t *upng)
 {
-    return upng->buffer;
+    return upng->composited ? upng->canvas.data : upng->buffer;
+}
+
+void upng_set_progress_callback(upng_t *upng, upng_progress_cb callback, void *user)
+{
+    upng->progress = callback;
+    upng->progress_user = user;
+}
+
+void upng_set_analytics(upng_t *upng, int enabled)
+{
+    if (enabled)
+        upng->flags |= UPNG_FLAG_ANALYTICS;
+    else
+        upng->flags &= ~UPNG_FLAG_ANALYTICS;
+}
+
+upng_error upng_get_analytics(const upng_t *upng, upng_analytics *analytics)
+{
+    if (!upng->analytics_state.valid)
+        return UPNG_EPARAM;
+    *analytics = upng->analytics;
+    return UPNG_EOK;
 }
 
 uint8_t* upng_move_frame_buffer(upng_t *upng)
 {
     uint8_t* buffer = upng->buffer;
+    if (upng->composited)
+    {
+        /* the next frame has to be composited from the start again */
+        buffer = upng->canvas.data;
+        upng->canvas.data = NULL;
+        upng->composed_frame = FRAME_INDEX_NONE;
+        upng->cached_frame = FRAME_INDEX_NONE;
+        upng->composited = 0;
+        return buffer;
+    }
     upng->buffer = NULL;
+    upng->size = 0;
     return buffer;
 }
@@ -39,10 +39,11 @@ typedef enum upng_error {
 	UPNG_ENOTPNG		= 3, /* image data does not have a PNG header */
 	UPNG_EMALFORMED		= 4, /* image data is not a valid PNG image */
 	UPNG_EUNSUPPORTED	= 5, /* critical PNG chunk type is not supported */
-	UPNG_EUNINTERLACED	= 6, /* image interlacing is not supported */
+	UPNG_EUNINTERLACED	= 6, /* image interlacing is not supported (unused since Adam7 is supported) */
 	UPNG_EUNFORMAT		= 7, /* image color format is not supported */
 	UPNG_EPARAM			= 8, /* invalid parameter to method call */
-    UPNG_EREAD          = 9  /* read callback did not return all data */
+    UPNG_EREAD          = 9, /* read callback did not return all data */
+    UPNG_ENOSEEK        = 10 /* data a sequential source already passed was needed again */
 } upng_error;
 
 typedef enum upng_format {
@@ -62,10 +63,29 @@ typedef enum upng_format {
 	UPNG_LUMINANCE_ALPHA1,
 	UPNG_LUMINANCE_ALPHA2,
 	UPNG_LUMINANCE_ALPHA4,
-	UPNG_LUMINANCE_ALPHA8
+	UPNG_LUMINANCE_ALPHA8,
+	UPNG_ARGB2222		/* only for external canvases, 2 bits per channel with alpha in the high bits like GColor8 of Pebble */
 } upng_format;
 
+typedef enum upng_cpu_feature {
+	UPNG_CPU_SSE2		= 1 << 0,
+	UPNG_CPU_AVX2		= 1 << 1
+} upng_cpu_feature;
+
+typedef enum upng_blend_mode {
+	UPNG_BLEND_EXACT,			/* over operator of the APNG specification on straight alpha */
+	UPNG_BLEND_PREMULTIPLIED	/* faster, RGBA8 and LUMINANCE_ALPHA8 canvases hold premultiplied alpha */
+} upng_blend_mode;
+
+typedef struct upng_cache_stats {
+	unsigned long	hits;
+	unsigned long	misses;
+	unsigned long	evictions;
+	unsigned long	bytes;		/* used by cached frames */
+} upng_cache_stats;
+
 typedef struct upng_t upng_t;
+typedef struct upng_playback upng_playback;
 
 typedef struct upng_rect
 {
@@ -75,36 +95,177 @@ typedef struct upng_rect
 	unsigned height;
 } upng_rect;
 
+typedef struct upng_analytics
+{
+	int opaque;				/* every pixel has full alpha */
+	int single_color;		/* every pixel has the same 8 bit RGBA value */
+	uint8_t average[4];		/* average 8 bit RGBA value of all pixels */
+	upng_rect bounds;		/* bounding box of all pixels with non-zero alpha, relative to the frame buffer */
+} upng_analytics;
+
 typedef struct __attribute__((__packed__)) upng_rgb {
   unsigned char r;
   unsigned char g;
   unsigned char b;
 } upng_rgb;
 
+// called after every Adam7 pass of an interlaced image with a coarse preview in the frame buffer
+typedef void			(*upng_progress_cb)		(void* user, const upng_t* upng, unsigned pass);
+
 typedef void 			(*upng_source_free_cb)	(void* user);
 typedef unsigned long 	(*upng_source_read_cb)	(void* user, unsigned long offset, void* buffer, unsigned long size);
+// pointer to size bytes at offset which stays valid until the source is freed, NULL if they are not in memory
+typedef const void*		(*upng_source_map_cb)	(void* user, unsigned long offset, unsigned long size);
+// starts reading like read into buffer and returns a request for complete, NULL if the read cannot be started
+typedef void*			(*upng_source_submit_cb)	(void* user, unsigned long offset, void* buffer, unsigned long size);
+// waits for a started read and returns the number of bytes read, the buffer is not touched anymore afterwards
+typedef unsigned long	(*upng_source_complete_cb)	(void* user, void* request);
+typedef struct upng_source_span
+{
+    unsigned long offset;
+    unsigned long size;
+} upng_source_span;
+// reads count spans one after another into buffer and returns the number of bytes read
+typedef unsigned long	(*upng_source_readv_cb)	(void* user, const upng_source_span* spans, unsigned count, void* buffer);
+// optional callbacks are NULL if the source does not implement them, they are only read from sources
+// set up with upng_source_init, so sources which only fill in the members before version keep working
+#define UPNG_SOURCE_VERSION 0x75505331u	/* 'uPS1' */
 typedef struct upng_source
 {
     void* user;
     unsigned long size;
     upng_source_free_cb free;
     upng_source_read_cb read;
+    unsigned version;			/* UPNG_SOURCE_VERSION, otherwise the members below are ignored */
+    upng_source_map_cb map;		/* optional */
+    upng_source_readv_cb readv;	/* optional, frame payloads are read with one call */
+    upng_source_submit_cb submit;	/* optional, together with complete */
+    upng_source_complete_cb complete;
+    int sequential;				/* reads never go back, the size is ULONG_MAX if unknown, see upng_source_new_stream */
 } upng_source;
+// reads the next bytes of a stream like read(2), less than size if no more arrived yet, 0 at its end
+typedef unsigned long	(*upng_stream_read_cb)	(void* user, void* buffer, unsigned long size);
 
+// clears all members of source and sets its version, before the callbacks are filled in
+void			upng_source_init			(upng_source* source);
 #ifdef UPNG_USE_STDIO
 upng_t*			upng_new_from_file	 		(const char* path);
+// file source which determines the size once when opening, reads continuing the previous one do not seek
+upng_error		upng_source_new_file		(const char* path, upng_source* source);
+#endif
+#ifdef UPNG_USE_MMAP
+// maps the whole file into memory, chunks are parsed and single chunk frames inflated from there without copies
+upng_error		upng_source_new_mapped_file	(const char* path, upng_source* source);
 #endif
+#ifdef UPNG_USE_THREADS
+// file source which reads on a pool of threads, the payload of the next frame is read while a frame is inflated
+upng_error		upng_source_new_async_file	(const char* path, unsigned threads, upng_source* source);
+#endif
+// sequential source of a stream which cannot seek like a pipe or a socket, chunks are parsed as they arrive and
+// the data chunks of every frame are kept once they arrived, so looping and seeking back decode them again,
+// which holds the compressed data of the whole image in memory, the caller closes the stream after freeing the source
+upng_error		upng_source_new_stream		(upng_stream_read_cb read, void* user, upng_source* source);
+// replaces the source by a read-through cache of blocks of block_size bytes (a power of two), which owns it then,
+// a missing block is read together with the next read_ahead blocks and replaces the least recently used ones,
+// reads of at least block_size bytes bypass the cache, upng_new_from_file already uses one, not for sequential sources
+upng_error		upng_source_add_block_cache	(upng_source* source, unsigned long block_size, unsigned blocks, unsigned read_ahead);
 upng_t*			upng_new_from_bytes	 		(unsigned char* source_buffer, unsigned long source_size, unsigned char**buffer);
 upng_t*     	upng_new_from_source 		(upng_source source);
+// upng_header takes the chunks from an index of upng_save_index instead of scanning them, which only reads the header,
+// the texts, the first and last bytes and the CRCs of the data chunks identifying the source, an index of another version or source is ignored
+// (sources of the same size which only differ in ancillary chunks in the middle are not told apart)
+upng_t*			upng_new_from_index			(upng_source source, const uint8_t* index, unsigned long size);
 void			upng_free			 		(upng_t* upng);
 
+// features of this cpu which the vectorized kernels use, the detected ones as restricted by upng_set_cpu_features
+unsigned		upng_get_cpu_features		(void);
+// restricts the used kernels to a mask of upng_cpu_feature, 0 forces the scalar path
+// (as does setting the UPNG_FORCE_SCALAR environment variable), the kernels are shared by all images,
+// so it must not be called while any thread decodes, prefetches or reads ahead
+void			upng_set_cpu_features		(unsigned features);
+
+// parses the header and scans the chunks up to the end of the image data, later chunks are scanned as frames need them,
+// the getters of per frame information and texts only report what was scanned
 upng_error		upng_header			 		(upng_t* upng);
+// scans all remaining chunks, which reports errors in any of them at once
+upng_error		upng_scan_chunks			(upng_t* upng);
+// compact index of the scanned chunks to open the same source again with, scans all chunks first,
+// the index is allocated with UPNG_MEM_ALLOC and owned by the caller, sequential sources have none
+upng_error		upng_save_index				(upng_t* upng, uint8_t** index, unsigned long* size);
 // jumps to first frame
 upng_error  	upng_reset           		(upng_t* upng);
-// decodes only the main image (as if no apng support)
+// decodes only the main image (as if no apng support), the chunks after it are scanned afterwards for their texts
 upng_error		upng_decode_default			(upng_t* upng);
 // decodes only the next animation frame
 upng_error		upng_decode_next_frame		(upng_t* upng);
+// decodes the given animation frame, compositing starts at the nearest keyframe or snapshot
+upng_error		upng_seek_frame				(upng_t* upng, unsigned index);
+// whether the frame can be composited without the frames before it, 0 until all of its chunks were scanned
+int				upng_is_keyframe			(const upng_t* upng, unsigned index);
+// memory used for periodic canvas snapshots while compositing, 0 (the default) disables them
+void			upng_set_snapshot_budget	(upng_t* upng, unsigned long bytes);
+// keeps composited frames up to the given number of bytes so later loops skip decoding,
+// least recently used frames are evicted first, 0 (the default) disables the cache
+void			upng_set_frame_cache		(upng_t* upng, unsigned long budget);
+void			upng_get_frame_cache_stats	(const upng_t* upng, upng_cache_stats* stats);
+// keeps the compressed data of frames up to the given number of bytes so decoding them again reads nothing,
+// pinned payloads are never evicted, so the frames which fit on the first loop stay cached,
+// 0 (the default) disables the cache
+void			upng_set_payload_cache		(upng_t* upng, unsigned long budget, int pin);
+void			upng_get_payload_cache_stats(const upng_t* upng, upng_cache_stats* stats);
+// playback clock of an animation, enables compositing and has to be freed before upng
+upng_playback*	upng_playback_new			(upng_t* upng);
+void			upng_playback_free			(upng_playback* playback);
+// duration of a single play in milliseconds
+unsigned long	upng_playback_get_duration	(const upng_playback* playback);
+// whether all plays are over at the given time, never for infinitely looping animations
+int				upng_playback_finished		(const upng_playback* playback, unsigned long time_ms);
+// frame on screen at the given time since the start, the last frame once all plays are over
+unsigned		upng_playback_frame_at		(const upng_playback* playback, unsigned long time_ms);
+// composites the frame on screen at the given time, frames in between are only decoded if they stay visible
+upng_error		upng_playback_update		(upng_playback* playback, unsigned long time_ms);
+#ifdef UPNG_USE_THREADS
+// composites up to depth frames ahead on a worker thread which owns upng until upng_prefetch_stop,
+// no other function may be called on upng in between
+upng_error		upng_prefetch_start			(upng_t* upng, unsigned depth);
+// next composited frame, NULL if none is ready (and wait is 0) or the worker failed (see upng_get_error)
+// the canvas stays valid until upng_prefetch_release
+const uint8_t*	upng_prefetch_acquire		(upng_t* upng, unsigned* index, int wait);
+void			upng_prefetch_release		(upng_t* upng);
+void			upng_prefetch_stop			(upng_t* upng);
+// inflates and unfilters up to max_in_flight frames following the decoded one on a pool of threads,
+// frames are still decoded or composited in order by the calling thread which also does all reads,
+// progress is not reported for frames decoded ahead, 0 threads stop the pool (the default)
+upng_error		upng_set_parallel_decode	(upng_t* upng, unsigned threads, unsigned max_in_flight);
+#endif
+void			upng_set_progress_callback	(upng_t* upng, upng_progress_cb callback, void* user);
+// computes upng_analytics while unfiltering, disabled by default
+void			upng_set_analytics			(upng_t* upng, int enabled);
+// composites animation frames onto a canvas of the full image size
+// using their dispose and blend operations, disabled by default
+void			upng_set_compositing		(upng_t* upng, int enabled);
+void			upng_set_blend_mode			(upng_t* upng, upng_blend_mode mode);
+// area of the canvas which changed since the last composited frame, the whole canvas if unknown
+// returns UPNG_EPARAM if the frame buffer is not a composited canvas
+upng_error		upng_get_dirty_rect			(const upng_t* upng, upng_rect* rect);
+// tightens dirty rects to the pixels which changed their value, disabled by default
+void			upng_set_tight_dirty_rects	(upng_t* upng, int enabled);
+// composites indexed images as palette indices if the tRNS alpha is binary, disabled by default
+void			upng_set_indexed_compositing(upng_t* upng, int enabled);
+// keeps the canvas in tiles which are allocated on first write, tiles with the same content are kept once
+// and shared with saved canvas states, the frame buffer is NULL then and has to be exported,
+// snapshots and the frame cache are not used and dirty rects are not tightened, disabled by default
+void			upng_set_tiled_canvas		(upng_t* upng, int enabled);
+// composites into the given memory with rows of stride bytes instead of an allocated canvas, in the canvas format
+// or UPNG_ARGB2222, snapshots and the frame cache are not used then, NULL returns to an allocated canvas
+upng_error		upng_set_external_canvas	(upng_t* upng, uint8_t* data, unsigned long stride, upng_format format);
+// copies the canvas into out with rows of stride bytes
+// returns UPNG_EPARAM if the frame buffer is not a composited canvas
+upng_error		upng_export_canvas			(const upng_t* upng, uint8_t* out, unsigned long stride);
+// format of the frame buffer, indexed images are composited as UPNG_RGBA8 unless composited as indices
+upng_format		upng_get_canvas_format		(const upng_t* upng);
+// expands the frame buffer to 8 bit RGBA, out has to hold width * height * 4 bytes of the frame buffer
+upng_error		upng_get_frame_rgba8		(const upng_t* upng, uint8_t* out);
 // moves ownership out of upng
 uint8_t*		upng_move_frame_buffer		(upng_t* upng); 
 
@@ -120,9 +281,18 @@ unsigned		upng_get_components	 		(const upng_t* upng);
 upng_format		upng_get_format		 		(const upng_t* upng);
 // 0 means unlimited plays
 unsigned    	upng_get_plays       		(const upng_t* upng);
+// delay of a frame in seconds as a fraction, a denominator of 0 is reported as 100,
+// UPNG_EPARAM for frames whose fcTL was not scanned yet
+upng_error		upng_get_frame_delay		(const upng_t* upng, unsigned index, unsigned* numerator, unsigned* denominator);
+// earliest frame with the same compressed data and size, whose decoded frame is reused, the index itself if there is none,
+// duplicates are found once all chunks were scanned
+unsigned		upng_get_duplicate_frame	(const upng_t* upng, unsigned index);
 //returns count of entries in palette
 int         	upng_get_palette			(const upng_t* upng, upng_rgb **palette);
 int         	upng_get_alpha				(const upng_t* upng, uint8_t **alpha);
 const uint8_t*	upng_get_frame_buffer		(const upng_t* upng);
-//returns keyword and text_out matching keyword
+// returns UPNG_EPARAM if analytics were not enabled for the last decoded frame
+upng_error		upng_get_analytics			(const upng_t* upng, upng_analytics* analytics);
+//returns keyword and text_out matching keyword, texts after the image data are found once the chunks
+//up to them were scanned, which upng_decode_default and upng_scan_chunks make sure of
 const char* 	upng_get_text				(const upng_t* upng, const char** text_out, unsigned int index);
@@ -0,0 +1,294 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+/*
+    Composited frames are kept in one of three encodings, whichever is smallest:
+    the raw canvas, the canvas run length encoded or the canvas xor the frame before
+    run length encoded. Delta entries can only be used while the canvas holds the frame before.
+
+    Run length encoding: control bytes below 128 are followed by control + 1 literal bytes,
+    larger ones by a single byte repeated control - 125 times.
+*/
+
+#define RLE_MAX_RUN 130
+
+static unsigned long rle_literals(uint8_t *out, unsigned long pos, const uint8_t *in, unsigned long count)
+{
+    while (count > 0)
+    {
+        unsigned long n = count < 128 ? count : 128;
+        if (out != NULL)
+        {
+            out[pos] = (uint8_t)(n - 1);
+            memcpy(out + pos + 1, in, n);
+        }
+        pos += n + 1;
+        in += n;
+        count -= n;
+    }
+    return pos;
+}
+
+/* returns the encoded size, out may be NULL to only measure it */
+static unsigned long rle_encode(uint8_t *out, const uint8_t *in, unsigned long size)
+{
+    unsigned long i = 0, literal = 0, pos = 0;
+
+    while (i < size)
+    {
+        unsigned long run = 1;
+        while (i + run < size && run < RLE_MAX_RUN && in[i + run] == in[i])
+            run++;
+        if (run < 3)
+        {
+            i += run;
+            continue;
+        }
+
+        pos = rle_literals(out, pos, in + literal, i - literal);
+        if (out != NULL)
+        {
+            out[pos] = (uint8_t)(run + 125);
+            out[pos + 1] = in[i];
+        }
+        pos += 2;
+        i += run;
+        literal = i;
+    }
+
+    return rle_literals(out, pos, in + literal, size - literal);
+}
+
+static void rle_decode(uint8_t *out, const uint8_t *in, unsigned long size, int xor)
+{
+    unsigned long pos = 0, n, k;
+
+    while (pos < size)
+    {
+        unsigned control = in[pos++];
+        if (control < 128)
+        {
+            n = control + 1;
+            if (xor)
+            {
+                for (k = 0; k < n; k++)
+                    out[k] ^= in[pos + k];
+            }
+            else
+                memcpy(out, in + pos, n);
+            pos += n;
+        }
+        else
+        {
+            uint8_t value = in[pos++];
+            n = control - 125;
+            if (!xor)
+                memset(out, value, n);
+            else if (value != 0)
+            {
+                for (k = 0; k < n; k++)
+                    out[k] ^= value;
+            }
+        }
+        out += n;
+    }
+}
+
+static void evict_entry(upng_t *upng, upng_cache_entry *entry)
+{
+    UPNG_MEM_FREE(entry->data);
+    upng->cache_stats.bytes -= entry->size;
+    entry->data = NULL;
+    entry->size = 0;
+}
+
+/* evicts the least recently used frames until size bytes fit into the budget */
+static void make_room(upng_t *upng, unsigned long size)
+{
+    while (upng->cache_stats.bytes + size > upng->cache_budget)
+    {
+        upng_cache_entry *oldest = NULL;
+        unsigned i;
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            if (upng->cache[i].data != NULL && (oldest == NULL || upng->cache[i].last_use < oldest->last_use))
+                oldest = &upng->cache[i];
+        }
+        if (oldest == NULL)
+            return;
+        evict_entry(upng, oldest);
+        upng->cache_stats.evictions++;
+    }
+}
+
+int upng_cache_load(upng_t *upng, unsigned index)
+{
+    upng_cache_entry *entry = upng->cache != NULL ? &upng->cache[index] : NULL;
+
+    if (entry == NULL || entry->data == NULL || upng->canvas.data == NULL ||
+        (entry->encoding == UPNG_CACHE_DELTA && !upng_canvas_holds(upng, index - 1)))
+    {
+        upng->cache_stats.misses++;
+        return 0;
+    }
+
+    if (entry->encoding == UPNG_CACHE_RAW)
+        memcpy(upng->canvas.data, entry->data, entry->size);
+    else
+        rle_decode(upng->canvas.data, entry->data, entry->size, entry->encoding == UPNG_CACHE_DELTA);
+    entry->last_use = ++upng->cache_clock;
+    upng->cache_stats.hits++;
+
+    /* the canvas before the frame was never saved, so its dispose op cannot be applied */
+    if (index > 0 && upng->frames[index].dispose_op == UPNG_DISPOSE_OP_PREVIOUS)
+        upng->composed_frame = FRAME_INDEX_NONE;
+    else
+        upng->composed_frame = index;
+    upng->composed_skipped = 0;
+    upng->cached_frame = index;
+    return 1;
+}
+
+void upng_cache_prepare_delta(upng_t *upng, unsigned index)
+{
+    upng->cache_delta_frame = FRAME_INDEX_NONE;
+    if (upng->cache_budget == 0 || index == 0 || !upng_canvas_holds(upng, index - 1))
+        return;
+    if (upng->cache != NULL && upng->cache[index].data != NULL)
+        return;
+
+    if (upng->cache_scratch == NULL)
+    {
+        upng->cache_scratch = (uint8_t*)UPNG_MEM_ALLOC(upng->canvas.size);
+        if (upng->cache_scratch == NULL)
+            return;
+    }
+    memcpy(upng->cache_scratch, upng->canvas.data, upng->canvas.size);
+    upng->cache_delta_frame = index - 1;
+}
+
+void upng_cache_store(upng_t *upng, unsigned index)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    upng_cache_entry *entry;
+    upng_cache_encoding encoding = UPNG_CACHE_RAW;
+    unsigned long size = canvas->size, encoded, i;
+    int delta = upng->cache_delta_frame != FRAME_INDEX_NONE && upng->cache_delta_frame + 1 == index;
+
+    upng->cache_delta_frame = FRAME_INDEX_NONE;
+    if (upng->cache_budget == 0 || canvas->data == NULL)
+        return;
+
+    /* the cache is optional, running out of memory only means frames are decoded again */
+    if (upng->cache == NULL)
+    {
+        upng->cache = (upng_cache_entry*)UPNG_MEM_ALLOC(sizeof(upng_cache_entry) * upng->frame_count);
+        if (upng->cache == NULL)
+            return;
+        memset(upng->cache, 0, sizeof(upng_cache_entry) * upng->frame_count);
+    }
+    entry = &upng->cache[index];
+    if (entry->data != NULL)
+    {
+        entry->last_use = ++upng->cache_clock;
+        return;
+    }
+
+    encoded = rle_encode(NULL, canvas->data, canvas->size);
+    if (encoded < size)
+    {
+        encoding = UPNG_CACHE_RLE;
+        size = encoded;
+    }
+    if (delta)
+    {
+        for (i = 0; i < canvas->size; i++)
+            upng->cache_scratch[i] ^= canvas->data[i];
+        encoded = rle_encode(NULL, upng->cache_scratch, canvas->size);
+        if (encoded < size)
+        {
+            encoding = UPNG_CACHE_DELTA;
+            size = encoded;
+        }
+    }
+
+    if (size > upng->cache_budget)
+        return;
+    make_room(upng, size);
+    entry->data = (uint8_t*)UPNG_MEM_ALLOC(size);
+    if (entry->data == NULL)
+        return;
+
+    if (encoding == UPNG_CACHE_RAW)
+        memcpy(entry->data, canvas->data, size);
+    else
+        rle_encode(entry->data, encoding == UPNG_CACHE_DELTA ? upng->cache_scratch : canvas->data, canvas->size);
+    entry->size = size;
+    entry->encoding = encoding;
+    entry->last_use = ++upng->cache_clock;
+    upng->cache_stats.bytes += size;
+}
+
+void upng_free_cache(upng_t *upng)
+{
+    unsigned i;
+
+    if (upng->cache != NULL)
+    {
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            if (upng->cache[i].data != NULL)
+                UPNG_MEM_FREE(upng->cache[i].data);
+        }
+        UPNG_MEM_FREE(upng->cache);
+        upng->cache = NULL;
+    }
+    if (upng->cache_scratch != NULL)
+    {
+        UPNG_MEM_FREE(upng->cache_scratch);
+        upng->cache_scratch = NULL;
+    }
+
+    upng->cache_stats.bytes = 0;
+    upng->cache_delta_frame = FRAME_INDEX_NONE;
+    upng->cached_frame = FRAME_INDEX_NONE;
+}
+
+void upng_set_frame_cache(upng_t *upng, unsigned long budget)
+{
+    upng_free_cache(upng);
+    upng->cache_budget = budget;
+}
+
+void upng_get_frame_cache_stats(const upng_t *upng, upng_cache_stats *stats)
+{
+    *stats = upng->cache_stats;
+}
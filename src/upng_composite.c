@@ -0,0 +1,1146 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+/*
+    Composites animation frames onto a canvas of the full image size as described by the
+    APNG specification. Every step only touches the rect of the previous frame (dispose) and
+    the rect of the current frame (save, blend), so its cost is proportional to the frame rect.
+    Indexed images are composited in RGBA8 as blending can produce colors not in the palette,
+    unless indexed compositing is enabled and the alpha of the palette is binary (with at least one
+    transparent entry for cleared pixels). All other formats are composited in their own format.
+    External canvases are memory of the caller, which can also be in UPNG_ARGB2222 for any image.
+*/
+
+unsigned upng_format_bpp(upng_format format)
+{
+    switch (format)
+    {
+    case UPNG_INDEXED1:
+    case UPNG_LUMINANCE1:
+        return 1;
+    case UPNG_INDEXED2:
+    case UPNG_LUMINANCE2:
+    case UPNG_LUMINANCE_ALPHA1:
+        return 2;
+    case UPNG_INDEXED4:
+    case UPNG_LUMINANCE4:
+    case UPNG_LUMINANCE_ALPHA2:
+        return 4;
+    case UPNG_INDEXED8:
+    case UPNG_LUMINANCE8:
+    case UPNG_LUMINANCE_ALPHA4:
+    case UPNG_ARGB2222:
+        return 8;
+    case UPNG_LUMINANCE_ALPHA8:
+        return 16;
+    case UPNG_RGB8:
+        return 24;
+    case UPNG_RGBA8:
+        return 32;
+    case UPNG_RGB16:
+        return 48;
+    case UPNG_RGBA16:
+        return 64;
+    default:
+        return 0;
+    }
+}
+
+/* the palette index used for transparent pixels if indexed images can be composited as indices, -1 otherwise */
+static int transparent_index(const upng_t *upng)
+{
+    int index = -1;
+    unsigned i;
+
+    if (!(upng->flags & UPNG_FLAG_INDEXED_CANVAS))
+        return -1;
+    /* blending partially transparent colors needs RGBA */
+    for (i = 0; i < upng->alpha_entries; i++)
+    {
+        if (upng->alpha[i] != 0 && upng->alpha[i] != 0xFF)
+            return -1;
+        if (upng->alpha[i] == 0 && index < 0)
+            index = (int)i;
+    }
+    return index;
+}
+
+static upng_format canvas_format(const upng_t *upng)
+{
+    if (upng->external_canvas != NULL)
+        return upng->external_format;
+    if (upng->color_type == UPNG_PLT && transparent_index(upng) < 0)
+        return UPNG_RGBA8;
+    return upng->format;
+}
+
+static upng_dispose_op effective_dispose_op(const upng_t *upng, unsigned index)
+{
+    /* the specification requires PREVIOUS on the first frame to be treated as BACKGROUND */
+    if (index == 0 && upng->frames[0].dispose_op == UPNG_DISPOSE_OP_PREVIOUS)
+        return UPNG_DISPOSE_OP_BACKGROUND;
+    return upng->frames[index].dispose_op;
+}
+
+static int canvas_allocated(const upng_t *upng)
+{
+    return upng->canvas.data != NULL || upng->canvas.tiles != NULL;
+}
+
+static upng_error ensure_canvas(upng_t *upng)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned long save_size;
+    unsigned i;
+
+    if (canvas_allocated(upng))
+        return UPNG_EOK;
+
+    /* the save buffer is sized for the PREVIOUS rects of all frames, so compositing scans every fcTL first,
+     * except on sequential sources which would have to keep all frames for that, they save up to the whole canvas */
+    if (upng->source.sequential)
+    {
+        upng->save_width = upng->defaultImage.rect.width;
+        upng->save_height = upng->defaultImage.rect.height;
+    }
+    else if (upng_scan(upng, FRAME_INDEX_NONE, 1) != UPNG_EOK)
+        return upng->error;
+
+    canvas->format = canvas_format(upng);
+    canvas->bpp = upng_format_bpp(canvas->format);
+    canvas->stride = ((unsigned long)upng->defaultImage.rect.width * canvas->bpp + 7) / 8;
+    if (upng->external_canvas != NULL)
+        canvas->stride = upng->external_stride;
+    canvas->size = canvas->stride * upng->defaultImage.rect.height;
+
+    /* transparent black, or the transparent index repeated over a byte */
+    canvas->clear = 0;
+    if (canvas->format != UPNG_RGBA8 && canvas->format != UPNG_ARGB2222 && upng->color_type == UPNG_PLT)
+    {
+        for (i = 0; i < 8; i += canvas->bpp)
+            canvas->clear |= (uint8_t)(transparent_index(upng) << i);
+    }
+
+    upng->composed_frame = FRAME_INDEX_NONE;
+    upng->cached_frame = FRAME_INDEX_NONE;
+
+    if (upng->external_canvas != NULL)
+        canvas->data = upng->external_canvas;
+    else if (upng->flags & UPNG_FLAG_TILED_CANVAS)
+    {
+        /* tiles are allocated on first write and saved by reference */
+        return upng_tiles_alloc(upng);
+    }
+    else
+    {
+        canvas->data = (uint8_t*)UPNG_MEM_ALLOC(canvas->size);
+        CHECK_RET(upng, canvas->data != NULL, UPNG_ENOMEM);
+    }
+
+    /* sized for the largest PREVIOUS rect, so saving never allocates */
+    save_size = ((unsigned long)upng->save_width * canvas->bpp + 7) / 8 * upng->save_height;
+    if (upng->save_size < save_size)
+    {
+        if (upng->save_buffer != NULL)
+            UPNG_MEM_FREE(upng->save_buffer);
+        upng->save_size = 0;
+        upng->save_buffer = (uint8_t*)UPNG_MEM_ALLOC(save_size);
+        CHECK_RET(upng, upng->save_buffer != NULL, UPNG_ENOMEM);
+        upng->save_size = save_size;
+    }
+    return UPNG_EOK;
+}
+
+static upng_error clear_rect(upng_t *upng, const upng_rect *rect)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    uint8_t *row = canvas->data + rect->y_offset * canvas->stride;
+    unsigned y;
+
+    if (canvas->tiles != NULL)
+        return upng_tiles_clear(upng, rect);
+    for (y = 0; y < rect->height; y++, row += canvas->stride)
+        upng_fill_bits(row, (unsigned long)rect->x_offset * canvas->bpp, (unsigned long)rect->width * canvas->bpp, canvas->clear);
+    return UPNG_EOK;
+}
+
+static upng_error save_rect(upng_t *upng, const upng_rect *rect)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned long linebytes = ((unsigned long)rect->width * canvas->bpp + 7) / 8;
+    unsigned long size = linebytes * rect->height;
+    uint8_t *row = canvas->data + rect->y_offset * canvas->stride;
+    unsigned y;
+
+    if (canvas->tiles != NULL)
+        return upng_tiles_save(upng, rect);
+    CHECK_RET(upng, upng->save_size >= size, UPNG_EPARAM);
+
+    for (y = 0; y < rect->height; y++, row += canvas->stride)
+        upng_copy_bits(upng->save_buffer + y * linebytes, 0, row, (unsigned long)rect->x_offset * canvas->bpp, (unsigned long)rect->width * canvas->bpp);
+    return UPNG_EOK;
+}
+
+static void restore_rect(upng_t *upng, const upng_rect *rect)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned long linebytes = ((unsigned long)rect->width * canvas->bpp + 7) / 8;
+    uint8_t *row = canvas->data + rect->y_offset * canvas->stride;
+    unsigned y;
+
+    if (canvas->tiles != NULL)
+    {
+        upng_tiles_restore(upng, rect);
+        return;
+    }
+    for (y = 0; y < rect->height; y++, row += canvas->stride)
+        upng_copy_bits(row, (unsigned long)rect->x_offset * canvas->bpp, upng->save_buffer + y * linebytes, 0, (unsigned long)rect->width * canvas->bpp);
+}
+
+/* the over operator of the APNG specification for samples with the given maximum value, rounded to nearest */
+static void blend_pixel(unsigned *dst, const unsigned *src, unsigned channels, unsigned max)
+{
+    unsigned long long fa, fb, total;
+    unsigned sa = src[channels], da = dst[channels], c;
+
+    if (sa == max)
+    {
+        memcpy(dst, src, sizeof(unsigned) * (channels + 1));
+        return;
+    }
+    if (sa == 0)
+        return;
+
+    fa = (unsigned long long)sa * max;
+    fb = (unsigned long long)(max - sa) * da;
+    total = fa + fb;
+    for (c = 0; c < channels; c++)
+        dst[c] = (unsigned)((src[c] * fa + dst[c] * fb + total / 2) / total);
+    dst[channels] = (unsigned)((total + max / 2) / max);
+}
+
+/* exact over operator, fully opaque and fully transparent source pixels are copied or skipped */
+static void blend_over_exact(uint8_t *dst, const uint8_t *src, unsigned long count, unsigned channels)
+{
+    unsigned long i;
+    unsigned c;
+    for (i = 0; i < count; i++, dst += channels + 1, src += channels + 1)
+    {
+        unsigned s[4], d[4];
+        if (src[channels] == 0xFF)
+            memcpy(dst, src, channels + 1);
+        else if (src[channels] != 0)
+        {
+            for (c = 0; c <= channels; c++)
+            {
+                s[c] = src[c];
+                d[c] = dst[c];
+            }
+            blend_pixel(d, s, channels, 0xFF);
+            for (c = 0; c <= channels; c++)
+                dst[c] = (uint8_t)d[c];
+        }
+    }
+}
+
+/* rounded x / 255 for x <= 65535 without a division */
+#define DIV255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+/* over operator on a premultiplied canvas: dst = premultiplied(src) + dst * (1 - src alpha) */
+static void blend_over_premultiplied(uint8_t *dst, const uint8_t *src, unsigned long count, unsigned channels)
+{
+    unsigned long i;
+    unsigned c;
+    for (i = 0; i < count; i++, dst += channels + 1, src += channels + 1)
+    {
+        unsigned sa = src[channels], ia = 0xFF - sa;
+        if (sa == 0xFF)
+            memcpy(dst, src, channels + 1);
+        else if (sa != 0)
+        {
+            for (c = 0; c < channels; c++)
+                dst[c] = (uint8_t)(DIV255(src[c] * sa) + DIV255(dst[c] * ia));
+            dst[channels] = (uint8_t)(sa + DIV255(dst[channels] * ia));
+        }
+    }
+}
+
+static void premultiply(uint8_t *dst, const uint8_t *src, unsigned long count, unsigned channels)
+{
+    unsigned long i;
+    unsigned c;
+    for (i = 0; i < count; i++, dst += channels + 1, src += channels + 1)
+    {
+        unsigned sa = src[channels];
+        for (c = 0; c < channels; c++)
+            dst[c] = (uint8_t)DIV255(src[c] * sa);
+        dst[channels] = (uint8_t)sa;
+    }
+}
+
+void upng_blend_rgba8_scalar(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_over_exact(dst, src, count, 3);
+}
+
+void upng_blend_la8_scalar(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_over_exact(dst, src, count, 1);
+}
+
+void upng_blend_rgba8_premultiplied_scalar(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_over_premultiplied(dst, src, count, 3);
+}
+
+void upng_blend_la8_premultiplied_scalar(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_over_premultiplied(dst, src, count, 1);
+}
+
+static void blend_rgba16_over(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    unsigned long i;
+    unsigned c;
+    for (i = 0; i < count; i++, dst += 8, src += 8)
+    {
+        unsigned s[4], d[4];
+        for (c = 0; c < 4; c++)
+        {
+            s[c] = MAKE_WORD_PTR(src + 2 * c);
+            d[c] = MAKE_WORD_PTR(dst + 2 * c);
+        }
+        blend_pixel(d, s, 3, 0xFFFF);
+        for (c = 0; c < 4; c++)
+        {
+            dst[2 * c] = (uint8_t)(d[c] >> 8);
+            dst[2 * c + 1] = (uint8_t)d[c];
+        }
+    }
+}
+
+/* luminance alpha of bit depths below 8, samples never cross byte boundaries */
+static void blend_luminance_alpha_over(uint8_t *dst, unsigned long dst_bit, const uint8_t *src, unsigned long src_bit, unsigned long count, unsigned depth)
+{
+    unsigned max = (1u << depth) - 1;
+    unsigned long i;
+    for (i = 0; i < count; i++, dst_bit += 2 * depth, src_bit += 2 * depth)
+    {
+        unsigned s[2], d[2], c;
+        for (c = 0; c < 2; c++)
+        {
+            unsigned long sb = src_bit + c * depth, db = dst_bit + c * depth;
+            s[c] = (src[sb >> 3] >> (8 - depth - (sb & 7))) & max;
+            d[c] = (dst[db >> 3] >> (8 - depth - (db & 7))) & max;
+        }
+        if (s[1] == 0)
+            continue;
+        blend_pixel(d, s, 1, max);
+        for (c = 0; c < 2; c++)
+        {
+            unsigned long db = dst_bit + c * depth;
+            unsigned shift = 8 - depth - (db & 7);
+            dst[db >> 3] = (uint8_t)((dst[db >> 3] & ~(max << shift)) | (d[c] << shift));
+        }
+    }
+}
+
+/* indices of transparent palette entries leave the canvas untouched, alpha is binary */
+static void blend_indexed_over(const upng_t *upng, uint8_t *dst, unsigned long dst_bit, const uint8_t *src, unsigned long src_bit, unsigned long count, unsigned depth)
+{
+    unsigned max = (1u << depth) - 1;
+    unsigned long i;
+
+    if (depth == 8)
+    {
+        dst += dst_bit >> 3;
+        src += src_bit >> 3;
+        for (i = 0; i < count; i++)
+        {
+            if (src[i] >= upng->alpha_entries || upng->alpha[src[i]] != 0)
+                dst[i] = src[i];
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++, dst_bit += depth, src_bit += depth)
+    {
+        unsigned index = (src[src_bit >> 3] >> (8 - depth - (src_bit & 7))) & max;
+        unsigned shift = 8 - depth - (dst_bit & 7);
+        if (index < upng->alpha_entries && upng->alpha[index] == 0)
+            continue;
+        dst[dst_bit >> 3] = (uint8_t)((dst[dst_bit >> 3] & ~(max << shift)) | (index << shift));
+    }
+}
+
+/* whether the canvas is stored with premultiplied alpha */
+static int canvas_premultiplied(const upng_t *upng)
+{
+    return upng->blend_mode == UPNG_BLEND_PREMULTIPLIED &&
+        (upng->canvas.format == UPNG_RGBA8 || upng->canvas.format == UPNG_LUMINANCE_ALPHA8);
+}
+
+/* 8 bit RGBA is truncated to 2 bits per channel like the color macros of the Pebble SDK */
+static void pack_argb2222(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    unsigned long i;
+    for (i = 0; i < count; i++, src += 4)
+        dst[i] = (uint8_t)((src[3] >> 6) << 6 | (src[0] >> 6) << 4 | (src[1] >> 6) << 2 | src[2] >> 6);
+}
+
+/* copies or blends up to 64 RGBA8 pixels onto an UPNG_ARGB2222 canvas */
+static void blend_argb2222(uint8_t *dst, const uint8_t *src, unsigned long count, upng_blend_op op)
+{
+    uint8_t rgba[4 * 64];
+
+    if (op == UPNG_BLEND_OP_OVER)
+    {
+        upng_unpack_argb2222(rgba, dst, count);
+        upng_get_kernels()->blend_rgba8(rgba, src, count);
+        src = rgba;
+    }
+    pack_argb2222(dst, src, count);
+}
+
+/* copies or blends pixels in the canvas format */
+static void blend_pixels(upng_t *upng, uint8_t *dst, const uint8_t *src, unsigned long count, upng_blend_op op)
+{
+    const upng_kernels *kernels = upng_get_kernels();
+    int premultiplied = canvas_premultiplied(upng);
+    unsigned channels = upng->canvas.format == UPNG_RGBA8 ? 3 : 1;
+
+    if (op == UPNG_BLEND_OP_SOURCE)
+    {
+        if (premultiplied)
+            premultiply(dst, src, count, channels);
+        else
+            memcpy(dst, src, count * (channels + 1));
+    }
+    else if (upng->canvas.format == UPNG_RGBA8)
+        (premultiplied ? kernels->blend_rgba8_premultiplied : kernels->blend_rgba8)(dst, src, count);
+    else
+        (premultiplied ? kernels->blend_la8_premultiplied : kernels->blend_la8)(dst, src, count);
+}
+
+/* blends width pixels of the frame row starting at pixel src_x */
+static void blend_row(upng_t *upng, uint8_t *dst, unsigned long dst_bit, const uint8_t *src, unsigned src_x, unsigned width, upng_blend_op op)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned long src_bit = (unsigned long)src_x * upng_get_bpp(upng);
+    uint8_t rgba[4 * 64];
+    unsigned x;
+
+    if (canvas->format != upng->format)
+    {
+        /* indexed frames and frames for UPNG_ARGB2222 canvases are expanded in small batches */
+        for (x = 0; x < width; x += 64)
+        {
+            unsigned count = width - x < 64 ? width - x : 64;
+            upng_convert_row_rgba8(upng, rgba, src, src_x + x, count);
+            if (canvas->format == UPNG_ARGB2222)
+                blend_argb2222(dst + (dst_bit >> 3) + x, rgba, count, op);
+            else
+                blend_pixels(upng, dst + (dst_bit >> 3) + x * 4, rgba, count, op);
+        }
+        return;
+    }
+
+    switch (canvas->format)
+    {
+    case UPNG_RGBA8:
+    case UPNG_LUMINANCE_ALPHA8:
+        blend_pixels(upng, dst + (dst_bit >> 3), src + (src_bit >> 3), width, op);
+        return;
+    case UPNG_RGBA16:
+        if (op == UPNG_BLEND_OP_OVER)
+        {
+            blend_rgba16_over(dst + (dst_bit >> 3), src + (src_bit >> 3), width);
+            return;
+        }
+        break;
+    case UPNG_LUMINANCE_ALPHA1:
+    case UPNG_LUMINANCE_ALPHA2:
+    case UPNG_LUMINANCE_ALPHA4:
+        if (op == UPNG_BLEND_OP_OVER)
+        {
+            blend_luminance_alpha_over(dst, dst_bit, src, src_bit, width, upng->color_depth);
+            return;
+        }
+        break;
+    case UPNG_INDEXED1:
+    case UPNG_INDEXED2:
+    case UPNG_INDEXED4:
+    case UPNG_INDEXED8:
+        if (op == UPNG_BLEND_OP_OVER)
+        {
+            blend_indexed_over(upng, dst, dst_bit, src, src_bit, width, upng->color_depth);
+            return;
+        }
+        break;
+    default:
+        /* no alpha channel means full alpha, so over is the same as copy */
+        break;
+    }
+
+    upng_copy_bits(dst, dst_bit, src, src_bit, (unsigned long)width * canvas->bpp);
+}
+
+/* fills the rect of a frame of a single color by blending its first row and repeating that,
+ * returns 0 if the color is translucent and over has to blend every pixel */
+static int fill_frame(upng_t *upng, const upng_frame *frame, upng_blend_op op)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned long bit = (unsigned long)frame->rect.x_offset * canvas->bpp;
+    unsigned long bits = (unsigned long)frame->rect.width * canvas->bpp;
+    uint8_t *first = canvas->data + frame->rect.y_offset * canvas->stride;
+    uint8_t rgba[4];
+    unsigned alpha, max = 0xFF, y;
+
+    /* the conversion to 8 bits would round 16 bit alpha to opaque or transparent */
+    if (upng->format == UPNG_RGBA16)
+    {
+        alpha = MAKE_WORD_PTR(upng->buffer + 6);
+        max = 0xFFFF;
+    }
+    else
+    {
+        upng_convert_row_rgba8(upng, rgba, upng->buffer, 0, 1);
+        alpha = rgba[3];
+    }
+    if (op == UPNG_BLEND_OP_OVER && alpha == 0)
+        return 1;
+    if (op == UPNG_BLEND_OP_OVER && alpha != max)
+        return 0;
+
+    blend_row(upng, first, bit, upng->buffer, 0, frame->rect.width, UPNG_BLEND_OP_SOURCE);
+    for (y = 1; y < frame->rect.height; y++)
+        upng_copy_bits(first + y * canvas->stride, bit, first, bit, bits);
+    return 1;
+}
+
+/* blends the frame in the frame buffer onto the canvas */
+static upng_error blend_frame(upng_t *upng, const upng_frame *frame)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned long src_linebytes = ((unsigned long)frame->rect.width * upng_get_bpp(upng) + 7) / 8;
+    const uint8_t *src = upng->buffer;
+    upng_blend_op op = frame->blend_op;
+    upng_rect area = { 0, 0, frame->rect.width, frame->rect.height };
+    unsigned x, y, end;
+
+    /* canvases of greyscale and RGB images in their own format have no alpha, so colour keyed pixels are copied as well */
+    if (op == UPNG_BLEND_OP_OVER && canvas->format == upng->format && (upng->color_type == UPNG_LUM || upng->color_type == UPNG_RGB))
+        op = UPNG_BLEND_OP_SOURCE;
+
+    if (upng->frame_solid && canvas->tiles == NULL && frame->rect.width > 0 && fill_frame(upng, frame, op))
+        return UPNG_EOK;
+
+    /* analytics tell us whether over can be replaced by copying or skipped altogether */
+    if (op == UPNG_BLEND_OP_OVER && upng->analytics_state.valid)
+    {
+        if (upng->analytics.opaque)
+            op = UPNG_BLEND_OP_SOURCE;
+        else if (upng->analytics.bounds.width == 0)
+            return UPNG_EOK;
+        else
+            area = upng->analytics.bounds; /* over leaves the canvas alone where the frame is transparent */
+    }
+
+    src += area.y_offset * src_linebytes;
+    for (y = frame->rect.y_offset + area.y_offset; y < frame->rect.y_offset + area.y_offset + area.height; y++, src += src_linebytes)
+    {
+        x = frame->rect.x_offset + area.x_offset;
+        end = x + area.width;
+        if (canvas->tiles == NULL)
+        {
+            blend_row(upng, canvas->data + y * canvas->stride, (unsigned long)x * canvas->bpp, src, x - frame->rect.x_offset, area.width, op);
+            continue;
+        }
+        /* only the tiles the frame touches are written */
+        for (; x < end; x = (x / UPNG_TILE_SIZE + 1) * UPNG_TILE_SIZE)
+        {
+            unsigned tile_end = (x / UPNG_TILE_SIZE + 1) * UPNG_TILE_SIZE;
+            uint8_t *row = upng_tile_row(upng, x, y);
+            if (row == NULL)
+                return upng->error;
+            blend_row(upng, row, (unsigned long)(x % UPNG_TILE_SIZE) * canvas->bpp, src, x - frame->rect.x_offset,
+                (tile_end < end ? tile_end : end) - x, op);
+        }
+    }
+    if (canvas->tiles != NULL)
+        upng_tiles_share(upng, &frame->rect);
+    return UPNG_EOK;
+}
+
+/* applies the dispose operation of the frame currently on the canvas */
+static upng_error dispose_frame(upng_t *upng, unsigned index)
+{
+    const upng_frame *frame = &upng->frames[index];
+    switch (effective_dispose_op(upng, index))
+    {
+    case UPNG_DISPOSE_OP_BACKGROUND:
+        return clear_rect(upng, &frame->rect);
+    case UPNG_DISPOSE_OP_PREVIOUS:
+        restore_rect(upng, &frame->rect);
+        break;
+    default:
+        break;
+    }
+    return UPNG_EOK;
+}
+
+/* whether compositing can start at a keyframe and continue up to the target frame */
+static int keyframe_usable(const upng_t *upng, unsigned index, unsigned target)
+{
+    unsigned kind = upng->frames[index].keyframe;
+    if (kind & UPNG_KEYFRAME_CLEAR)
+        return 1;
+    /* restoring the canvas before a covering frame needs the frames before it */
+    return (kind & UPNG_KEYFRAME_COVER) &&
+        (index == target || effective_dispose_op(upng, index) != UPNG_DISPOSE_OP_PREVIOUS);
+}
+
+void upng_classify_keyframe(upng_t *upng, unsigned index)
+{
+    const upng_rect *canvas = &upng->defaultImage.rect;
+    upng_frame *frame = &upng->frames[index];
+
+    frame->keyframe = 0;
+    if (index == 0)
+        frame->keyframe |= UPNG_KEYFRAME_CLEAR;
+    else if (upng->frames[index - 1].rect.width == canvas->width && upng->frames[index - 1].rect.height == canvas->height &&
+        effective_dispose_op(upng, index - 1) == UPNG_DISPOSE_OP_BACKGROUND)
+        frame->keyframe |= UPNG_KEYFRAME_CLEAR;
+    if (frame->rect.width == canvas->width && frame->rect.height == canvas->height &&
+        frame->blend_op == UPNG_BLEND_OP_SOURCE)
+        frame->keyframe |= UPNG_KEYFRAME_COVER;
+}
+
+static void free_snapshots(upng_t *upng)
+{
+    unsigned i;
+    if (upng->snapshots != NULL)
+    {
+        for (i = 0; i < upng->snapshot_count; i++)
+        {
+            if (upng->snapshots[i] != NULL)
+                UPNG_MEM_FREE(upng->snapshots[i]);
+        }
+        UPNG_MEM_FREE(upng->snapshots);
+    }
+    upng->snapshots = NULL;
+    upng->snapshot_count = 0;
+    upng->snapshot_interval = 0;
+}
+
+/* spreads as many snapshots as fit into the budget evenly over the animation */
+static void ensure_snapshots(upng_t *upng)
+{
+    unsigned long count;
+    unsigned interval;
+
+    /* a snapshot would be a linear copy of a tiled canvas, or overwrite all of the rows of an external one */
+    if (upng->snapshots != NULL || upng->canvas.size == 0 || upng->frame_count < 2 || upng->canvas.tiles != NULL ||
+        upng->external_canvas != NULL)
+        return;
+    count = upng->snapshot_budget / upng->canvas.size;
+    if (count == 0)
+        return;
+    if (count > upng->frame_count - 1)
+        count = upng->frame_count - 1;
+
+    interval = (unsigned)((upng->frame_count + count) / (count + 1));
+    count = (upng->frame_count - 1) / interval;
+
+    /* snapshots only speed up seeking, not having them is no error */
+    upng->snapshots = (uint8_t**)UPNG_MEM_ALLOC(sizeof(uint8_t*) * count);
+    if (upng->snapshots == NULL)
+        return;
+    memset(upng->snapshots, 0, sizeof(uint8_t*) * count);
+    upng->snapshot_count = (unsigned)count;
+    upng->snapshot_interval = interval;
+}
+
+/* keeps the canvas before the frame if the frame is due for a snapshot */
+static void take_snapshot(upng_t *upng, unsigned index)
+{
+    unsigned slot;
+
+    ensure_snapshots(upng);
+    if (upng->snapshots == NULL || index == 0 || index % upng->snapshot_interval != 0)
+        return;
+    slot = index / upng->snapshot_interval - 1;
+    if (slot >= upng->snapshot_count || upng->snapshots[slot] != NULL)
+        return;
+    /* keyframes are starting points already */
+    if (keyframe_usable(upng, index, FRAME_INDEX_NONE))
+        return;
+
+    upng->snapshots[slot] = (uint8_t*)UPNG_MEM_ALLOC(upng->canvas.size);
+    if (upng->snapshots[slot] != NULL)
+        memcpy(upng->snapshots[slot], upng->canvas.data, upng->canvas.size);
+}
+
+/* how the canvas is brought into the state before a frame */
+typedef enum upng_prepare
+{
+    PREPARE_DISPOSE, /* the canvas contains the frame before, apply its dispose operation */
+    PREPARE_CLEAR,
+    PREPARE_NONE /* the canvas was restored from a snapshot */
+} upng_prepare;
+
+/* decodes a frame and composites it onto the canvas */
+static upng_error composite_step(upng_t *upng, unsigned index, upng_prepare prepare)
+{
+    const upng_frame *frame = &upng->frames[index];
+
+    if (upng_decode_frame(upng, frame) != UPNG_EOK)
+        return upng->error;
+    if (ensure_canvas(upng) != UPNG_EOK)
+        return upng->error;
+
+    if (prepare == PREPARE_CLEAR)
+    {
+        /* the padding of the rows of an external canvas belongs to the caller */
+        if (upng->canvas.tiles != NULL || upng->external_canvas != NULL)
+        {
+            if (clear_rect(upng, &upng->defaultImage.rect) != UPNG_EOK)
+                return upng->error;
+        }
+        else
+            memset(upng->canvas.data, upng->canvas.clear, upng->canvas.size);
+    }
+    else if (prepare == PREPARE_DISPOSE)
+    {
+        if (dispose_frame(upng, upng->composed_frame) != UPNG_EOK)
+            return upng->error;
+    }
+    take_snapshot(upng, index);
+
+    if (effective_dispose_op(upng, index) == UPNG_DISPOSE_OP_PREVIOUS)
+    {
+        if (save_rect(upng, &frame->rect) != UPNG_EOK)
+            return upng->error;
+    }
+
+    if (blend_frame(upng, frame) != UPNG_EOK)
+        return upng->error;
+    upng->composed_frame = index;
+    upng->composed_skipped = 0;
+    return UPNG_EOK;
+}
+
+/*
+    frames in between which do not leave pixels behind are not decoded:
+    PREVIOUS restores the canvas before the frame, BACKGROUND only clears the frame rect
+*/
+static int skippable(const upng_t *upng, unsigned index)
+{
+    return effective_dispose_op(upng, index) != UPNG_DISPOSE_OP_NONE;
+}
+
+static upng_error skip_step(upng_t *upng, unsigned index)
+{
+    if (effective_dispose_op(upng, index) == UPNG_DISPOSE_OP_BACKGROUND)
+    {
+        if (dispose_frame(upng, upng->composed_frame) != UPNG_EOK)
+            return upng->error;
+        take_snapshot(upng, index);
+        /* the rect is cleared when the frame itself is disposed */
+        upng->composed_frame = index;
+        upng->composed_skipped = 1;
+    }
+    return UPNG_EOK;
+}
+
+/* finds the latest frame compositing can start at, the current canvas is preferred */
+static unsigned start_frame(upng_t *upng, unsigned index, upng_prepare *prepare)
+{
+    const uint8_t *snapshot = NULL;
+    unsigned start, slot;
+
+    for (start = index; start > 0 && !keyframe_usable(upng, start, index); start--)
+        ;
+    *prepare = PREPARE_CLEAR;
+
+    if (upng->snapshots != NULL && index >= upng->snapshot_interval)
+    {
+        slot = index / upng->snapshot_interval;
+        if (slot > upng->snapshot_count)
+            slot = upng->snapshot_count;
+        for (; slot > 0 && slot * upng->snapshot_interval > start; slot--)
+        {
+            if (upng->snapshots[slot - 1] != NULL)
+            {
+                snapshot = upng->snapshots[slot - 1];
+                start = slot * upng->snapshot_interval;
+                *prepare = PREPARE_NONE;
+                break;
+            }
+        }
+    }
+
+    if (upng->composed_frame != FRAME_INDEX_NONE && canvas_allocated(upng) &&
+        upng->composed_frame <= index && upng->composed_frame + 1 >= start)
+    {
+        *prepare = PREPARE_DISPOSE;
+        return upng->composed_frame + 1;
+    }
+
+    if (snapshot != NULL)
+        memcpy(upng->canvas.data, snapshot, upng->canvas.size);
+    upng->composed_frame = FRAME_INDEX_NONE;
+    return start;
+}
+
+int upng_canvas_holds(const upng_t *upng, unsigned index)
+{
+    /* a skipped frame only advanced the dispose state */
+    return index != FRAME_INDEX_NONE && canvas_allocated(upng) &&
+        ((upng->composed_frame == index && !upng->composed_skipped) || upng->cached_frame == index);
+}
+
+static void union_rect(upng_rect *rect, const upng_rect *other)
+{
+    int right, bottom;
+    if (other->width == 0 || other->height == 0)
+        return;
+    if (rect->width == 0 || rect->height == 0)
+    {
+        *rect = *other;
+        return;
+    }
+    right = rect->x_offset + (int)rect->width;
+    bottom = rect->y_offset + (int)rect->height;
+    if (other->x_offset + (int)other->width > right)
+        right = other->x_offset + (int)other->width;
+    if (other->y_offset + (int)other->height > bottom)
+        bottom = other->y_offset + (int)other->height;
+    if (other->x_offset < rect->x_offset)
+        rect->x_offset = other->x_offset;
+    if (other->y_offset < rect->y_offset)
+        rect->y_offset = other->y_offset;
+    rect->width = (unsigned)(right - rect->x_offset);
+    rect->height = (unsigned)(bottom - rect->y_offset);
+}
+
+/*
+    the canvas can only change inside the rect of the frame shown before (if it is disposed)
+    and the rects of all frames up to the new one, the canvas is saved if it should be tightened
+*/
+static void dirty_begin(upng_t *upng, unsigned index)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    upng_rect *dirty = &upng->dirty;
+    unsigned shown = upng->shown_frame, i;
+    unsigned long linebytes, y;
+
+    upng->dirty_saved = 0;
+    memset(dirty, 0, sizeof(upng_rect));
+    if (shown == index)
+        return;
+    if (shown == FRAME_INDEX_NONE || shown > index)
+    {
+        dirty->width = upng->defaultImage.rect.width;
+        dirty->height = upng->defaultImage.rect.height;
+    }
+    else
+    {
+        if (effective_dispose_op(upng, shown) != UPNG_DISPOSE_OP_NONE)
+            *dirty = upng->frames[shown].rect;
+        for (i = shown + 1; i <= index; i++)
+            union_rect(dirty, &upng->frames[i].rect);
+    }
+
+    if (!(upng->flags & UPNG_FLAG_TIGHT_DIRTY) || canvas->tiles != NULL || !upng_canvas_holds(upng, shown))
+        return;
+    linebytes = ((unsigned long)dirty->width * canvas->bpp + 7) / 8 + 1;
+    if (upng->dirty_size < linebytes * dirty->height)
+    {
+        if (upng->dirty_buffer != NULL)
+            UPNG_MEM_FREE(upng->dirty_buffer);
+        upng->dirty_size = 0;
+        upng->dirty_buffer = (uint8_t*)UPNG_MEM_ALLOC(linebytes * dirty->height);
+        /* without the copy the rect just stays loose */
+        if (upng->dirty_buffer == NULL)
+            return;
+        upng->dirty_size = linebytes * dirty->height;
+    }
+    for (y = 0; y < dirty->height; y++)
+    {
+        upng_copy_bits(upng->dirty_buffer + y * linebytes, 0,
+            canvas->data + (dirty->y_offset + y) * canvas->stride, (unsigned long)dirty->x_offset * canvas->bpp,
+            (unsigned long)dirty->width * canvas->bpp);
+    }
+    upng->dirty_saved = 1;
+}
+
+static int pixel_changed(const uint8_t *saved, const uint8_t *row, unsigned long x, unsigned long x_offset, unsigned bpp)
+{
+    unsigned long a = x * bpp, b = (x + x_offset) * bpp, bit;
+    if ((bpp & 7) == 0 && (b & 7) == 0)
+        return memcmp(saved + (a >> 3), row + (b >> 3), bpp >> 3) != 0;
+    for (bit = 0; bit < bpp; bit++, a++, b++)
+    {
+        if (((saved[a >> 3] >> (7 - (a & 7))) ^ (row[b >> 3] >> (7 - (b & 7)))) & 1)
+            return 1;
+    }
+    return 0;
+}
+
+/* shrinks the dirty rect to the pixels which changed their value */
+static void dirty_end(upng_t *upng, unsigned index)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    upng_rect *dirty = &upng->dirty;
+    unsigned long linebytes = ((unsigned long)dirty->width * canvas->bpp + 7) / 8 + 1;
+    unsigned long x, y, min_x = dirty->width, max_x = 0, min_y = dirty->height, max_y = 0;
+
+    upng->shown_frame = index;
+    if (!upng->dirty_saved)
+        return;
+    upng->dirty_saved = 0;
+
+    for (y = 0; y < dirty->height; y++)
+    {
+        const uint8_t *saved = upng->dirty_buffer + y * linebytes;
+        const uint8_t *row = canvas->data + (dirty->y_offset + y) * canvas->stride;
+        for (x = 0; x < dirty->width; x++)
+        {
+            if (!pixel_changed(saved, row, x, (unsigned long)dirty->x_offset, canvas->bpp))
+                continue;
+            if (x < min_x)
+                min_x = x;
+            if (x + 1 > max_x)
+                max_x = x + 1;
+            if (y < min_y)
+                min_y = y;
+            max_y = y + 1;
+        }
+    }
+
+    if (max_x == 0)
+    {
+        memset(dirty, 0, sizeof(upng_rect));
+        return;
+    }
+    dirty->x_offset += (int)min_x;
+    dirty->y_offset += (int)min_y;
+    dirty->width = (unsigned)(max_x - min_x);
+    dirty->height = (unsigned)(max_y - min_y);
+}
+
+upng_error upng_composite_frame(upng_t *upng, unsigned index)
+{
+    /* cached frames are linear copies which a tiled canvas would have to be exported for,
+     * and which would overwrite all of the rows of an external canvas */
+    int cache = upng->cache_budget > 0 && !(upng->flags & UPNG_FLAG_TILED_CANVAS) && upng->external_canvas == NULL;
+    upng_error error;
+    upng_prepare prepare;
+    unsigned i, start;
+
+    dirty_begin(upng, index);
+    if (cache)
+    {
+        if (ensure_canvas(upng) != UPNG_EOK)
+            return upng->error;
+        if (upng_cache_load(upng, index))
+        {
+            dirty_end(upng, index);
+            upng->composited = 1;
+            return UPNG_EOK;
+        }
+    }
+
+    start = start_frame(upng, index, &prepare);
+    upng->cached_frame = FRAME_INDEX_NONE;
+    for (i = start; i <= index; i++)
+    {
+        if (i != start && i != index && skippable(upng, i))
+            error = skip_step(upng, i);
+        else
+        {
+            if (i == index && cache)
+                upng_cache_prepare_delta(upng, index);
+            error = composite_step(upng, i, i == start ? prepare : PREPARE_DISPOSE);
+        }
+        if (error != UPNG_EOK)
+        {
+            upng->composed_frame = FRAME_INDEX_NONE;
+            upng->shown_frame = FRAME_INDEX_NONE;
+            return error;
+        }
+    }
+    if (cache)
+        upng_cache_store(upng, index);
+    dirty_end(upng, index);
+
+    upng->composited = 1;
+    return UPNG_EOK;
+}
+
+int upng_is_keyframe(const upng_t *upng, unsigned index)
+{
+    /* frames are classified once all of their chunks were scanned */
+    return index < upng->scanned_frames && upng->frames[index].keyframe != 0;
+}
+
+void upng_set_snapshot_budget(upng_t *upng, unsigned long bytes)
+{
+    free_snapshots(upng);
+    upng->snapshot_budget = bytes;
+}
+
+void upng_free_canvas(upng_t *upng)
+{
+    if (upng->canvas.data != NULL && upng->canvas.data != upng->external_canvas)
+        UPNG_MEM_FREE(upng->canvas.data);
+    upng_tiles_free(upng);
+    memset(&upng->canvas, 0, sizeof(upng->canvas));
+
+    if (upng->save_buffer != NULL)
+        UPNG_MEM_FREE(upng->save_buffer);
+    upng->save_buffer = NULL;
+    upng->save_size = 0;
+    free_snapshots(upng);
+
+    if (upng->dirty_buffer != NULL)
+        UPNG_MEM_FREE(upng->dirty_buffer);
+    upng->dirty_buffer = NULL;
+    upng->dirty_size = 0;
+    upng->shown_frame = FRAME_INDEX_NONE;
+
+    upng->composed_frame = FRAME_INDEX_NONE;
+    upng->composited = 0;
+}
+
+void upng_set_compositing(upng_t *upng, int enabled)
+{
+    if (enabled)
+        upng->flags |= UPNG_FLAG_COMPOSITE;
+    else
+    {
+        upng->flags &= ~UPNG_FLAG_COMPOSITE;
+        upng_free_canvas(upng);
+        upng_free_cache(upng);
+    }
+}
+
+void upng_set_blend_mode(upng_t *upng, upng_blend_mode mode)
+{
+    /* the canvas content depends on the mode */
+    if (mode != upng->blend_mode)
+    {
+        upng->composed_frame = FRAME_INDEX_NONE;
+        free_snapshots(upng);
+        upng_free_cache(upng);
+    }
+    upng->blend_mode = mode;
+}
+
+void upng_set_tight_dirty_rects(upng_t *upng, int enabled)
+{
+    if (enabled)
+        upng->flags |= UPNG_FLAG_TIGHT_DIRTY;
+    else
+        upng->flags &= ~UPNG_FLAG_TIGHT_DIRTY;
+}
+
+upng_error upng_get_dirty_rect(const upng_t *upng, upng_rect *rect)
+{
+    if (!upng->composited)
+        return UPNG_EPARAM;
+    *rect = upng->dirty;
+    return UPNG_EOK;
+}
+
+void upng_set_indexed_compositing(upng_t *upng, int enabled)
+{
+    /* canvases, snapshots and cached frames are in the old format */
+    upng_free_canvas(upng);
+    upng_free_cache(upng);
+    if (enabled)
+        upng->flags |= UPNG_FLAG_INDEXED_CANVAS;
+    else
+        upng->flags &= ~UPNG_FLAG_INDEXED_CANVAS;
+}
+
+void upng_set_tiled_canvas(upng_t *upng, int enabled)
+{
+    upng_free_canvas(upng);
+    upng_free_cache(upng);
+    if (enabled)
+        upng->flags |= UPNG_FLAG_TILED_CANVAS;
+    else
+        upng->flags &= ~UPNG_FLAG_TILED_CANVAS;
+}
+
+upng_error upng_set_external_canvas(upng_t *upng, uint8_t *data, unsigned long stride, upng_format format)
+{
+    /* the canvas is composited again from the start */
+    upng_free_canvas(upng);
+    upng_free_cache(upng);
+    upng->external_canvas = NULL;
+    if (data == NULL)
+        return UPNG_EOK;
+
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    CHECK_RET(upng, format == canvas_format(upng) || format == UPNG_ARGB2222, UPNG_EPARAM);
+    CHECK_RET(upng, stride >= ((unsigned long)upng->defaultImage.rect.width * upng_format_bpp(format) + 7) / 8, UPNG_EPARAM);
+
+    upng->external_canvas = data;
+    upng->external_stride = stride;
+    upng->external_format = format;
+    return UPNG_EOK;
+}
+
+upng_error upng_export_canvas(const upng_t *upng, uint8_t *out, unsigned long stride)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned y;
+
+    if (!upng->composited || !canvas_allocated(upng) || out == NULL || stride < canvas->stride)
+        return UPNG_EPARAM;
+    if (canvas->tiles != NULL)
+    {
+        upng_tiles_export(upng, out, stride);
+        return UPNG_EOK;
+    }
+    for (y = 0; y < upng->defaultImage.rect.height; y++)
+        memcpy(out + y * stride, canvas->data + y * canvas->stride, canvas->stride);
+    return UPNG_EOK;
+}
+
+upng_format upng_get_canvas_format(const upng_t *upng)
+{
+    return (upng->flags & UPNG_FLAG_COMPOSITE) ? canvas_format(upng) : upng->format;
+}
@@ -6,7 +6,19 @@
 /* if enabled, loading png's from file are supported */
 #define UPNG_USE_STDIO
 
-/* memory interface */
+/* if enabled, files can be memory mapped (POSIX) */
+#define UPNG_USE_MMAP
+
+/* if enabled, vectorized kernels are selected at runtime (x86 only) */
+#define UPNG_USE_SIMD
+
+/* if enabled, frames can be decoded ahead on a worker thread (pthreads) */
+#define UPNG_USE_THREADS
+
+/* if defined, gbitmap_sequence.h takes GBitmap and the resource functions from this firmware header */
+/* #define UPNG_GBITMAP_HEADER "pebble.h" */
+
+/* memory interface, has to be thread-safe if frames are decoded on several threads */
 void* test_upng_malloc(unsigned size, const char* file, int line);
 void test_upng_free(void* ptr);
 #define UPNG_MEM_ALLOC(size) test_upng_malloc((size), __FILE__, __LINE__)
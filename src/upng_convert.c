@@ -0,0 +1,237 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#include <string.h>
+
+/* scale a sample of the given (sub-byte) bit depth up to 8 bit */
+static uint8_t scale_sample(unsigned value, unsigned depth)
+{
+    switch (depth)
+    {
+    case 1:
+        return value ? 0xFF : 0x00;
+    case 2:
+        return (uint8_t)(value * 0x55);
+    case 4:
+        return (uint8_t)(value * 0x11);
+    default:
+        return (uint8_t)value;
+    }
+}
+
+/* read the sample at the given bit position, samples never cross byte boundaries */
+static unsigned read_sample(const uint8_t *row, unsigned long bitpos, unsigned depth)
+{
+    return (row[bitpos >> 3] >> (8 - depth - (bitpos & 7))) & ((1u << depth) - 1);
+}
+
+/* the tRNS chunk of greyscale and RGB images holds a 16 bit colour key per channel, pixels of exactly that colour are transparent */
+static int color_key(const upng_t *upng, unsigned channels, unsigned *key)
+{
+    unsigned c;
+    if (upng->alpha == NULL || upng->alpha_entries < 2 * channels)
+        return 0;
+    for (c = 0; c < channels; c++)
+        key[c] = MAKE_WORD_PTR(upng->alpha + 2 * c);
+    return 1;
+}
+
+/* the full sample at the given bit position, as the colour key is given */
+static unsigned raw_sample(const uint8_t *row, unsigned long bitpos, unsigned depth)
+{
+    if (depth == 16)
+        return MAKE_WORD_PTR(row + (bitpos >> 3));
+    if (depth == 8)
+        return row[bitpos >> 3];
+    return read_sample(row, bitpos, depth);
+}
+
+/*converts count pixels starting at pixel x of a scanline in the images format to 8 bit RGBA*/
+void upng_convert_row_rgba8(const upng_t *upng, uint8_t *out, const uint8_t *row, unsigned x, unsigned count)
+{
+    unsigned depth = upng->color_depth;
+    unsigned bpp = upng_get_bpp(upng);
+    unsigned long bitpos = (unsigned long)x * bpp;
+    unsigned key[3];
+    unsigned i;
+    int keyed;
+
+    switch (upng->color_type)
+    {
+    case UPNG_PLT:
+        for (i = 0; i < count; i++, bitpos += bpp, out += 4)
+        {
+            unsigned index = depth == 8 ? row[bitpos >> 3] : read_sample(row, bitpos, depth);
+            if (index < upng->palette_entries)
+            {
+                out[0] = upng->palette[index].r;
+                out[1] = upng->palette[index].g;
+                out[2] = upng->palette[index].b;
+            }
+            else
+                out[0] = out[1] = out[2] = 0;
+            out[3] = index < upng->alpha_entries ? upng->alpha[index] : 0xFF;
+        }
+        break;
+    case UPNG_LUM:
+        keyed = color_key(upng, 1, key);
+        for (i = 0; i < count; i++, bitpos += bpp, out += 4)
+        {
+            out[0] = out[1] = out[2] = depth >= 8
+                ? row[bitpos >> 3]
+                : scale_sample(read_sample(row, bitpos, depth), depth);
+            out[3] = keyed && raw_sample(row, bitpos, depth) == key[0] ? 0 : 0xFF;
+        }
+        break;
+    case UPNG_LUMA:
+        for (i = 0; i < count; i++, bitpos += bpp, out += 4)
+        {
+            if (depth >= 8)
+            {
+                out[0] = out[1] = out[2] = row[bitpos >> 3];
+                out[3] = row[(bitpos + depth) >> 3];
+            }
+            else
+            {
+                out[0] = out[1] = out[2] = scale_sample(read_sample(row, bitpos, depth), depth);
+                out[3] = scale_sample(read_sample(row, bitpos + depth, depth), depth);
+            }
+        }
+        break;
+    case UPNG_RGB:
+        keyed = color_key(upng, 3, key);
+        row += bitpos >> 3;
+        for (i = 0; i < count; i++, out += 4)
+        {
+            /* for 16 bit images only the high byte of every sample is used, except for the colour key */
+            unsigned step = depth / 8;
+            out[0] = row[0];
+            out[1] = row[step];
+            out[2] = row[2 * step];
+            out[3] = keyed && raw_sample(row, 0, depth) == key[0] && raw_sample(row, depth, depth) == key[1] &&
+                raw_sample(row, 2 * depth, depth) == key[2] ? 0 : 0xFF;
+            row += 3 * step;
+        }
+        break;
+    case UPNG_RGBA:
+        row += bitpos >> 3;
+        if (depth == 8)
+        {
+            memcpy(out, row, (unsigned long)count * 4);
+            break;
+        }
+        for (i = 0; i < count; i++, out += 4, row += 8)
+        {
+            out[0] = row[0];
+            out[1] = row[2];
+            out[2] = row[4];
+            out[3] = row[6];
+        }
+        break;
+    default:
+        memset(out, 0, (unsigned long)count * 4);
+        break;
+    }
+}
+
+/* expands UPNG_ARGB2222 pixels to 8 bit RGBA */
+void upng_unpack_argb2222(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    unsigned long i;
+    for (i = 0; i < count; i++, dst += 4)
+    {
+        dst[0] = (uint8_t)(((src[i] >> 4) & 3) * 0x55);
+        dst[1] = (uint8_t)(((src[i] >> 2) & 3) * 0x55);
+        dst[2] = (uint8_t)((src[i] & 3) * 0x55);
+        dst[3] = (uint8_t)((src[i] >> 6) * 0x55);
+    }
+}
+
+/*copies bits between two bit positions, whole bytes are copied at once if both positions are byte aligned*/
+void upng_copy_bits(uint8_t *out, unsigned long obp, const uint8_t *in, unsigned long ibp, unsigned long bits)
+{
+    if (((obp | ibp) & 7) == 0)
+    {
+        memmove(out + (obp >> 3), in + (ibp >> 3), bits >> 3);
+        obp += bits & ~7ul;
+        ibp += bits & ~7ul;
+        bits &= 7;
+    }
+
+    for (; bits > 0; bits--, ibp++, obp++)
+    {
+        if ((in[ibp >> 3] >> (7 - (ibp & 7))) & 1)
+            out[obp >> 3] |= (uint8_t)(1 << (7 - (obp & 7)));
+        else
+            out[obp >> 3] &= (uint8_t)~(1 << (7 - (obp & 7)));
+    }
+}
+
+/*fills bits with the bits of a byte pattern at the same positions within a byte*/
+void upng_fill_bits(uint8_t *out, unsigned long obp, unsigned long bits, uint8_t pattern)
+{
+    for (; bits > 0 && (obp & 7) != 0; bits--, obp++)
+    {
+        uint8_t mask = (uint8_t)(1 << (7 - (obp & 7)));
+        out[obp >> 3] = (uint8_t)((out[obp >> 3] & ~mask) | (pattern & mask));
+    }
+
+    memset(out + (obp >> 3), pattern, bits >> 3);
+    obp += bits & ~7ul;
+    bits &= 7;
+
+    for (; bits > 0; bits--, obp++)
+    {
+        uint8_t mask = (uint8_t)(1 << (7 - (obp & 7)));
+        out[obp >> 3] = (uint8_t)((out[obp >> 3] & ~mask) | (pattern & mask));
+    }
+}
+
+upng_error upng_get_frame_rgba8(const upng_t *upng, uint8_t *out)
+{
+    const uint8_t *row = upng_get_frame_buffer(upng);
+    const upng_rect *rect;
+    unsigned long stride;
+    unsigned y;
+
+    if (row == NULL)
+        return UPNG_EPARAM;
+    rect = upng->composited ? &upng->defaultImage.rect : &upng->decodedFrame->rect;
+    stride = upng->composited ? upng->canvas.stride : ((unsigned long)rect->width * upng_get_bpp(upng) + 7) / 8;
+
+    for (y = 0; y < rect->height; y++, row += stride, out += rect->width * 4)
+    {
+        if (upng->composited && upng->canvas.format == UPNG_ARGB2222)
+            upng_unpack_argb2222(out, row, rect->width);
+        else if (upng->composited && upng->canvas.format != upng->format)
+            memcpy(out, row, (unsigned long)rect->width * 4); /* indexed images composited in RGBA8 need no conversion */
+        else
+            upng_convert_row_rgba8(upng, out, row, 0, rect->width);
+    }
+    return UPNG_EOK;
+}
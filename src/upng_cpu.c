@@ -0,0 +1,133 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#include <stdlib.h>
+#ifdef UPNG_USE_THREADS
+#include <pthread.h>
+#endif
+
+static upng_kernels kernels;
+static unsigned detected_features;
+static unsigned enabled_features;
+#ifdef UPNG_USE_THREADS
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+#else
+static int initialized = 0;
+#endif
+
+static unsigned detect_features(void)
+{
+    unsigned features = 0;
+#ifdef UPNG_HAVE_X86_SIMD
+    const char *force_scalar = getenv("UPNG_FORCE_SCALAR");
+    if (force_scalar != NULL && force_scalar[0] != '\0' && force_scalar[0] != '0')
+        return 0;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        features |= UPNG_CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        features |= UPNG_CPU_AVX2;
+#endif
+    return features;
+}
+
+static void select_kernels(unsigned features)
+{
+    kernels.unfilter_sub = upng_unfilter_sub_scalar;
+    kernels.unfilter_up = upng_unfilter_up_scalar;
+    kernels.unfilter_avg = upng_unfilter_avg_scalar;
+    kernels.unfilter_paeth = upng_unfilter_paeth_scalar;
+    kernels.blend_rgba8 = upng_blend_rgba8_scalar;
+    kernels.blend_la8 = upng_blend_la8_scalar;
+    kernels.blend_rgba8_premultiplied = upng_blend_rgba8_premultiplied_scalar;
+    kernels.blend_la8_premultiplied = upng_blend_la8_premultiplied_scalar;
+
+#ifdef UPNG_HAVE_X86_SIMD
+    if (features & UPNG_CPU_SSE2)
+    {
+        kernels.unfilter_sub = upng_unfilter_sub_sse2;
+        kernels.unfilter_up = upng_unfilter_up_sse2;
+        kernels.unfilter_avg = upng_unfilter_avg_sse2;
+        kernels.unfilter_paeth = upng_unfilter_paeth_sse2;
+        kernels.blend_rgba8 = upng_blend_rgba8_sse2;
+        kernels.blend_la8 = upng_blend_la8_sse2;
+        kernels.blend_rgba8_premultiplied = upng_blend_rgba8_premultiplied_sse2;
+        kernels.blend_la8_premultiplied = upng_blend_la8_premultiplied_sse2;
+    }
+    if (features & UPNG_CPU_AVX2)
+    {
+        kernels.unfilter_up = upng_unfilter_up_avx2;
+        kernels.blend_rgba8 = upng_blend_rgba8_avx2;
+        kernels.blend_la8 = upng_blend_la8_avx2;
+        kernels.blend_rgba8_premultiplied = upng_blend_rgba8_premultiplied_avx2;
+        kernels.blend_la8_premultiplied = upng_blend_la8_premultiplied_avx2;
+    }
+#else
+    (void)features;
+#endif
+}
+
+static void detect(void)
+{
+    detected_features = detect_features();
+    enabled_features = detected_features;
+    select_kernels(enabled_features);
+}
+
+/* detection runs once, the table is complete before any thread reads it */
+static void initialize(void)
+{
+#ifdef UPNG_USE_THREADS
+    pthread_once(&initialized, detect);
+#else
+    if (initialized)
+        return;
+    detect();
+    initialized = 1;
+#endif
+}
+
+const upng_kernels* upng_get_kernels(void)
+{
+    initialize();
+    return &kernels;
+}
+
+unsigned upng_get_cpu_features(void)
+{
+    initialize();
+    return enabled_features;
+}
+
+void upng_set_cpu_features(unsigned features)
+{
+    initialize();
+    enabled_features = detected_features & features;
+    select_kernels(enabled_features);
+}
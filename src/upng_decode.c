@@ -30,6 +30,13 @@ freely, subject to the following restrictions:
 #include <string.h>
 #include <limits.h>
 
+#define DECODER_ERROR(decoder, code)       \
+    do                                     \
+    {                                      \
+        (decoder)->error = (code);         \
+        (decoder)->error_line = __LINE__;  \
+    } while (0)
+
 /*Paeth predicter, used by PNG filter type 4*/
 static int paeth_predictor(int a, int b, int c)
 {
@@ -46,7 +53,43 @@ static int paeth_predictor(int a, int b, int c)
         return c;
 }
 
-static void unfilter_scanline(upng_t *upng, uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, uint8_t filterType, unsigned long length)
+void upng_unfilter_sub_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i;
+    (void)precon;
+    for (i = 0; i < bytewidth; i++)
+        recon[i] = scanline[i];
+    for (i = bytewidth; i < length; i++)
+        recon[i] = scanline[i] + recon[i - bytewidth];
+}
+
+void upng_unfilter_up_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i;
+    (void)bytewidth;
+    for (i = 0; i < length; i++)
+        recon[i] = scanline[i] + precon[i];
+}
+
+void upng_unfilter_avg_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i;
+    for (i = 0; i < bytewidth; i++)
+        recon[i] = scanline[i] + precon[i] / 2;
+    for (i = bytewidth; i < length; i++)
+        recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
+}
+
+void upng_unfilter_paeth_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i;
+    for (i = 0; i < bytewidth; i++)
+        recon[i] = (uint8_t)(scanline[i] + paeth_predictor(0, precon[i], 0));
+    for (i = bytewidth; i < length; i++)
+        recon[i] = (uint8_t)(scanline[i] + paeth_predictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]));
+}
+
+static void unfilter_scanline(upng_decoder *decoder, uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, uint8_t filterType, unsigned long length)
 {
     /*
         For PNG filter method 0
@@ -54,8 +97,10 @@ static void unfilter_scanline(upng_t *upng, uint8_t *recon, const uint8_t *scanl
         precon is the previous unfiltered scanline, recon the result, scanline the current one
         the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
         recon and scanline MAY be the same memory address! precon must be disjoint.
+        the kernels for rows with a previous scanline are selected by the cpu dispatcher
         */
 
+    const upng_kernels *kernels = upng_get_kernels();
     unsigned long i;
     switch (filterType)
     {
@@ -64,27 +109,18 @@ static void unfilter_scanline(upng_t *upng, uint8_t *recon, const uint8_t *scanl
             recon[i] = scanline[i];
         break;
     case 1:
-        for (i = 0; i < bytewidth; i++)
-            recon[i] = scanline[i];
-        for (i = bytewidth; i < length; i++)
-            recon[i] = scanline[i] + recon[i - bytewidth];
+        kernels->unfilter_sub(recon, scanline, precon, bytewidth, length);
         break;
     case 2:
         if (precon)
-            for (i = 0; i < length; i++)
-                recon[i] = scanline[i] + precon[i];
+            kernels->unfilter_up(recon, scanline, precon, bytewidth, length);
         else
             for (i = 0; i < length; i++)
                 recon[i] = scanline[i];
         break;
     case 3:
         if (precon)
-        {
-            for (i = 0; i < bytewidth; i++)
-                recon[i] = scanline[i] + precon[i] / 2;
-            for (i = bytewidth; i < length; i++)
-                recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-        }
+            kernels->unfilter_avg(recon, scanline, precon, bytewidth, length);
         else
         {
             for (i = 0; i < bytewidth; i++)
@@ -95,12 +131,7 @@ static void unfilter_scanline(upng_t *upng, uint8_t *recon, const uint8_t *scanl
         break;
     case 4:
         if (precon)
-        {
-            for (i = 0; i < bytewidth; i++)
-                recon[i] = (uint8_t)(scanline[i] + paeth_predictor(0, precon[i], 0));
-            for (i = bytewidth; i < length; i++)
-                recon[i] = (uint8_t)(scanline[i] + paeth_predictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]));
-        }
+            kernels->unfilter_paeth(recon, scanline, precon, bytewidth, length);
         else
         {
             for (i = 0; i < bytewidth; i++)
@@ -110,12 +141,101 @@ static void unfilter_scanline(upng_t *upng, uint8_t *recon, const uint8_t *scanl
         }
         break;
     default:
-        SET_ERROR(upng, UPNG_EMALFORMED);
+        DECODER_ERROR(decoder, UPNG_EMALFORMED);
         break;
     }
 }
 
-static void unfilter(upng_t *upng, uint8_t *out, const uint8_t *in, unsigned w, unsigned h, unsigned bpp)
+static void analytics_begin(upng_decoder *decoder)
+{
+    upng_analytics_state *state = &decoder->analytics_state;
+    memset(state, 0, sizeof(*state));
+    state->min_x = state->min_y = UINT_MAX;
+
+    decoder->analytics.opaque = 1;
+    decoder->analytics.single_color = 1;
+}
+
+/* accumulates a single unfiltered scanline, converted to RGBA8 in small batches */
+static void analytics_row(upng_decoder *decoder, const uint8_t *row, unsigned y, unsigned w)
+{
+    upng_analytics_state *state = &decoder->analytics_state;
+    const upng_t *upng = decoder->upng;
+    uint8_t rgba[4 * 64];
+    unsigned x, i, row_min_x = UINT_MAX, row_max_x = 0;
+    unsigned pixel_bytes = upng_get_bpp(upng) / 8, max = 0xFF;
+    const uint8_t *alpha16 = NULL;
+
+    /* the 8 bit conversion keeps only the high byte of 16 bit alpha, which tells neither full nor zero alpha */
+    if (upng->color_depth == 16 && (upng->color_type == UPNG_RGBA || upng->color_type == UPNG_LUMA))
+    {
+        alpha16 = row + pixel_bytes - 2;
+        max = 0xFFFF;
+    }
+
+    if (state->count == 0 && w > 0)
+        upng_convert_row_rgba8(upng, state->first, row, 0, 1);
+
+    for (x = 0; x < w; x += 64)
+    {
+        unsigned count = w - x < 64 ? w - x : 64;
+        upng_convert_row_rgba8(upng, rgba, row, x, count);
+
+        for (i = 0; i < count; i++)
+        {
+            const uint8_t *pixel = rgba + 4 * i;
+            unsigned alpha = alpha16 != NULL ? MAKE_WORD_PTR(alpha16 + (unsigned long)(x + i) * pixel_bytes) : pixel[3];
+            if (alpha != max)
+                decoder->analytics.opaque = 0;
+            if (decoder->analytics.single_color && memcmp(pixel, state->first, 4) != 0)
+                decoder->analytics.single_color = 0;
+            if (alpha != 0)
+            {
+                if (row_min_x == UINT_MAX)
+                    row_min_x = x + i;
+                row_max_x = x + i + 1;
+            }
+            state->sum[0] += pixel[0];
+            state->sum[1] += pixel[1];
+            state->sum[2] += pixel[2];
+            state->sum[3] += pixel[3];
+        }
+    }
+    state->count += w;
+
+    if (row_min_x != UINT_MAX)
+    {
+        if (state->min_y == UINT_MAX)
+            state->min_y = y;
+        state->max_y = y + 1;
+        if (row_min_x < state->min_x)
+            state->min_x = row_min_x;
+        if (row_max_x > state->max_x)
+            state->max_x = row_max_x;
+    }
+}
+
+static void analytics_end(upng_decoder *decoder)
+{
+    upng_analytics_state *state = &decoder->analytics_state;
+    unsigned c;
+
+    for (c = 0; c < 4; c++)
+        decoder->analytics.average[c] = state->count ? (uint8_t)((state->sum[c] + state->count / 2) / state->count) : 0;
+
+    if (state->min_y == UINT_MAX)
+        memset(&decoder->analytics.bounds, 0, sizeof(upng_rect));
+    else
+    {
+        decoder->analytics.bounds.x_offset = state->min_x;
+        decoder->analytics.bounds.y_offset = state->min_y;
+        decoder->analytics.bounds.width = state->max_x - state->min_x;
+        decoder->analytics.bounds.height = state->max_y - state->min_y;
+    }
+    state->valid = 1;
+}
+
+static void unfilter(upng_decoder *decoder, uint8_t *out, const uint8_t *in, unsigned w, unsigned h, unsigned bpp, int analyze)
 {
     /*
         For PNG filter method 0
@@ -137,16 +257,102 @@ static void unfilter(upng_t *upng, uint8_t *out, const uint8_t *in, unsigned w,
         unsigned long inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row */
         uint8_t filterType = in[inindex];
 
-        unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
-        if (upng->error != UPNG_EOK)
+        unfilter_scanline(decoder, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
+        if (decoder->error != UPNG_EOK)
         {
             return;
         }
 
+        if (analyze)
+            analytics_row(decoder, &out[outindex], y, w);
+
         prevline = &out[outindex];
     }
 }
 
+/* filtered byte of a pixel in a frame of that single color, depending on which neighbours precede it */
+static uint8_t solid_filter_byte(uint8_t filterType, uint8_t value, int left, int up)
+{
+    int a = left ? value : 0, b = up ? value : 0, c = left && up ? value : 0;
+    switch (filterType)
+    {
+    case 0:
+        return value;
+    case 1:
+        return (uint8_t)(value - a);
+    case 2:
+        return (uint8_t)(value - b);
+    case 3:
+        return (uint8_t)(value - (a + b) / 2);
+    default:
+        return (uint8_t)(value - paeth_predictor(a, b, c));
+    }
+}
+
+/*
+    Frames of a single color, like cleared frames, are usually compressed as their first pixel followed by
+    long matches of the filtered bytes it predicts. These are detected on the inflated rows and filled
+    with the pixel instead of being unfiltered, which also lets the compositor fill instead of blend.
+    Sub-byte pixels have to repeat within a byte and rows have to end on a byte boundary.
+*/
+static int fill_solid_frame(upng_decoder *decoder, uint8_t *out, const upng_frame *frame)
+{
+    unsigned bpp = upng_get_bpp(decoder->upng);
+    unsigned w = frame->rect.width;
+    unsigned h = frame->rect.height;
+    unsigned long bytewidth = (bpp + 7) / 8;
+    unsigned long linebytes = ((unsigned long)w * bpp + 7) / 8;
+    const uint8_t *in = out;
+    uint8_t pixel[8], expected[8];
+    unsigned long i, k, n;
+    unsigned y;
+
+    if (bpp == 0 || w == 0 || h == 0 || bytewidth > sizeof(pixel))
+        return 0;
+    if (bpp < 8 && (((unsigned long)w * bpp) % 8 != 0 || (uint8_t)(in[1] << bpp | in[1] >> (8 - bpp)) != in[1]))
+        return 0;
+
+    /* the first pixel is never predicted from anything */
+    memcpy(pixel, in + 1, bytewidth);
+    for (y = 0; y < h; y++, in += linebytes + 1)
+    {
+        uint8_t filterType = in[0];
+        if (filterType > 4)
+            return 0;
+        for (k = 0; k < bytewidth; k++)
+        {
+            if (in[1 + k] != solid_filter_byte(filterType, pixel[k], 0, y > 0))
+                return 0;
+            expected[k] = solid_filter_byte(filterType, pixel[k], 1, y > 0);
+        }
+        for (i = bytewidth, k = 0; i < linebytes; i++, k = k + 1 < bytewidth ? k + 1 : 0)
+        {
+            if (in[1 + i] != expected[k])
+                return 0;
+        }
+    }
+
+    /* the inflated rows are not needed anymore, so the frame can overwrite them */
+    memcpy(out, pixel, bytewidth);
+    for (n = bytewidth; n < linebytes; n *= 2)
+        memcpy(out + n, out, n < linebytes - n ? n : linebytes - n);
+    for (y = 1; y < h; y++)
+        memcpy(out + y * linebytes, out, linebytes);
+
+    if (decoder->analyze)
+    {
+        upng_analytics_state *state = &decoder->analytics_state;
+        analytics_row(decoder, out, 0, w);
+        for (k = 0; k < 4; k++)
+            state->sum[k] *= h;
+        state->count *= h;
+        if (state->min_y != UINT_MAX)
+            state->max_y = h;
+    }
+    decoder->solid = 1;
+    return 1;
+}
+
 static void remove_padding_bits(uint8_t *out, const uint8_t *in, unsigned long olinebits, unsigned long ilinebits, unsigned h)
 {
     /*
@@ -177,22 +383,23 @@ static void remove_padding_bits(uint8_t *out, const uint8_t *in, unsigned long o
 }
 
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks*/
-static void post_process_scanlines(upng_t *upng, uint8_t *out, uint8_t *in, const upng_frame *frame)
+static void post_process_scanlines(upng_decoder *decoder, uint8_t *out, uint8_t *in, const upng_frame *frame)
 {
-    unsigned bpp = upng_get_bpp(upng);
+    unsigned bpp = upng_get_bpp(decoder->upng);
     unsigned w = frame->rect.width;
     unsigned h = frame->rect.height;
 
     if (bpp == 0)
     {
-        SET_ERROR(upng, UPNG_EMALFORMED);
+        DECODER_ERROR(decoder, UPNG_EMALFORMED);
         return;
     }
 
+    int analyze = decoder->analyze;
     if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-        unfilter(upng, in, in, w, h, bpp);
-        if (upng->error != UPNG_EOK)
+        unfilter(decoder, in, in, w, h, bpp, analyze);
+        if (decoder->error != UPNG_EOK)
         {
             return;
         }
@@ -203,120 +410,457 @@ static void post_process_scanlines(upng_t *upng, uint8_t *out, uint8_t *in, cons
     }
     else
     {
-        unfilter(upng, in, in, w, h, bpp); /*we can immediatly filter into the out buffer, no other steps needed */
+        unfilter(decoder, in, in, w, h, bpp, analyze); /*we can immediatly filter into the out buffer, no other steps needed */
     }
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode_frame(upng_t *upng, const upng_frame* frame)
+/* Adam7 pass geometry: first pixel, distance between pixels and the block a pixel covers in the preview */
+static const uint8_t ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static const uint8_t ADAM7_IY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+static const uint8_t ADAM7_DX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const uint8_t ADAM7_DY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+static const uint8_t ADAM7_BW[7] = { 8, 4, 4, 2, 2, 1, 1 };
+static const uint8_t ADAM7_BH[7] = { 8, 8, 4, 4, 2, 2, 1 };
+
+static void adam7_pass_size(unsigned pass, unsigned w, unsigned h, unsigned *pass_w, unsigned *pass_h)
 {
-    uint8_t *compressed = NULL;
-    unsigned long compressed_index = 0;
-    unsigned long inflated_size;
-    unsigned long chunk_offset;
-    uint8_t chunk_header[12];
-    upng_error error;
+    *pass_w = w > ADAM7_IX[pass] ? (w - ADAM7_IX[pass] + ADAM7_DX[pass] - 1) / ADAM7_DX[pass] : 0;
+    *pass_h = h > ADAM7_IY[pass] ? (h - ADAM7_IY[pass] + ADAM7_DY[pass] - 1) / ADAM7_DY[pass] : 0;
+}
 
-    /* parse the main header, if necessary */
-    upng_header(upng);
-    if (upng->error != UPNG_EOK)
-    {
-        return upng->error;
-    }
+/* size of the inflated (still filtered) data of a frame, including filter bytes */
+static unsigned long inflated_frame_size(const upng_t *upng, const upng_frame *frame)
+{
+    unsigned bpp = upng_get_bpp(upng);
+    unsigned long size = 0;
+    unsigned pass, pass_w, pass_h;
 
-    /* if we are not ready to decode the image, stop now */
-    if (upng->state != UPNG_HEADER && upng->state != UPNG_DECODED)
+    if (upng->interlace_method == 0)
+        return ((frame->rect.width * bpp + 7) / 8 + 1) * (unsigned long)frame->rect.height;
+
+    for (pass = 0; pass < 7; pass++)
     {
-        return upng->error;
+        adam7_pass_size(pass, frame->rect.width, frame->rect.height, &pass_w, &pass_h);
+        /* empty passes do not even contain filter bytes */
+        if (pass_w > 0 && pass_h > 0)
+            size += ((pass_w * bpp + 7) / 8 + 1) * (unsigned long)pass_h;
     }
+    return size;
+}
 
-    /* allocate enough space for the (compressed and filtered) image data */
-    compressed = (uint8_t *)UPNG_MEM_ALLOC(frame->compressed_size);
-    CHECK_RET(upng, compressed != NULL, UPNG_ENOMEM);
+/* scatters an unfiltered reduced image into its final positions, pointers step by a per-pass stride instead of computing coordinates per pixel */
+static void adam7_scatter(uint8_t *out, const uint8_t *in, unsigned pass, unsigned pass_w, unsigned pass_h, unsigned long linebytes, unsigned bpp)
+{
+    unsigned long pass_linebytes = (pass_w * bpp + 7) / 8;
+    unsigned x, y;
 
-    /* scan through the chunks again, this time copying the values into
-     * our compressed buffer.  there's no reason to validate anything a second time. */
-    chunk_offset = frame->data_chunk_offset;
-    while (chunk_offset < upng->source.size)
+    if (bpp >= 8)
     {
-        unsigned long chunk_data_offset = upng_chunk_data(chunk_offset);
-        unsigned long length;
-
-        /* read chunk header */
-        CHECK_GOTO(upng, upng->source.read(upng->source.user, chunk_offset, chunk_header, 12) == 12, UPNG_EREAD, error);
+        unsigned bytes = bpp / 8;
+        unsigned long dst_step = (unsigned long)ADAM7_DX[pass] * bytes;
+        uint8_t *dst_row = out + ADAM7_IY[pass] * linebytes + ADAM7_IX[pass] * bytes;
 
-        length = upng_chunk_length(chunk_header);
-
-        /* collect data chunks */
-        if (upng_chunk_type(chunk_header) == CHUNK_IDAT)
+        for (y = 0; y < pass_h; y++, in += pass_linebytes, dst_row += ADAM7_DY[pass] * linebytes)
         {
-            CHECK_GOTO(upng, upng->source.read(upng->source.user, chunk_data_offset, compressed + compressed_index, length) == length, UPNG_EREAD, error);
-            compressed_index += length;
+            const uint8_t *src = in;
+            uint8_t *dst = dst_row;
+            switch (bytes)
+            {
+            case 1:
+                for (x = 0; x < pass_w; x++, dst += dst_step)
+                    *dst = *src++;
+                break;
+            case 4:
+                for (x = 0; x < pass_w; x++, dst += dst_step, src += 4)
+                    memcpy(dst, src, 4);
+                break;
+            default:
+                for (x = 0; x < pass_w; x++, dst += dst_step, src += bytes)
+                    memcpy(dst, src, bytes);
+                break;
+            }
         }
-        else if (upng_chunk_type(chunk_header) == CHUNK_FDAT)
+    }
+    else
+    {
+        unsigned long dst_step = (unsigned long)ADAM7_DX[pass] * bpp;
+        unsigned long dst_row_bit = (ADAM7_IY[pass] * linebytes) * 8 + ADAM7_IX[pass] * bpp;
+
+        for (y = 0; y < pass_h; y++, in += pass_linebytes, dst_row_bit += ADAM7_DY[pass] * linebytes * 8)
         {
-            CHECK_GOTO(upng, upng->source.read(upng->source.user, chunk_data_offset + 4, compressed + compressed_index, length - 4) == length - 4, UPNG_EREAD, error);
-            compressed_index += length - 4;
+            unsigned long obp = dst_row_bit, ibp = 0;
+            for (x = 0; x < pass_w; x++, obp += dst_step, ibp += bpp)
+                upng_copy_bits(out, obp, in, ibp, bpp);
         }
-        else if (upng_chunk_type(chunk_header) == CHUNK_IEND || upng_chunk_type(chunk_header) == CHUNK_FCTL)
+    }
+}
+
+/* fills the block every pixel of a pass stands for, this is only used for progressive previews */
+static void adam7_replicate(uint8_t *out, unsigned pass, unsigned w, unsigned h, unsigned long linebytes, unsigned bpp)
+{
+    unsigned x, y, bx, by;
+
+    for (y = ADAM7_IY[pass]; y < h; y += ADAM7_DY[pass])
+    {
+        const uint8_t *src_row = out + y * linebytes;
+        for (by = 0; by < ADAM7_BH[pass] && y + by < h; by++)
         {
-            break;
+            uint8_t *dst_row = out + (y + by) * linebytes;
+            for (x = ADAM7_IX[pass]; x < w; x += ADAM7_DX[pass])
+            {
+                for (bx = by == 0 ? 1 : 0; bx < ADAM7_BW[pass] && x + bx < w; bx++)
+                {
+                    if (bpp >= 8)
+                        memcpy(dst_row + (x + bx) * (bpp / 8), src_row + x * (bpp / 8), bpp / 8);
+                    else
+                        upng_copy_bits(dst_row, (unsigned long)(x + bx) * bpp, src_row, (unsigned long)x * bpp, bpp);
+                }
+            }
         }
+    }
+}
+
+/* unfilters all seven reduced images one by one and scatters them into out */
+static void adam7_deinterlace(upng_decoder *decoder, uint8_t *out, uint8_t *in, const upng_frame *frame)
+{
+    const upng_t *upng = decoder->upng;
+    unsigned bpp = upng_get_bpp(upng);
+    unsigned w = frame->rect.width;
+    unsigned h = frame->rect.height;
+    unsigned long linebytes = (w * bpp + 7) / 8;
+    unsigned pass, pass_w, pass_h, y;
+
+    if (bpp == 0)
+    {
+        DECODER_ERROR(decoder, UPNG_EMALFORMED);
+        return;
+    }
 
-        chunk_offset += length + 12;
+    /* the passes only write pixel bits, the padding at the end of the rows is zero like in progressive images */
+    if ((w * bpp) % 8 != 0)
+    {
+        for (y = 0; y < h; y++)
+            out[y * linebytes + linebytes - 1] = 0;
     }
 
-    /* allocate space to store inflated (but still filtered) data */
-    int width_aligned_bytes = (frame->rect.width * upng_get_bpp(upng) + 7) / 8;
-    inflated_size = (width_aligned_bytes * frame->rect.height) + frame->rect.height; // pad byte
-    if (upng->size < inflated_size)
+    for (pass = 0; pass < 7; pass++)
     {
-        if (upng->buffer != NULL)
+        adam7_pass_size(pass, w, h, &pass_w, &pass_h);
+        if (pass_w > 0 && pass_h > 0)
         {
-            UPNG_MEM_FREE(upng->buffer);
+            unfilter(decoder, in, in, pass_w, pass_h, bpp, 0);
+            if (decoder->error != UPNG_EOK)
+                return;
+
+            adam7_scatter(out, in, pass, pass_w, pass_h, linebytes, bpp);
+            in += ((pass_w * bpp + 7) / 8 + 1) * (unsigned long)pass_h;
         }
-        upng->buffer = (uint8_t*)UPNG_MEM_ALLOC(inflated_size);
-        CHECK_GOTO(upng, upng->buffer != NULL, UPNG_ENOMEM, error);
-        upng->size = inflated_size;
+
+        if (decoder->progress)
+        {
+            if (pass < 6)
+                adam7_replicate(out, pass, w, h, linebytes, bpp);
+            upng->progress(upng->progress_user, upng, pass + 1);
+        }
+    }
+
+    if (decoder->analyze)
+    {
+        for (y = 0; y < h; y++)
+            analytics_row(decoder, out + y * linebytes, y, w);
     }
+}
+
+static int ensure_buffer(upng_t *upng, unsigned long size)
+{
+    if (upng->size >= size && upng->buffer != NULL)
+        return 1;
+
+    if (upng->buffer != NULL)
+        UPNG_MEM_FREE(upng->buffer);
+    upng->buffer = (uint8_t*)UPNG_MEM_ALLOC(size);
+    upng->size = upng->buffer != NULL ? size : 0;
+    return upng->buffer != NULL;
+}
+
+unsigned long upng_raw_frame_size(const upng_t *upng, const upng_frame *frame)
+{
+    return ((frame->rect.width * upng_get_bpp(upng) + 7) / 8) * (unsigned long)frame->rect.height;
+}
+
+void upng_decode_sizes(const upng_t *upng, const upng_frame *frame, unsigned long *out_size, unsigned long *scratch_size)
+{
+    /* interlaced images are inflated into scratch as the passes are scattered */
+    if (upng->interlace_method != 0)
+    {
+        *out_size = upng_raw_frame_size(upng, frame);
+        *scratch_size = inflated_frame_size(upng, frame);
+    }
+    else
+    {
+        *out_size = inflated_frame_size(upng, frame);
+        *scratch_size = 0;
+    }
+}
+
+void upng_decoder_init(upng_decoder *decoder, const upng_t *upng, int progress)
+{
+    memset(decoder, 0, sizeof(upng_decoder));
+    decoder->upng = upng;
+    decoder->analyze = (upng->flags & UPNG_FLAG_ANALYTICS) != 0;
+    decoder->progress = progress && upng->progress != NULL;
+}
+
+upng_error upng_decode_payload(upng_decoder *decoder, const upng_frame *frame, const uint8_t *payload, uint8_t *out, uint8_t *scratch)
+{
+    const upng_t *upng = decoder->upng;
+    uint8_t *inflated = upng->interlace_method != 0 ? scratch : out;
+    upng_error error;
 
     /* decompress image data */
-    error = uz_inflate(upng->buffer, inflated_size, compressed, frame->compressed_size);
-    CHECK_GOTO(upng, error == UPNG_EOK, error, error);
-    UPNG_MEM_FREE(compressed);
+    error = uz_inflate(inflated, inflated_frame_size(upng, frame), payload, frame->compressed_size);
+    if (error != UPNG_EOK)
+    {
+        DECODER_ERROR(decoder, error);
+        return decoder->error;
+    }
 
     /* unfilter scanlines */
-    post_process_scanlines(upng, upng->buffer, upng->buffer, frame);
+    if (decoder->analyze)
+        analytics_begin(decoder);
+    if (upng->interlace_method != 0)
+        adam7_deinterlace(decoder, out, scratch, frame);
+    else if (!fill_solid_frame(decoder, out, frame))
+        post_process_scanlines(decoder, out, out, frame);
+    if (decoder->analyze && decoder->error == UPNG_EOK)
+        analytics_end(decoder);
+
+    return decoder->error;
+}
 
-    if (upng->error != UPNG_EOK)
+const uint8_t *upng_fetch_payload(upng_t *upng, const upng_frame *frame, uint8_t **compressed)
+{
+    const uint8_t *payload;
+    *compressed = NULL;
+
+    /* the only data chunk of a frame is inflated straight from the memory of the source */
+    if (frame->data_chunks == 1 && upng->source.map != NULL)
     {
-        UPNG_MEM_FREE(upng->buffer);
+        payload = (const uint8_t*)upng->source.map(upng->source.user, upng->spans[frame->first_span].offset, frame->compressed_size);
+        if (payload != NULL)
+            return payload;
+    }
+
+    /* cached payloads need no source reads */
+    payload = upng_payload_lookup(upng, frame);
+    if (payload != NULL)
+        return payload;
+
+    /* nor do payloads read ahead while the previous frame was decoded */
+    *compressed = upng_payload_take_read(upng, frame);
+    if (*compressed != NULL)
+        return *compressed;
+
+    /* sequential sources cannot go back to the data chunks, which were kept while scanning for every later loop */
+    if (upng->source.sequential)
+    {
+        payload = upng_payload_streamed(upng, frame);
+        if (payload == NULL)
+            SET_ERROR(upng, UPNG_ENOSEEK);
+        return payload;
+    }
+
+    /* allocate enough space for the (compressed and filtered) image data */
+    *compressed = (uint8_t *)UPNG_MEM_ALLOC(frame->compressed_size);
+    if (*compressed == NULL)
+    {
+        SET_ERROR(upng, UPNG_ENOMEM);
+        return NULL;
+    }
+    /* the data chunks were located while parsing, their spans are read without walking the chunks again */
+    if (!upng_source_read_spans(upng, frame, *compressed))
+    {
+        SET_ERROR(upng, UPNG_EREAD);
+        UPNG_MEM_FREE(*compressed);
+        *compressed = NULL;
+        return NULL;
+    }
+    return *compressed;
+}
+
+void upng_release_payload(upng_t *upng, const upng_frame *frame, uint8_t **compressed)
+{
+    if (*compressed != NULL && !upng_payload_store(upng, frame, *compressed))
+        UPNG_MEM_FREE(*compressed);
+    *compressed = NULL;
+}
+
+int upng_raw_frame_matches(const upng_t *upng, const upng_frame *frame, const upng_raw_frame *raw, uint64_t payload_hash)
+{
+    /* frames with the same payload decode to the same raw frame, the checksum only made them candidates */
+    return raw->data != NULL && raw->payload_hash == payload_hash && raw->size == upng_raw_frame_size(upng, frame) &&
+        (raw->analytics_valid || !(upng->flags & UPNG_FLAG_ANALYTICS));
+}
+
+upng_error upng_load_raw_frame(upng_t *upng, const upng_frame *frame, const upng_raw_frame *raw)
+{
+    if (!ensure_buffer(upng, raw->size))
+    {
+        SET_ERROR(upng, UPNG_ENOMEM);
+        return upng->error;
+    }
+    memcpy(upng->buffer, raw->data, raw->size);
+    upng->analytics = raw->analytics;
+    upng->analytics_state.valid = (upng->flags & UPNG_FLAG_ANALYTICS) != 0;
+    upng->frame_solid = raw->solid;
+    upng->state = UPNG_DECODED;
+    upng->decodedFrame = frame;
+    return upng->error;
+}
+
+upng_error upng_finish_frame(upng_t *upng, const upng_frame *frame, const upng_decoder *decoder, upng_raw_frame *raw, uint64_t payload_hash)
+{
+    if (decoder->error != UPNG_EOK)
+    {
+        upng->error = decoder->error;
+        upng->error_line = decoder->error_line;
+        if (upng->buffer != NULL)
+            UPNG_MEM_FREE(upng->buffer);
         upng->buffer = NULL;
         upng->size = 0;
+        return upng->error;
     }
-    else
+
+    upng->analytics = decoder->analytics;
+    upng->analytics_state = decoder->analytics_state;
+    upng->frame_solid = decoder->solid;
+    upng->state = UPNG_DECODED;
+    upng->decodedFrame = frame;
+    if (raw != NULL)
+        upng_retain_frame(upng, raw, payload_hash, upng_raw_frame_size(upng, frame));
+    return upng->error;
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode_frame(upng_t *upng, const upng_frame* frame)
+{
+    uint8_t *compressed = NULL;
+    const uint8_t *payload;
+    uint8_t *scratch = NULL;
+    unsigned long out_size, scratch_size;
+    upng_raw_frame *raw;
+    uint64_t payload_hash = 0;
+    upng_decoder decoder;
+
+    /* parse the main header, if necessary */
+    upng_header(upng);
+    if (upng->error != UPNG_EOK)
     {
-        upng->state = UPNG_DECODED;
-        upng->decodedFrame = frame;
+        return upng->error;
     }
 
-    return upng->error;
+    /* if we are not ready to decode the image, stop now */
+    if (upng->state != UPNG_HEADER && upng->state != UPNG_DECODED)
+    {
+        return upng->error;
+    }
+
+    upng->analytics_state.valid = 0;
+#ifdef UPNG_USE_THREADS
+    if (upng->parallel != NULL && frame >= upng->frames && frame < upng->frames + upng->frame_count)
+        return upng_parallel_decode(upng, frame);
+#endif
+
+    payload = upng_fetch_payload(upng, frame, &compressed);
+    if (payload == NULL)
+        goto error;
+
+    /* the source reads the next frame while this one is decoded */
+    if (frame >= upng->frames && frame < upng->frames + upng->frame_count && upng->frame_count > 1 && upng->source.submit != NULL)
+    {
+        unsigned next = (unsigned)(frame - upng->frames + 1) % upng->frame_count;
+        if (upng_scan(upng, next + 1, 0) == UPNG_EOK)
+            upng_payload_read_ahead(upng, &upng->frames[next]);
+    }
+
+    raw = upng_get_raw_frame(upng, frame);
+    if (raw != NULL)
+    {
+        payload_hash = upng_content_hash(payload, frame->compressed_size);
+        if (upng_raw_frame_matches(upng, frame, raw, payload_hash))
+        {
+            upng_release_payload(upng, frame, &compressed);
+            return upng_load_raw_frame(upng, frame, raw);
+        }
+    }
+
+    /* allocate space to store inflated (but still filtered) data */
+    upng_decode_sizes(upng, frame, &out_size, &scratch_size);
+    if (scratch_size > 0)
+    {
+        scratch = (uint8_t*)UPNG_MEM_ALLOC(scratch_size);
+        CHECK_GOTO(upng, scratch != NULL, UPNG_ENOMEM, error);
+    }
+    CHECK_GOTO(upng, ensure_buffer(upng, out_size), UPNG_ENOMEM, error);
+
+    upng_decoder_init(&decoder, upng, 1);
+    if (upng_decode_payload(&decoder, frame, payload, upng->buffer, scratch) == UPNG_EOK)
+        upng_release_payload(upng, frame, &compressed);
+    else if (compressed != NULL)
+    {
+        UPNG_MEM_FREE(compressed);
+        compressed = NULL;
+    }
+    if (scratch != NULL)
+        UPNG_MEM_FREE(scratch);
+
+    return upng_finish_frame(upng, frame, &decoder, raw, payload_hash);
 
 error:
     if (compressed != NULL)
         UPNG_MEM_FREE(compressed);
+    if (scratch != NULL)
+        UPNG_MEM_FREE(scratch);
     if (upng->buffer != NULL)
         UPNG_MEM_FREE(upng->buffer);
+    upng->buffer = NULL;
+    upng->size = 0;
     return upng->error;
 }
 
 upng_error upng_decode_default(upng_t* upng)
 {
-    return upng_decode_frame(upng, &upng->defaultImage);
+    upng->composited = 0;
+    if (upng_decode_frame(upng, &upng->defaultImage) != UPNG_EOK)
+        return upng->error;
+
+    /* texts may follow the image data, broken chunks after it only fail the frames they belong to */
+    upng_scan(upng, FRAME_INDEX_NONE, 0);
+    return upng->error;
 }
 
 upng_error upng_decode_next_frame(upng_t *upng)
 {
-    upng->current_frame = (upng->current_frame + 1) % upng->frame_count;
-    upng_decode_frame(upng, &upng->frames[upng->current_frame]);
+    /* the frame count is only known after parsing the header */
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    CHECK_RET(upng, upng->frame_count > 0, UPNG_EPARAM);
+
+    return upng_seek_frame(upng, (upng->current_frame + 1) % upng->frame_count);
+}
+
+upng_error upng_seek_frame(upng_t *upng, unsigned index)
+{
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    CHECK_RET(upng, index < upng->frame_count, UPNG_EPARAM);
+    if (upng_scan(upng, index + 1, 1) != UPNG_EOK)
+        return upng->error;
+
+    upng->current_frame = index;
+    if (upng->flags & UPNG_FLAG_COMPOSITE)
+        return upng_composite_frame(upng, index);
+
+    upng->composited = 0;
+    return upng_decode_frame(upng, &upng->frames[index]);
 }
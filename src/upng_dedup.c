@@ -0,0 +1,235 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+/*
+    Duplicate frames are found without reading their data: the CRC stored with every
+    data chunk covers the chunk type (and the sequence number of fdAT chunks), which is
+    removed again as CRCs are linear, and the CRCs of all chunks of a frame are combined
+    into the CRC of its whole payload. Frames with the same CRC, payload size and frame
+    size are candidates, their payloads are compared by a 64 bit hash before reuse.
+*/
+
+#define CRC_POLYNOMIAL 0xedb88320u
+
+uint32_t upng_crc32(uint32_t crc, const uint8_t *data, unsigned long size)
+{
+    unsigned long i;
+    unsigned bit;
+
+    crc = ~crc;
+    for (i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+    }
+    return ~crc;
+}
+
+/* product of two polynomials modulo the CRC polynomial, bit 31 is x^0 */
+static uint32_t multiply_mod(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, product = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            product ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC_POLYNOMIAL : b >> 1;
+    }
+    return product;
+}
+
+/* x^(8 * size) modulo the CRC polynomial, which appends size zero bytes to a CRC */
+static uint32_t zero_bytes_operator(unsigned long size)
+{
+    uint32_t result = 1u << 31, square = 1u << 23; /* x^0 and x^8 */
+    while (size != 0)
+    {
+        if (size & 1)
+            result = multiply_mod(square, result);
+        size >>= 1;
+        if (size != 0)
+            square = multiply_mod(square, square);
+    }
+    return result;
+}
+
+uint32_t upng_crc32_combine(uint32_t crc1, uint32_t crc2, unsigned long size2)
+{
+    if (crc1 == 0)
+        return crc2;
+    return multiply_mod(zero_bytes_operator(size2), crc1) ^ crc2;
+}
+
+uint32_t upng_payload_crc(uint32_t chunk_crc, const uint8_t *prefix, unsigned prefix_size, unsigned long payload_size)
+{
+    /* crc(prefix payload) = crc(prefix) * x^(8 * payload_size) + crc(payload) */
+    return chunk_crc ^ upng_crc32_combine(upng_crc32(0, prefix, prefix_size), 0, payload_size);
+}
+
+uint64_t upng_content_hash(const uint8_t *data, unsigned long size)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ size, word;
+    unsigned long i;
+
+    for (i = 0; i + 8 <= size; i += 8)
+    {
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int same_payload(const upng_frame *a, const upng_frame *b)
+{
+    return a->payload_crc == b->payload_crc && a->compressed_size == b->compressed_size &&
+        a->rect.width == b->rect.width && a->rect.height == b->rect.height;
+}
+
+void upng_find_duplicates(upng_t *upng)
+{
+    unsigned *table;
+    unsigned long size = 1, mask, slot;
+    unsigned i;
+    int found = 0;
+
+    for (i = 0; i < upng->frame_count; i++)
+        upng->frames[i].duplicate_of = FRAME_INDEX_NONE;
+    if (upng->frame_count < 2)
+        return;
+
+    /* open addressing on the payload CRC, the table is at most half full */
+    while (size < 2ul * upng->frame_count)
+        size <<= 1;
+    mask = size - 1;
+    table = (unsigned*)UPNG_MEM_ALLOC(sizeof(unsigned) * size);
+    if (table == NULL)
+        return;
+    memset(table, 0xff, sizeof(unsigned) * size);
+
+    for (i = 0; i < upng->frame_count; i++)
+    {
+        upng_frame *frame = &upng->frames[i];
+        if (frame->compressed_size == 0)
+            continue;
+        for (slot = frame->payload_crc & mask; table[slot] != FRAME_INDEX_NONE; slot = (slot + 1) & mask)
+        {
+            if (same_payload(&upng->frames[table[slot]], frame))
+            {
+                frame->duplicate_of = table[slot];
+                upng->frames[table[slot]].duplicated = 1;
+                found = 1;
+                break;
+            }
+        }
+        if (frame->duplicate_of == FRAME_INDEX_NONE)
+            table[slot] = i;
+    }
+    UPNG_MEM_FREE(table);
+
+    if (!found)
+        return;
+    /* reusing frames is an optimization, without memory frames are just decoded again */
+    upng->raw_frames = (upng_raw_frame*)UPNG_MEM_ALLOC(sizeof(upng_raw_frame) * upng->frame_count);
+    if (upng->raw_frames == NULL)
+    {
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            upng->frames[i].duplicate_of = FRAME_INDEX_NONE;
+            upng->frames[i].duplicated = 0;
+        }
+        return;
+    }
+    memset(upng->raw_frames, 0, sizeof(upng_raw_frame) * upng->frame_count);
+}
+
+upng_raw_frame *upng_get_raw_frame(const upng_t *upng, const upng_frame *frame)
+{
+    unsigned index;
+
+    if (upng->raw_frames == NULL || frame < upng->frames || frame >= upng->frames + upng->frame_count)
+        return NULL;
+    index = (unsigned)(frame - upng->frames);
+    if (frame->duplicate_of != FRAME_INDEX_NONE)
+        return &upng->raw_frames[frame->duplicate_of];
+    return frame->duplicated ? &upng->raw_frames[index] : NULL;
+}
+
+void upng_retain_frame(upng_t *upng, upng_raw_frame *raw, uint64_t payload_hash, unsigned long size)
+{
+    if (raw->data != NULL)
+        return;
+    raw->data = (uint8_t*)UPNG_MEM_ALLOC(size);
+    if (raw->data == NULL)
+        return;
+    memcpy(raw->data, upng->buffer, size);
+    raw->size = size;
+    raw->payload_hash = payload_hash;
+    raw->analytics = upng->analytics;
+    raw->analytics_valid = upng->analytics_state.valid;
+    raw->solid = upng->frame_solid;
+}
+
+void upng_free_raw_frames(upng_t *upng)
+{
+    unsigned i;
+
+    if (upng->raw_frames == NULL)
+        return;
+    for (i = 0; i < upng->frame_count; i++)
+    {
+        if (upng->raw_frames[i].data != NULL)
+            UPNG_MEM_FREE(upng->raw_frames[i].data);
+    }
+    UPNG_MEM_FREE(upng->raw_frames);
+    upng->raw_frames = NULL;
+}
+
+unsigned upng_get_duplicate_frame(const upng_t *upng, unsigned index)
+{
+    /* duplicates are only found once all frames were scanned */
+    if (index >= upng->frame_count || !upng->scan_done || upng->frames[index].duplicate_of == FRAME_INDEX_NONE)
+        return index;
+    return upng->frames[index].duplicate_of;
+}
@@ -0,0 +1,379 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+/*
+    An index holds everything the chunk scan finds, so opening an image with it reads no
+    chunks besides the header. It is tied to its source by the size and a hash of the first
+    and last bytes and of the CRCs stored after the data chunks. These cover the header, the
+    chunks at the end of the file and every payload, edits of the same size to the ancillary
+    chunks in the middle of a file are not noticed.
+
+    All numbers are big endian 32 bit words:
+        magic, version, source size, hash (2 words), play count, frame count,
+        span count, text count, palette entries, alpha entries
+        default image and frames (FRAME_WORDS each)
+        spans (offset, size), texts (offset, length)
+        palette (3 bytes per entry), alpha (1 byte per entry)
+        CRC of all of the above
+*/
+
+#define INDEX_MAGIC MAKE_DWORD('u', 'P', 'N', 'X')
+#define INDEX_VERSION 2
+#define INDEX_HEADER_WORDS 11
+#define FRAME_WORDS 10
+#define INDEX_SAMPLE 256 // bytes hashed at the start and the end of the source
+#define INDEX_CRC_BATCH 32 // chunk CRCs read at once
+
+static uint8_t *put_word(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+static uint32_t get_word(const uint8_t **p)
+{
+    const uint8_t *bytes = *p;
+    *p += 4;
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+/* the CRC of every data chunk follows its span, a batch of them is one vectored read if the source has them */
+static int chunk_crcs(upng_t *upng, const uint8_t *spans, uint32_t count, uint32_t *crc)
+{
+    upng_source_span batch[INDEX_CRC_BATCH];
+    uint8_t crcs[4 * INDEX_CRC_BATCH];
+    unsigned n = 0, i;
+
+    *crc = 0;
+    while (count > 0)
+    {
+        for (n = 0; n < count && n < INDEX_CRC_BATCH; n++)
+        {
+            unsigned long offset = get_word(&spans), size = get_word(&spans);
+            if (offset > upng->source.size || size > upng->source.size - offset || upng->source.size - offset - size < 4)
+                return 0;
+            batch[n].offset = offset + size;
+            batch[n].size = 4;
+        }
+        if (upng->mapped == NULL && upng->source.readv != NULL)
+        {
+            if (upng->source.readv(upng->source.user, batch, n, crcs) != 4 * n)
+                return 0;
+        }
+        else
+        {
+            for (i = 0; i < n; i++)
+                if (!upng_source_copy(upng, batch[i].offset, crcs + 4 * i, 4))
+                    return 0;
+        }
+        *crc = upng_crc32(*crc, crcs, 4 * n);
+        count -= n;
+    }
+    return 1;
+}
+
+/* identifies the source by its size, its first and last bytes and the CRCs of the spans stored in the index */
+static int source_hash(upng_t *upng, const uint8_t *spans, uint32_t span_count, uint64_t *hash)
+{
+    uint8_t sample[2 * INDEX_SAMPLE + 4];
+    unsigned long size = upng->source.size;
+    unsigned long head = size < 2 * INDEX_SAMPLE ? size : INDEX_SAMPLE;
+    unsigned long tail = size - head < INDEX_SAMPLE ? size - head : INDEX_SAMPLE;
+    uint32_t crc;
+
+    if (!upng_source_copy(upng, 0, sample, head))
+        return 0;
+    if (tail > 0 && !upng_source_copy(upng, size - tail, sample + head, tail))
+        return 0;
+    if (!chunk_crcs(upng, spans, span_count, &crc))
+        return 0;
+    put_word(sample + head + tail, crc);
+    *hash = upng_content_hash(sample, head + tail + 4);
+    return 1;
+}
+
+static uint64_t index_size(uint64_t frames, uint64_t spans, uint64_t texts, uint64_t palette_entries, uint64_t alpha_entries)
+{
+    return 4 * (INDEX_HEADER_WORDS + (frames + 1) * FRAME_WORDS + 2 * spans + 2 * texts + 1) + 3 * palette_entries + alpha_entries;
+}
+
+static uint8_t *put_frame(uint8_t *p, const upng_frame *frame)
+{
+    p = put_word(p, (uint32_t)frame->rect.x_offset);
+    p = put_word(p, (uint32_t)frame->rect.y_offset);
+    p = put_word(p, frame->rect.width);
+    p = put_word(p, frame->rect.height);
+    p = put_word(p, (uint32_t)frame->delay_numerator << 16 | frame->delay_denominator);
+    p = put_word(p, (uint32_t)frame->dispose_op << 8 | frame->blend_op);
+    p = put_word(p, frame->first_span);
+    p = put_word(p, frame->data_chunks);
+    p = put_word(p, (uint32_t)frame->compressed_size);
+    return put_word(p, frame->payload_crc);
+}
+
+/* reads a frame and checks it against the image like the fcTL chunk would have been */
+static int get_frame(const upng_t *upng, const uint8_t **p, upng_frame *frame)
+{
+    uint32_t delay, ops;
+    unsigned long payload = 0;
+    unsigned i;
+
+    memset(frame, 0, sizeof(upng_frame));
+    frame->rect.x_offset = (int)get_word(p);
+    frame->rect.y_offset = (int)get_word(p);
+    frame->rect.width = get_word(p);
+    frame->rect.height = get_word(p);
+    delay = get_word(p);
+    frame->delay_numerator = (unsigned short)(delay >> 16);
+    frame->delay_denominator = (unsigned short)delay;
+    ops = get_word(p);
+    frame->dispose_op = (upng_dispose_op)(ops >> 8);
+    frame->blend_op = (upng_blend_op)(ops & 0xff);
+    frame->first_span = get_word(p);
+    frame->data_chunks = get_word(p);
+    frame->compressed_size = get_word(p);
+    frame->payload_crc = get_word(p);
+    frame->duplicate_of = FRAME_INDEX_NONE;
+
+    if (frame->dispose_op > UPNG_LAST_DISPOSE_OP || frame->blend_op > UPNG_LAST_BLEND_OP)
+        return 0;
+    if ((uint64_t)frame->first_span + frame->data_chunks > upng->span_count)
+        return 0;
+    /* payloads are read into buffers of compressed_size bytes */
+    for (i = 0; i < frame->data_chunks; i++)
+        payload += upng->spans[frame->first_span + i].size;
+    return payload == frame->compressed_size;
+}
+
+upng_error upng_save_index(upng_t *upng, uint8_t **index, unsigned long *size)
+{
+    uint64_t hash;
+    uint8_t *p, *spans;
+    unsigned i;
+
+    *index = NULL;
+    *size = 0;
+    if (upng->source.sequential)
+        return UPNG_ENOSEEK;
+    if (upng_scan_chunks(upng) != UPNG_EOK)
+        return upng->error;
+    /* offsets and sizes are stored as 32 bit words */
+    if (upng->source.size > 0xffffffffu)
+        return UPNG_EUNSUPPORTED;
+
+    *size = (unsigned long)index_size(upng->frame_count, upng->span_count, upng->text_count, upng->palette_entries, upng->alpha_entries);
+    *index = p = (uint8_t*)UPNG_MEM_ALLOC(*size);
+    if (p == NULL)
+    {
+        *size = 0;
+        return UPNG_ENOMEM;
+    }
+
+    p = put_word(p, INDEX_MAGIC);
+    p = put_word(p, INDEX_VERSION);
+    p = put_word(p, (uint32_t)upng->source.size);
+    p += 8; // hash, once the spans are written
+    p = put_word(p, upng->play_count);
+    p = put_word(p, upng->frame_count);
+    p = put_word(p, upng->span_count);
+    p = put_word(p, upng->text_count);
+    p = put_word(p, upng->palette_entries);
+    p = put_word(p, upng->alpha_entries);
+
+    p = put_frame(p, &upng->defaultImage);
+    for (i = 0; i < upng->frame_count; i++)
+        p = put_frame(p, &upng->frames[i]);
+    spans = p;
+    for (i = 0; i < upng->span_count; i++)
+    {
+        p = put_word(p, (uint32_t)upng->spans[i].offset);
+        p = put_word(p, (uint32_t)upng->spans[i].size);
+    }
+    for (i = 0; i < upng->text_count; i++)
+    {
+        p = put_word(p, (uint32_t)upng->text[i].offset);
+        p = put_word(p, (uint32_t)upng->text[i].length);
+    }
+    if (upng->palette_entries > 0)
+        memcpy(p, upng->palette, 3 * upng->palette_entries);
+    p += 3 * upng->palette_entries;
+    if (upng->alpha_entries > 0)
+        memcpy(p, upng->alpha, upng->alpha_entries);
+    p += upng->alpha_entries;
+
+    if (!source_hash(upng, spans, upng->span_count, &hash))
+    {
+        UPNG_MEM_FREE(*index);
+        *index = NULL;
+        *size = 0;
+        SET_ERROR(upng, UPNG_EREAD);
+        return upng->error;
+    }
+    put_word(put_word(*index + 12, (uint32_t)(hash >> 32)), (uint32_t)hash);
+
+    put_word(p, upng_crc32(0, *index, (unsigned long)(p - *index)));
+    return UPNG_EOK;
+}
+
+/* a stale index or one of another version is left to the scan */
+static int index_matches(upng_t *upng, const uint8_t *index, unsigned long size)
+{
+    const uint8_t *p = index, *crc = index + size - 4;
+    uint32_t frames, spans, texts, palette_entries, alpha_entries;
+    uint64_t hash, expected;
+
+    if (size < 4 * (INDEX_HEADER_WORDS + FRAME_WORDS + 1) || upng_crc32(0, index, size - 4) != get_word(&crc))
+        return 0;
+    if (get_word(&p) != INDEX_MAGIC || get_word(&p) != INDEX_VERSION || get_word(&p) != upng->source.size)
+        return 0;
+    expected = (uint64_t)get_word(&p) << 32;
+    expected |= get_word(&p);
+
+    p += 4; // play count
+    frames = get_word(&p);
+    spans = get_word(&p);
+    texts = get_word(&p);
+    palette_entries = get_word(&p);
+    alpha_entries = get_word(&p);
+    if (texts > sizeof(upng->text) / sizeof(upng->text[0]) || palette_entries > 255 || alpha_entries > 255)
+        return 0;
+    if (index_size(frames, spans, texts, palette_entries, alpha_entries) != size)
+        return 0;
+    p = index + 4 * (INDEX_HEADER_WORDS + (frames + 1) * FRAME_WORDS);
+    return source_hash(upng, p, spans, &hash) && hash == expected;
+}
+
+int upng_load_index(upng_t *upng)
+{
+    const uint8_t *p = upng->index + 4 * 5;
+    unsigned long size = upng->source.size;
+    upng_rect image = upng->defaultImage.rect;
+    const uint8_t *frames;
+    upng_error error;
+    unsigned i;
+    int loaded = 0;
+
+    /* sequential sources could not read the bytes identifying them again */
+    if (upng->index == NULL || upng->source.sequential || !index_matches(upng, upng->index, upng->index_size))
+        goto done;
+    loaded = 1;
+
+    upng->play_count = get_word(&p);
+    upng->frame_count = get_word(&p);
+    upng->span_count = get_word(&p);
+    upng->text_count = get_word(&p);
+    upng->palette_entries = (uint8_t)get_word(&p);
+    upng->alpha_entries = (uint8_t)get_word(&p);
+
+    /* the frames refer to the spans after them */
+    frames = p;
+    p += 4 * FRAME_WORDS * (1 + upng->frame_count);
+    if (upng->span_count > 0)
+    {
+        upng->spans = (upng_source_span*)UPNG_MEM_ALLOC(sizeof(upng_source_span) * upng->span_count);
+        CHECK_GOTO(upng, upng->spans != NULL, UPNG_ENOMEM, done);
+        upng->span_capacity = upng->span_count;
+    }
+    for (i = 0; i < upng->span_count; i++)
+    {
+        upng->spans[i].offset = get_word(&p);
+        upng->spans[i].size = get_word(&p);
+        CHECK_GOTO(upng, upng->spans[i].offset <= size && upng->spans[i].size <= size - upng->spans[i].offset, UPNG_EMALFORMED, done);
+    }
+
+    /* the header was parsed from the source already */
+    CHECK_GOTO(upng, get_frame(upng, &frames, &upng->defaultImage), UPNG_EMALFORMED, done);
+    CHECK_GOTO(upng, upng->defaultImage.rect.width == image.width && upng->defaultImage.rect.height == image.height, UPNG_EMALFORMED, done);
+    if (upng->frame_count > 0)
+    {
+        upng->frames = (upng_frame*)UPNG_MEM_ALLOC(sizeof(upng_frame) * upng->frame_count);
+        CHECK_GOTO(upng, upng->frames != NULL, UPNG_ENOMEM, done);
+    }
+    for (i = 0; i < upng->frame_count; i++)
+    {
+        upng_frame *frame = &upng->frames[i];
+        CHECK_GOTO(upng, get_frame(upng, &frames, frame) && upng_frame_fits(upng, frame), UPNG_EMALFORMED, done);
+        if (i == 0)
+            CHECK_GOTO(upng, frame->rect.x_offset == 0 && frame->rect.y_offset == 0 &&
+                frame->rect.width == image.width && frame->rect.height == image.height, UPNG_EMALFORMED, done);
+        else if (frame->dispose_op == UPNG_DISPOSE_OP_PREVIOUS)
+        {
+            if (frame->rect.width > upng->save_width)
+                upng->save_width = frame->rect.width;
+            if (frame->rect.height > upng->save_height)
+                upng->save_height = frame->rect.height;
+        }
+    }
+
+    /* the getter of the texts only reads them, so they are read from the source here */
+    for (i = 0; i < upng->text_count; i++)
+    {
+        upng->text[i].offset = get_word(&p);
+        upng->text[i].length = get_word(&p);
+        CHECK_GOTO(upng, upng->text[i].offset <= size && upng->text[i].length <= size - upng->text[i].offset, UPNG_EMALFORMED, done);
+        error = upng_read_text(upng, &upng->text[i]);
+        CHECK_GOTO(upng, error == UPNG_EOK, error, done);
+    }
+    if (upng->palette_entries > 0)
+    {
+        upng->palette = (upng_rgb*)UPNG_MEM_ALLOC(3 * upng->palette_entries);
+        CHECK_GOTO(upng, upng->palette != NULL, UPNG_ENOMEM, done);
+        memcpy(upng->palette, p, 3 * upng->palette_entries);
+        p += 3 * upng->palette_entries;
+    }
+    if (upng->alpha_entries > 0)
+    {
+        upng->alpha = (uint8_t*)UPNG_MEM_ALLOC(upng->alpha_entries);
+        CHECK_GOTO(upng, upng->alpha != NULL, UPNG_ENOMEM, done);
+        memcpy(upng->alpha, p, upng->alpha_entries);
+    }
+
+    /* as if all chunks were scanned */
+    upng->scan_offset = size;
+    upng->scan_frame = upng->frame_count > 0 ? upng->frame_count - 1 : FRAME_INDEX_NONE;
+    upng->scanned_default = 1;
+    upng->scan_done = 1;
+    for (i = 0; i < upng->frame_count; i++)
+        upng_classify_keyframe(upng, i);
+    upng->scanned_frames = upng->frame_count;
+    upng_find_duplicates(upng);
+
+done:
+    if (upng->index != NULL)
+        UPNG_MEM_FREE(upng->index);
+    upng->index = NULL;
+    upng->index_size = 0;
+    return loaded;
+}
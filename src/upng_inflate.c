@@ -42,7 +42,7 @@ freely, subject to the following restrictions:
 #define DEFLATE_CODE_BITLEN 15
 #define DISTANCE_BITLEN 15
 #define CODE_LENGTH_BITLEN 7
-#define MAX_BIT_LENGTH 15 // bug? 15 /* largest bitlen used by any tree type */
+#define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
 #define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
 #define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
@@ -147,8 +147,8 @@ static void huffman_tree_init(huffman_tree *tree, uint16_t *buffer, uint16_t num
 static upng_error huffman_tree_create_lengths(huffman_tree *tree, const uint16_t *bitlen)
 {
     uint16_t *tree1d = UPNG_MEM_ALLOC(sizeof(uint16_t) * MAX_SYMBOLS);
-    uint16_t blcount[MAX_BIT_LENGTH];
-    uint16_t nextcode[MAX_BIT_LENGTH];
+    uint16_t blcount[MAX_BIT_LENGTH + 1]; /* indexed by the lengths themselves, 0 to MAX_BIT_LENGTH */
+    uint16_t nextcode[MAX_BIT_LENGTH + 1];
     if (!tree1d)
         return UPNG_ENOMEM;
 
@@ -157,8 +157,8 @@ static upng_error huffman_tree_create_lengths(huffman_tree *tree, const uint16_t
     uint16_t treepos = 0;    /*position in the tree (1 of the numcodes columns) */
 
     /* initialize local vectors */
-    memset(blcount, 0, sizeof(uint16_t) * MAX_BIT_LENGTH);
-    memset(nextcode, 0, sizeof(uint16_t) * MAX_BIT_LENGTH);
+    memset(blcount, 0, sizeof(blcount));
+    memset(nextcode, 0, sizeof(nextcode));
 
     /*step 1: count number of instances of each code length */
     for (bits = 0; bits < tree->numcodes; bits++)
@@ -557,7 +557,7 @@ static upng_error inflate_uncompressed(unsigned char *out, unsigned long outsize
     p = (*bp) / 8; /*byte position */
 
     /* read len (2 bytes) and nlen (2 bytes) */
-    if (p >= inlength - 4)
+    if (p + 4 > inlength)
         return UPNG_EMALFORMED;
 
     len = in[p] + 256 * in[p + 1];
@@ -569,7 +569,7 @@ static upng_error inflate_uncompressed(unsigned char *out, unsigned long outsize
     if (len + nlen != 65535)
         return UPNG_EMALFORMED;
 
-    if ((*pos) + len >= outsize)
+    if ((*pos) + len > outsize)
         return UPNG_EMALFORMED;
 
     /* read the literal data: len bytes are now stored in the out buffer */
@@ -582,6 +582,7 @@ static upng_error inflate_uncompressed(unsigned char *out, unsigned long outsize
     }
 
     (*bp) = p * 8;
+    return UPNG_EOK;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
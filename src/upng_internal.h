@@ -118,18 +118,133 @@ typedef struct upng_frame
     upng_dispose_op dispose_op;
     upng_blend_op blend_op;
 
-    unsigned long data_chunk_offset; // of the first data chunk
+    unsigned first_span; // of the compressed data in the data chunks, see upng_t.spans
+    unsigned data_chunks;
     unsigned long compressed_size;
+    uint32_t payload_crc; // of the compressed data, without chunk types and sequence numbers
+    unsigned int duplicate_of; // earliest frame with the same payload and size, FRAME_INDEX_NONE if unique
+    uint8_t duplicated; // later frames have the same payload, so the raw frame is retained
+    uint8_t keyframe; // UPNG_KEYFRAME_* flags
 } upng_frame;
 
+#define UPNG_KEYFRAME_CLEAR (1 << 0) // the canvas is clear before the frame
+#define UPNG_KEYFRAME_COVER (1 << 1) // the frame replaces the whole canvas
+
+#define UPNG_FLAG_ANALYTICS (1 << 0)
+#define UPNG_FLAG_COMPOSITE (1 << 1)
+#define UPNG_FLAG_TIGHT_DIRTY (1 << 2)
+#define UPNG_FLAG_INDEXED_CANVAS (1 << 3)
+#define UPNG_FLAG_TILED_CANVAS (1 << 4)
+
+#define UPNG_TILE_SIZE 64 // width and height of canvas tiles in pixels
+#define UPNG_FILE_BLOCK_SIZE 4096 // of the block cache of upng_new_from_file
+#define UPNG_FILE_BLOCKS 4
+
+typedef struct upng_analytics_state
+{
+    unsigned long long sum[4];
+    unsigned long count;
+    uint8_t first[4];
+    unsigned min_x, min_y, max_x, max_y; // max are exclusive
+    int valid;
+} upng_analytics_state;
+
+typedef struct upng_tile
+{
+    unsigned refs; // canvases and saved states sharing the tile, it is copied before writing if shared
+    int hashed; // listed in the table of tiles by content, which is left before writing
+    uint64_t hash; // of the data once hashed
+    uint8_t data[]; // UPNG_TILE_SIZE rows of tile_stride bytes
+} upng_tile;
+
+typedef struct upng_canvas
+{
+    uint8_t *data; // NULL for tiled canvases
+    unsigned long stride; // in bytes
+    unsigned long size;
+    upng_format format;
+    unsigned bpp;
+    uint8_t clear; // byte pattern of cleared pixels
+    upng_tile **tiles; // tiles_x * tiles_y tiles in row major order, NULL tiles are clear
+    unsigned tiles_x, tiles_y;
+    upng_tile **table; // open addressing of the hashed tiles by content, at most half full
+    unsigned long table_size; // a power of two
+    unsigned long tile_stride; // in bytes
+} upng_canvas;
+
+typedef enum upng_cache_encoding
+{
+    UPNG_CACHE_RAW,
+    UPNG_CACHE_RLE,
+    UPNG_CACHE_DELTA // xor the frame before, run length encoded
+} upng_cache_encoding;
+
+typedef struct upng_cache_entry
+{
+    uint8_t *data; // NULL if the frame is not cached
+    unsigned long size;
+    unsigned long last_use;
+    upng_cache_encoding encoding;
+} upng_cache_entry;
+
+typedef struct upng_payload_entry
+{
+    uint8_t *data; // compressed_size bytes of the frame, NULL if the payload is not cached
+    unsigned long last_use;
+    unsigned holds; // frames being decoded from the payload, which is not evicted then
+} upng_payload_entry;
+
+/* payload of the frame after the one being decoded, read by the source in the background */
+typedef struct upng_pending_read
+{
+    const upng_frame *frame; // NULL if no read is pending
+    uint8_t *buffer; // compressed_size bytes
+    void *request;
+} upng_pending_read;
+
+/* data chunks of a frame passed by the scan of a sequential source, which cannot read them again */
+typedef struct upng_stream_payload
+{
+    uint8_t *data; // compressed_size bytes of the frame, kept until upng is freed
+    unsigned long capacity;
+} upng_stream_payload;
+
+typedef struct upng_prefetch upng_prefetch;
+typedef struct upng_parallel upng_parallel;
+
+typedef struct upng_raw_frame
+{
+    uint8_t *data; // NULL until one of the frames with this payload was decoded
+    unsigned long size;
+    uint64_t payload_hash; // of the compressed data the frame was decoded from
+    upng_analytics analytics;
+    int analytics_valid;
+    int solid;
+} upng_raw_frame;
+
 typedef struct upng_text
 {
-    char* buffer; // deallocate this
+    char* buffer; // deallocate this, NULL until read if the chunks were taken from an index
+    unsigned long offset; // of the chunk data
+    unsigned long length;
 
     const char *keyword; // but not these
     const char *text;
 } upng_text;
 
+/* state of decoding a single frame, upng is only read so frames can be decoded on several threads */
+typedef struct upng_decoder
+{
+    const upng_t *upng;
+    upng_error error;
+    unsigned error_line;
+    int analyze; // compute analytics while unfiltering
+    int progress; // call the progress callback after every Adam7 pass, the output has to be the frame buffer
+    upng_analytics analytics;
+    upng_analytics_state analytics_state;
+    int solid; // the frame is a single color, it was filled instead of unfiltered
+} upng_decoder;
+
 struct upng_t
 {
     upng_rgb *palette;
@@ -141,6 +256,8 @@ struct upng_t
     upng_color color_type;
     unsigned color_depth;
     upng_format format;
+    uint8_t interlace_method;
+    upng_blend_mode blend_mode;
 
     unsigned int play_count;
     unsigned int frame_count;
@@ -153,13 +270,195 @@ struct upng_t
     upng_error error;
     unsigned error_line;
 
+    unsigned flags;
+    upng_analytics analytics;
+    upng_analytics_state analytics_state;
+
+    upng_progress_cb progress;
+    void *progress_user;
+
     upng_state state;
     upng_source source;
+    const uint8_t *mapped; // all of the source if it can be mapped, chunks are parsed from there
+    upng_source_span *spans; // compressed data of every data chunk in file order, each frame owns consecutive ones
+    unsigned span_count;
+    unsigned span_capacity;
+    unsigned long scan_offset; // of the first chunk not scanned yet, see upng_scan
+    uint8_t scan_header[8]; // of the chunk at scan_offset if scan_header_read, where the last scan stopped
+    int scan_header_read;
+    unsigned int scan_frame; // of the last fcTL scanned, FRAME_INDEX_NONE before the first
+    unsigned int scan_sequence; // expected in the next fcTL or fdAT
+    unsigned int scanned_frames; // frames whose chunks were all scanned
+    int scanned_default; // the data chunks of the default image were all scanned
+    int scan_done; // the scan reached IEND or the end of the source
+    upng_error scan_error; // stopped the scan, only fails upng once a frame after it is needed
+    uint8_t *index; // copy of the index of upng_new_from_index until upng_header loads it
+    unsigned long index_size;
 
     const upng_frame* decodedFrame;
     uint8_t *buffer;
     unsigned long size;
+    int frame_solid; // every pixel of the frame buffer has the same value
     unsigned int current_frame;
+    upng_raw_frame *raw_frames; // one per frame if any frames are duplicates, see upng_get_raw_frame
+    unsigned long payload_budget;
+    int payload_pinned; // payloads are never evicted
+    unsigned long payload_clock;
+    upng_payload_entry *payloads; // one entry per frame
+    upng_cache_stats payload_stats;
+    upng_pending_read pending_read;
+    upng_stream_payload streamed_default;
+    upng_stream_payload *streamed; // one per frame for sequential sources
+
+    upng_canvas canvas;
+    uint8_t *external_canvas; // memory of the caller the canvas is composited into, NULL if allocated by upng
+    unsigned long external_stride;
+    upng_format external_format;
+    uint8_t *save_buffer; // rect of the canvas saved for UPNG_DISPOSE_OP_PREVIOUS
+    unsigned long save_size;
+    unsigned int save_width, save_height; // largest size of PREVIOUS rects
+    upng_tile **saved_tiles; // tiles of the rect saved for UPNG_DISPOSE_OP_PREVIOUS on tiled canvases
+    unsigned long saved_count;
+    unsigned int composed_frame; // last frame blended onto the canvas, FRAME_INDEX_NONE if the canvas is invalid
+    int composed_skipped; // composed_frame was skipped, the canvas lacks its pixels which its dispose op clears
+    int composited; // whether the frame buffer is the canvas
+    unsigned long snapshot_budget;
+    uint8_t **snapshots; // canvases before frame (i + 1) * snapshot_interval, NULL if not taken yet
+    unsigned int snapshot_count;
+    unsigned int snapshot_interval;
+    unsigned long cache_budget;
+    unsigned long cache_clock;
+    upng_cache_entry *cache; // one entry per frame
+    upng_cache_stats cache_stats;
+    uint8_t *cache_scratch; // canvas of cache_delta_frame to compute deltas against
+    unsigned int cache_delta_frame;
+    unsigned int cached_frame; // frame loaded from the cache onto the canvas, FRAME_INDEX_NONE if the canvas changed since
+    upng_prefetch *prefetch; // worker state while prefetching
+    upng_parallel *parallel; // thread pool decoding frames ahead, NULL if frames are decoded when needed
+    unsigned int shown_frame; // frame the dirty rect is relative to
+    upng_rect dirty;
+    uint8_t *dirty_buffer; // dirty rect of the canvas before compositing, rows padded by a byte
+    unsigned long dirty_size;
+    int dirty_saved;
 };
 
+/* SIMD kernels are only built for x86 with GCC compatible compilers */
+#if defined(UPNG_USE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UPNG_HAVE_X86_SIMD
+#endif
+
+typedef void (*upng_unfilter_kernel)(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+typedef void (*upng_blend_kernel)(uint8_t *dst, const uint8_t *src, unsigned long count);
+
+/* every entry is set, either to a scalar or to the best vectorized implementation */
+typedef struct upng_kernels
+{
+    upng_unfilter_kernel unfilter_sub;
+    upng_unfilter_kernel unfilter_up;
+    upng_unfilter_kernel unfilter_avg;
+    upng_unfilter_kernel unfilter_paeth;
+
+    /* the over operator, blending count pixels of src onto dst */
+    upng_blend_kernel blend_rgba8;
+    upng_blend_kernel blend_la8;
+    upng_blend_kernel blend_rgba8_premultiplied;
+    upng_blend_kernel blend_la8_premultiplied;
+} upng_kernels;
+
+const upng_kernels* upng_get_kernels(void);
+
+void upng_unfilter_sub_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_up_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_avg_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_paeth_scalar(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_blend_rgba8_scalar(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_scalar(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_rgba8_premultiplied_scalar(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_premultiplied_scalar(uint8_t *dst, const uint8_t *src, unsigned long count);
+
+#ifdef UPNG_HAVE_X86_SIMD
+void upng_unfilter_sub_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_up_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_avg_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_paeth_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_unfilter_up_avx2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length);
+void upng_blend_rgba8_sse2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_sse2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_rgba8_premultiplied_sse2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_premultiplied_sse2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_rgba8_avx2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_avx2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_rgba8_premultiplied_avx2(uint8_t *dst, const uint8_t *src, unsigned long count);
+void upng_blend_la8_premultiplied_avx2(uint8_t *dst, const uint8_t *src, unsigned long count);
+#endif
+
+/* scans until the default image and the first frames frames are complete, errors only fail upng if required */
+upng_error upng_scan(upng_t *upng, unsigned frames, int required);
+/* reads the keyword and text of a tEXt chunk at the offset and length of text */
+upng_error upng_read_text(upng_t *upng, upng_text *text);
+/* takes the chunks from the index instead of scanning them, 0 if there is none or it does not match the source */
+int upng_load_index(upng_t *upng);
+/* the rect of the frame lies within the image */
+int upng_frame_fits(const upng_t *upng, const upng_frame *frame);
+upng_error upng_decode_frame(upng_t *upng, const upng_frame *frame);
+unsigned long upng_raw_frame_size(const upng_t *upng, const upng_frame *frame);
+void upng_decode_sizes(const upng_t *upng, const upng_frame *frame, unsigned long *out_size, unsigned long *scratch_size);
+void upng_decoder_init(upng_decoder *decoder, const upng_t *upng, int progress);
+upng_error upng_decode_payload(upng_decoder *decoder, const upng_frame *frame, const uint8_t *payload, uint8_t *out, uint8_t *scratch);
+const uint8_t *upng_fetch_payload(upng_t *upng, const upng_frame *frame, uint8_t **compressed);
+void upng_release_payload(upng_t *upng, const upng_frame *frame, uint8_t **compressed);
+int upng_raw_frame_matches(const upng_t *upng, const upng_frame *frame, const upng_raw_frame *raw, uint64_t payload_hash);
+upng_error upng_load_raw_frame(upng_t *upng, const upng_frame *frame, const upng_raw_frame *raw);
+upng_error upng_finish_frame(upng_t *upng, const upng_frame *frame, const upng_decoder *decoder, upng_raw_frame *raw, uint64_t payload_hash);
+#ifdef UPNG_USE_THREADS
+upng_error upng_parallel_decode(upng_t *upng, const upng_frame *frame);
+#endif
+upng_error upng_composite_frame(upng_t *upng, unsigned index);
+void upng_classify_keyframe(upng_t *upng, unsigned index);
+int upng_canvas_holds(const upng_t *upng, unsigned index);
+int upng_cache_load(upng_t *upng, unsigned index);
+void upng_cache_prepare_delta(upng_t *upng, unsigned index);
+void upng_cache_store(upng_t *upng, unsigned index);
+void upng_free_cache(upng_t *upng);
+void upng_free_canvas(upng_t *upng);
+upng_error upng_tiles_alloc(upng_t *upng);
+void upng_tiles_free(upng_t *upng);
+uint8_t *upng_tile_row(upng_t *upng, unsigned x, unsigned y);
+upng_error upng_tiles_clear(upng_t *upng, const upng_rect *rect);
+upng_error upng_tiles_save(upng_t *upng, const upng_rect *rect);
+void upng_tiles_share(upng_t *upng, const upng_rect *rect);
+void upng_tiles_restore(upng_t *upng, const upng_rect *rect);
+void upng_tiles_export(const upng_t *upng, uint8_t *out, unsigned long stride);
+unsigned upng_format_bpp(upng_format format);
+
+uint32_t upng_crc32(uint32_t crc, const uint8_t *data, unsigned long size);
+uint32_t upng_crc32_combine(uint32_t crc1, uint32_t crc2, unsigned long size2);
+uint32_t upng_payload_crc(uint32_t chunk_crc, const uint8_t *prefix, unsigned prefix_size, unsigned long payload_size);
+uint64_t upng_content_hash(const uint8_t *data, unsigned long size);
+void upng_find_duplicates(upng_t *upng);
+upng_raw_frame *upng_get_raw_frame(const upng_t *upng, const upng_frame *frame);
+void upng_retain_frame(upng_t *upng, upng_raw_frame *raw, uint64_t payload_hash, unsigned long size);
+void upng_free_raw_frames(upng_t *upng);
+
+const uint8_t *upng_payload_lookup(upng_t *upng, const upng_frame *frame);
+int upng_payload_store(upng_t *upng, const upng_frame *frame, uint8_t *compressed);
+void upng_payload_hold(upng_t *upng, const upng_frame *frame, int hold);
+void upng_free_payloads(upng_t *upng);
+void upng_payload_read_ahead(upng_t *upng, const upng_frame *frame);
+uint8_t *upng_payload_take_read(upng_t *upng, const upng_frame *frame);
+void upng_payload_cancel_read(upng_t *upng);
+upng_error upng_payload_stream(upng_t *upng, const upng_frame *frame, unsigned long offset, unsigned long size);
+const uint8_t *upng_payload_streamed(upng_t *upng, const upng_frame *frame);
+void upng_free_streamed(upng_t *upng);
+
+void upng_source_check_version(upng_source *source);
+upng_error upng_source_from_bytes(upng_source *source, uint8_t *buffer, unsigned long size);
+const uint8_t *upng_source_bytes(upng_t *upng, unsigned long offset, void *buffer, unsigned long size);
+int upng_source_copy(upng_t *upng, unsigned long offset, void *buffer, unsigned long size);
+int upng_source_read_spans(upng_t *upng, const upng_frame *frame, uint8_t *buffer);
+
+void upng_copy_bits(uint8_t *out, unsigned long obp, const uint8_t *in, unsigned long ibp, unsigned long bits);
+void upng_fill_bits(uint8_t *out, unsigned long obp, unsigned long bits, uint8_t pattern);
+void upng_convert_row_rgba8(const upng_t *upng, uint8_t *out, const uint8_t *row, unsigned x, unsigned count);
+void upng_unpack_argb2222(uint8_t *dst, const uint8_t *src, unsigned long count);
 upng_error uz_inflate(uint8_t *out, unsigned long outsize, const uint8_t *in, unsigned long insize);
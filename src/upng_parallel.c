@@ -0,0 +1,429 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#ifdef UPNG_USE_THREADS
+
+#include <string.h>
+#include <pthread.h>
+
+/*
+    Worker threads inflate and unfilter the frames following the one being decoded into buffers
+    of their own, while the thread owning upng reads their payloads and takes the decoded frames
+    in order. Jobs only hold frames in a window after the requested one, seeking elsewhere
+    discards the others. Workers do not allocate anything but the inflate trees and only read upng.
+*/
+
+typedef enum upng_job_state
+{
+    UPNG_JOB_FREE,
+    UPNG_JOB_QUEUED,
+    UPNG_JOB_RUNNING,
+    UPNG_JOB_DONE
+} upng_job_state;
+
+typedef struct upng_parallel_job
+{
+    upng_job_state state;
+    unsigned frame;
+    unsigned long sequence; // jobs are started in the order they were queued
+    int reuse; // the retained raw frame is loaded instead of decoding
+    const uint8_t *payload;
+    uint8_t *compressed; // owned payload, NULL if the payload is cached
+    int held; // the payload is cached and held until the job is released
+    uint64_t payload_hash;
+    uint8_t *buffer;
+    unsigned long buffer_size;
+    uint8_t *scratch;
+    unsigned long scratch_size;
+    upng_decoder decoder;
+} upng_parallel_job;
+
+struct upng_parallel
+{
+    pthread_t *threads;
+    unsigned thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t queued; // jobs were queued or the pool stops
+    pthread_cond_t done; // a job finished
+
+    upng_parallel_job *jobs;
+    unsigned max_in_flight;
+    unsigned long sequence;
+    int stop;
+};
+
+static upng_parallel_job *next_job(upng_parallel *parallel)
+{
+    upng_parallel_job *next = NULL;
+    unsigned i;
+
+    for (i = 0; i < parallel->max_in_flight; i++)
+    {
+        upng_parallel_job *job = &parallel->jobs[i];
+        if (job->state == UPNG_JOB_QUEUED && (next == NULL || job->sequence < next->sequence))
+            next = job;
+    }
+    return next;
+}
+
+static void *parallel_worker(void *user)
+{
+    upng_t *upng = (upng_t*)user;
+    upng_parallel *parallel = upng->parallel;
+
+    pthread_mutex_lock(&parallel->mutex);
+    while (!parallel->stop)
+    {
+        upng_parallel_job *job = next_job(parallel);
+        if (job == NULL)
+        {
+            pthread_cond_wait(&parallel->queued, &parallel->mutex);
+            continue;
+        }
+
+        job->state = UPNG_JOB_RUNNING;
+        pthread_mutex_unlock(&parallel->mutex);
+        upng_decode_payload(&job->decoder, &upng->frames[job->frame], job->payload, job->buffer, job->scratch);
+        pthread_mutex_lock(&parallel->mutex);
+
+        job->state = UPNG_JOB_DONE;
+        pthread_cond_broadcast(&parallel->done);
+    }
+    pthread_mutex_unlock(&parallel->mutex);
+    return NULL;
+}
+
+/* releases the payload of a job which is not running, freeing the job is up to the caller */
+static void release_job(upng_t *upng, upng_parallel_job *job)
+{
+    const upng_frame *frame = &upng->frames[job->frame];
+
+    if (job->compressed != NULL)
+        upng_release_payload(upng, frame, &job->compressed);
+    if (job->held)
+        upng_payload_hold(upng, frame, 0);
+    job->held = 0;
+    job->payload = NULL;
+}
+
+static void free_job_locked(upng_parallel *parallel, upng_parallel_job *job)
+{
+    pthread_mutex_lock(&parallel->mutex);
+    job->state = UPNG_JOB_FREE;
+    pthread_mutex_unlock(&parallel->mutex);
+}
+
+static upng_parallel_job *find_job(upng_parallel *parallel, unsigned frame)
+{
+    unsigned i;
+    for (i = 0; i < parallel->max_in_flight; i++)
+    {
+        if (parallel->jobs[i].state != UPNG_JOB_FREE && parallel->jobs[i].frame == frame)
+            return &parallel->jobs[i];
+    }
+    return NULL;
+}
+
+static upng_parallel_job *free_job(upng_parallel *parallel)
+{
+    unsigned i;
+    for (i = 0; i < parallel->max_in_flight; i++)
+    {
+        if (parallel->jobs[i].state == UPNG_JOB_FREE)
+            return &parallel->jobs[i];
+    }
+    return NULL;
+}
+
+/* discards jobs which are outside the window starting at first or were decoded with other settings */
+static void prune_jobs(upng_t *upng, unsigned first)
+{
+    upng_parallel *parallel = upng->parallel;
+    int analyze = (upng->flags & UPNG_FLAG_ANALYTICS) != 0;
+    unsigned i;
+
+    for (i = 0; i < parallel->max_in_flight; i++)
+    {
+        upng_parallel_job *job = &parallel->jobs[i];
+        unsigned distance = (job->frame + upng->frame_count - first) % upng->frame_count;
+
+        if (job->state == UPNG_JOB_FREE || job->state == UPNG_JOB_RUNNING)
+            continue;
+        if (distance >= parallel->max_in_flight || (!job->reuse && job->decoder.analyze != analyze))
+        {
+            release_job(upng, job);
+            job->state = UPNG_JOB_FREE;
+        }
+    }
+}
+
+static int ensure_job_buffer(uint8_t **buffer, unsigned long *buffer_size, unsigned long size)
+{
+    if (*buffer_size >= size && (*buffer != NULL || size == 0))
+        return 1;
+
+    if (*buffer != NULL)
+        UPNG_MEM_FREE(*buffer);
+    *buffer = (uint8_t*)UPNG_MEM_ALLOC(size);
+    *buffer_size = *buffer != NULL ? size : 0;
+    return *buffer != NULL;
+}
+
+/* reads the payload of a frame and queues it, the job is free so no worker touches it until then */
+static upng_error submit_job(upng_t *upng, upng_parallel_job *job, unsigned index)
+{
+    upng_parallel *parallel = upng->parallel;
+    const upng_frame *frame = &upng->frames[index];
+    upng_raw_frame *raw;
+    unsigned long out_size, scratch_size;
+
+    job->frame = index;
+    job->reuse = 0;
+    job->payload_hash = 0;
+    job->payload = upng_fetch_payload(upng, frame, &job->compressed);
+    if (job->payload == NULL)
+        return upng->error;
+    job->held = job->compressed == NULL;
+    if (job->held)
+        upng_payload_hold(upng, frame, 1);
+
+    raw = upng_get_raw_frame(upng, frame);
+    if (raw != NULL)
+    {
+        job->payload_hash = upng_content_hash(job->payload, frame->compressed_size);
+        job->reuse = upng_raw_frame_matches(upng, frame, raw, job->payload_hash);
+    }
+
+    if (!job->reuse)
+    {
+        upng_decode_sizes(upng, frame, &out_size, &scratch_size);
+        if (!ensure_job_buffer(&job->buffer, &job->buffer_size, out_size) ||
+            !ensure_job_buffer(&job->scratch, &job->scratch_size, scratch_size))
+        {
+            release_job(upng, job);
+            SET_ERROR(upng, UPNG_ENOMEM);
+            return upng->error;
+        }
+        upng_decoder_init(&job->decoder, upng, 0);
+    }
+
+    pthread_mutex_lock(&parallel->mutex);
+    job->sequence = parallel->sequence++;
+    job->state = job->reuse ? UPNG_JOB_DONE : UPNG_JOB_QUEUED;
+    pthread_cond_signal(&parallel->queued);
+    pthread_mutex_unlock(&parallel->mutex);
+    return UPNG_EOK;
+}
+
+/* queues the frames after first which are not in flight yet, failures only show once the frame is needed */
+static void fill_window(upng_t *upng, unsigned first)
+{
+    upng_parallel *parallel = upng->parallel;
+    upng_error error = upng->error;
+    unsigned error_line = upng->error_line;
+    unsigned i;
+
+    for (i = 0; i < parallel->max_in_flight && i < upng->frame_count; i++)
+    {
+        unsigned index = (first + i) % upng->frame_count;
+        upng_parallel_job *job;
+
+        /* frames ahead are scanned for their data chunks */
+        if (upng_scan(upng, index + 1, 0) != UPNG_EOK)
+            break;
+
+        pthread_mutex_lock(&parallel->mutex);
+        job = find_job(parallel, index) != NULL ? NULL : free_job(parallel);
+        pthread_mutex_unlock(&parallel->mutex);
+        if (job == NULL)
+            continue;
+
+        if (submit_job(upng, job, index) != UPNG_EOK)
+        {
+            upng->error = error;
+            upng->error_line = error_line;
+            break;
+        }
+    }
+}
+
+upng_error upng_parallel_decode(upng_t *upng, const upng_frame *frame)
+{
+    upng_parallel *parallel = upng->parallel;
+    unsigned index = (unsigned)(frame - upng->frames);
+    upng_parallel_job *job, *slot;
+    upng_raw_frame *raw;
+    upng_error error;
+    uint8_t *buffer;
+    unsigned long size;
+
+    /* get a job for the frame, jobs of frames which are not needed anymore may have to finish first */
+    pthread_mutex_lock(&parallel->mutex);
+    for (;;)
+    {
+        prune_jobs(upng, index);
+        job = find_job(parallel, index);
+        slot = job == NULL ? free_job(parallel) : NULL;
+        if (job != NULL || slot != NULL)
+            break;
+        pthread_cond_wait(&parallel->done, &parallel->mutex);
+    }
+    pthread_mutex_unlock(&parallel->mutex);
+    if (job == NULL)
+    {
+        job = slot;
+        if (submit_job(upng, job, index) != UPNG_EOK)
+            goto error;
+    }
+
+    /* keep the workers busy while waiting */
+    fill_window(upng, index);
+
+    pthread_mutex_lock(&parallel->mutex);
+    while (job->state != UPNG_JOB_DONE)
+        pthread_cond_wait(&parallel->done, &parallel->mutex);
+    pthread_mutex_unlock(&parallel->mutex);
+
+    raw = upng_get_raw_frame(upng, frame);
+    if (job->reuse)
+    {
+        release_job(upng, job);
+        free_job_locked(parallel, job);
+        error = upng_load_raw_frame(upng, frame, raw);
+    }
+    else
+    {
+        /* the decoded frame becomes the frame buffer, the job takes over the old one */
+        buffer = upng->buffer;
+        size = upng->size;
+        upng->buffer = job->buffer;
+        upng->size = job->buffer_size;
+        job->buffer = buffer;
+        job->buffer_size = buffer != NULL ? size : 0;
+
+        /* payloads which failed to decode are not cached */
+        if (job->decoder.error != UPNG_EOK && job->compressed != NULL)
+        {
+            UPNG_MEM_FREE(job->compressed);
+            job->compressed = NULL;
+        }
+        release_job(upng, job);
+        free_job_locked(parallel, job);
+        error = upng_finish_frame(upng, frame, &job->decoder, raw, job->payload_hash);
+    }
+
+    fill_window(upng, (index + 1) % upng->frame_count);
+    return error;
+
+error:
+    if (upng->buffer != NULL)
+        UPNG_MEM_FREE(upng->buffer);
+    upng->buffer = NULL;
+    upng->size = 0;
+    return upng->error;
+}
+
+static void stop_parallel(upng_t *upng)
+{
+    upng_parallel *parallel = upng->parallel;
+    unsigned i;
+
+    pthread_mutex_lock(&parallel->mutex);
+    parallel->stop = 1;
+    pthread_cond_broadcast(&parallel->queued);
+    pthread_mutex_unlock(&parallel->mutex);
+    for (i = 0; i < parallel->thread_count; i++)
+        pthread_join(parallel->threads[i], NULL);
+
+    for (i = 0; i < parallel->max_in_flight; i++)
+    {
+        upng_parallel_job *job = &parallel->jobs[i];
+        if (job->state != UPNG_JOB_FREE)
+            release_job(upng, job);
+        if (job->buffer != NULL)
+            UPNG_MEM_FREE(job->buffer);
+        if (job->scratch != NULL)
+            UPNG_MEM_FREE(job->scratch);
+    }
+    UPNG_MEM_FREE(parallel->jobs);
+    UPNG_MEM_FREE(parallel->threads);
+    pthread_cond_destroy(&parallel->done);
+    pthread_cond_destroy(&parallel->queued);
+    pthread_mutex_destroy(&parallel->mutex);
+    UPNG_MEM_FREE(parallel);
+    upng->parallel = NULL;
+}
+
+upng_error upng_set_parallel_decode(upng_t *upng, unsigned threads, unsigned max_in_flight)
+{
+    upng_parallel *parallel;
+
+    if (upng->parallel != NULL)
+        stop_parallel(upng);
+    if (threads == 0)
+        return UPNG_EOK;
+    CHECK_RET(upng, max_in_flight > 0, UPNG_EPARAM);
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    CHECK_RET(upng, upng->frame_count > 0, UPNG_EPARAM);
+
+    parallel = (upng_parallel*)UPNG_MEM_ALLOC(sizeof(upng_parallel));
+    CHECK_RET(upng, parallel != NULL, UPNG_ENOMEM);
+    memset(parallel, 0, sizeof(upng_parallel));
+    parallel->threads = (pthread_t*)UPNG_MEM_ALLOC(sizeof(pthread_t) * threads);
+    parallel->jobs = (upng_parallel_job*)UPNG_MEM_ALLOC(sizeof(upng_parallel_job) * max_in_flight);
+    if (parallel->threads == NULL || parallel->jobs == NULL)
+    {
+        if (parallel->threads != NULL)
+            UPNG_MEM_FREE(parallel->threads);
+        if (parallel->jobs != NULL)
+            UPNG_MEM_FREE(parallel->jobs);
+        UPNG_MEM_FREE(parallel);
+        SET_ERROR(upng, UPNG_ENOMEM);
+        return upng->error;
+    }
+    memset(parallel->jobs, 0, sizeof(upng_parallel_job) * max_in_flight);
+    parallel->max_in_flight = max_in_flight;
+    pthread_mutex_init(&parallel->mutex, NULL);
+    pthread_cond_init(&parallel->queued, NULL);
+    pthread_cond_init(&parallel->done, NULL);
+    upng->parallel = parallel;
+
+    for (parallel->thread_count = 0; parallel->thread_count < threads; parallel->thread_count++)
+    {
+        if (pthread_create(&parallel->threads[parallel->thread_count], NULL, parallel_worker, upng) != 0)
+        {
+            stop_parallel(upng);
+            SET_ERROR(upng, UPNG_ENOMEM);
+            return upng->error;
+        }
+    }
+    return UPNG_EOK;
+}
+
+#endif
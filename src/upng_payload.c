@@ -0,0 +1,279 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+
+#include "upng_internal.h"
+
+#include <string.h>
+
+/*
+    The concatenated compressed data of frames is kept in RAM so decoding them again needs
+    no source reads. Entries are the buffers data chunks were read into, so storing copies nothing.
+    Unpinned caches evict the least recently used payloads, pinned caches keep whatever fit
+    on the first loop, which keeps animations larger than the budget from thrashing.
+    Sources which read asynchronously get the payload of the next frame requested while a frame
+    is inflated, so the read overlaps with decoding instead of stalling the next frame.
+    Sequential sources cannot go back to the data chunks, their data is copied out while the
+    scan passes them and handed to the decoder once, the payload cache may keep it after that.
+*/
+
+static upng_payload_entry *payload_entry(const upng_t *upng, const upng_frame *frame)
+{
+    if (upng->payloads == NULL || frame < upng->frames || frame >= upng->frames + upng->frame_count)
+        return NULL;
+    return &upng->payloads[frame - upng->frames];
+}
+
+const uint8_t *upng_payload_lookup(upng_t *upng, const upng_frame *frame)
+{
+    upng_payload_entry *entry;
+
+    if (upng->payload_budget == 0)
+        return NULL;
+    entry = payload_entry(upng, frame);
+    if (entry == NULL || entry->data == NULL)
+    {
+        upng->payload_stats.misses++;
+        return NULL;
+    }
+    entry->last_use = ++upng->payload_clock;
+    upng->payload_stats.hits++;
+    return entry->data;
+}
+
+/* evicts the least recently used payloads until size bytes fit into the budget */
+static int make_room(upng_t *upng, unsigned long size)
+{
+    while (upng->payload_stats.bytes + size > upng->payload_budget)
+    {
+        upng_payload_entry *oldest = NULL;
+        unsigned i;
+
+        if (upng->payload_pinned)
+            return 0;
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            if (upng->payloads[i].data != NULL && upng->payloads[i].holds == 0 && (oldest == NULL || upng->payloads[i].last_use < oldest->last_use))
+                oldest = &upng->payloads[i];
+        }
+        if (oldest == NULL)
+            return 0;
+        UPNG_MEM_FREE(oldest->data);
+        oldest->data = NULL;
+        upng->payload_stats.bytes -= upng->frames[oldest - upng->payloads].compressed_size;
+        upng->payload_stats.evictions++;
+    }
+    return 1;
+}
+
+int upng_payload_store(upng_t *upng, const upng_frame *frame, uint8_t *compressed)
+{
+    upng_payload_entry *entry;
+
+    if (upng->payload_budget == 0 || frame->compressed_size > upng->payload_budget)
+        return 0;
+    if (upng->payloads == NULL && upng->frames != NULL)
+    {
+        /* caching is an optimization, without memory payloads are just read again */
+        upng->payloads = (upng_payload_entry*)UPNG_MEM_ALLOC(sizeof(upng_payload_entry) * upng->frame_count);
+        if (upng->payloads == NULL)
+            return 0;
+        memset(upng->payloads, 0, sizeof(upng_payload_entry) * upng->frame_count);
+    }
+    entry = payload_entry(upng, frame);
+    if (entry == NULL || entry->data != NULL || !make_room(upng, frame->compressed_size))
+        return 0;
+
+    entry->data = compressed;
+    entry->last_use = ++upng->payload_clock;
+    upng->payload_stats.bytes += frame->compressed_size;
+    return 1;
+}
+
+void upng_payload_hold(upng_t *upng, const upng_frame *frame, int hold)
+{
+    upng_payload_entry *entry = payload_entry(upng, frame);
+    if (entry != NULL)
+        entry->holds += hold ? 1 : -1;
+}
+
+void upng_free_payloads(upng_t *upng)
+{
+    unsigned i;
+
+    if (upng->payloads != NULL)
+    {
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            if (upng->payloads[i].data != NULL)
+                UPNG_MEM_FREE(upng->payloads[i].data);
+        }
+        UPNG_MEM_FREE(upng->payloads);
+        upng->payloads = NULL;
+    }
+    upng->payload_stats.bytes = 0;
+}
+
+/* waits for the pending read, its buffer is returned if it holds the payload of frame and freed otherwise */
+static uint8_t *finish_read(upng_t *upng, const upng_frame *frame)
+{
+    upng_pending_read *pending = &upng->pending_read;
+    uint8_t *buffer = pending->buffer;
+    unsigned long got;
+
+    if (pending->frame == NULL)
+        return NULL;
+    got = upng->source.complete(upng->source.user, pending->request);
+    if (pending->frame != frame || got != frame->compressed_size)
+    {
+        UPNG_MEM_FREE(buffer);
+        buffer = NULL;
+    }
+    memset(pending, 0, sizeof(upng_pending_read));
+    return buffer;
+}
+
+void upng_payload_read_ahead(upng_t *upng, const upng_frame *frame)
+{
+    upng_payload_entry *entry = payload_entry(upng, frame);
+    upng_raw_frame *raw = upng_get_raw_frame(upng, frame);
+    uint8_t *buffer;
+    void *request;
+
+    if (upng->source.submit == NULL || upng->pending_read.frame == frame)
+        return;
+    finish_read(upng, NULL);
+
+    /* only payloads read in one piece which are neither mapped, cached nor likely decoded already */
+    if (frame->data_chunks != 1 || upng->source.map != NULL || (entry != NULL && entry->data != NULL) ||
+        (raw != NULL && raw->data != NULL))
+        return;
+    buffer = (uint8_t*)UPNG_MEM_ALLOC(frame->compressed_size);
+    if (buffer == NULL)
+        return;
+    request = upng->source.submit(upng->source.user, upng->spans[frame->first_span].offset, buffer, frame->compressed_size);
+    if (request == NULL)
+    {
+        UPNG_MEM_FREE(buffer);
+        return;
+    }
+    upng->pending_read.frame = frame;
+    upng->pending_read.buffer = buffer;
+    upng->pending_read.request = request;
+}
+
+uint8_t *upng_payload_take_read(upng_t *upng, const upng_frame *frame)
+{
+    /* reads for other frames keep going, the next read ahead waits for them */
+    if (upng->pending_read.frame != frame)
+        return NULL;
+    return finish_read(upng, frame);
+}
+
+void upng_payload_cancel_read(upng_t *upng)
+{
+    finish_read(upng, NULL);
+}
+
+static upng_stream_payload *stream_slot(upng_t *upng, const upng_frame *frame, int create)
+{
+    /* the default image may be the first frame, which shares its data chunks then */
+    if (frame == &upng->defaultImage || (frame == upng->frames && upng->defaultImage.data_chunks > 0 &&
+        frame->first_span == upng->defaultImage.first_span))
+        return &upng->streamed_default;
+    if (frame < upng->frames || frame >= upng->frames + upng->frame_count)
+        return NULL;
+    if (upng->streamed == NULL && create)
+    {
+        upng->streamed = (upng_stream_payload*)UPNG_MEM_ALLOC(sizeof(upng_stream_payload) * upng->frame_count);
+        if (upng->streamed == NULL)
+            return NULL;
+        memset(upng->streamed, 0, sizeof(upng_stream_payload) * upng->frame_count);
+    }
+    return upng->streamed != NULL ? &upng->streamed[frame - upng->frames] : NULL;
+}
+
+upng_error upng_payload_stream(upng_t *upng, const upng_frame *frame, unsigned long offset, unsigned long size)
+{
+    upng_stream_payload *slot = stream_slot(upng, frame, 1);
+    unsigned long filled = frame->compressed_size - size; // the span was added already
+    uint8_t *data;
+
+    if (slot == NULL)
+        return UPNG_ENOMEM;
+    if (frame->compressed_size > slot->capacity)
+    {
+        unsigned long capacity = slot->capacity * 2 > frame->compressed_size ? slot->capacity * 2 : frame->compressed_size;
+        data = (uint8_t*)UPNG_MEM_ALLOC(capacity);
+        if (data == NULL)
+            return UPNG_ENOMEM;
+        if (slot->data != NULL)
+        {
+            memcpy(data, slot->data, filled);
+            UPNG_MEM_FREE(slot->data);
+        }
+        slot->data = data;
+        slot->capacity = capacity;
+    }
+    return upng_source_copy(upng, offset, slot->data + filled, size) ? UPNG_EOK : UPNG_EREAD;
+}
+
+const uint8_t *upng_payload_streamed(upng_t *upng, const upng_frame *frame)
+{
+    upng_stream_payload *slot = stream_slot(upng, frame, 0);
+    return slot != NULL ? slot->data : NULL;
+}
+
+void upng_free_streamed(upng_t *upng)
+{
+    unsigned i;
+
+    if (upng->streamed_default.data != NULL)
+        UPNG_MEM_FREE(upng->streamed_default.data);
+    upng->streamed_default.data = NULL;
+    if (upng->streamed != NULL)
+    {
+        for (i = 0; i < upng->frame_count; i++)
+        {
+            if (upng->streamed[i].data != NULL)
+                UPNG_MEM_FREE(upng->streamed[i].data);
+        }
+        UPNG_MEM_FREE(upng->streamed);
+        upng->streamed = NULL;
+    }
+}
+
+void upng_set_payload_cache(upng_t *upng, unsigned long budget, int pin)
+{
+    upng_free_payloads(upng);
+    upng->payload_budget = budget;
+    upng->payload_pinned = pin;
+}
+
+void upng_get_payload_cache_stats(const upng_t *upng, upng_cache_stats *stats)
+{
+    *stats = upng->payload_stats;
+}
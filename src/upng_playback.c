@@ -0,0 +1,137 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+struct upng_playback
+{
+    upng_t *upng;
+    unsigned long long *ends; // time in microseconds at which each frame of a loop ends
+};
+
+/* the specification treats a denominator of 0 as 100 */
+static unsigned long long frame_delay_us(const upng_frame *frame)
+{
+    unsigned long long denominator = frame->delay_denominator == 0 ? 100 : frame->delay_denominator;
+    return (frame->delay_numerator * 1000000ull + denominator / 2) / denominator;
+}
+
+upng_error upng_get_frame_delay(const upng_t *upng, unsigned index, unsigned *numerator, unsigned *denominator)
+{
+    if (index >= upng->frame_count || upng->scan_frame == FRAME_INDEX_NONE || index > upng->scan_frame)
+        return UPNG_EPARAM;
+    *numerator = upng->frames[index].delay_numerator;
+    *denominator = upng->frames[index].delay_denominator == 0 ? 100 : upng->frames[index].delay_denominator;
+    return UPNG_EOK;
+}
+
+upng_playback *upng_playback_new(upng_t *upng)
+{
+    upng_playback *playback;
+    unsigned long long end = 0;
+    unsigned i;
+
+    /* the timeline needs the delays of all frames */
+    if (upng_scan_chunks(upng) != UPNG_EOK || upng->frame_count == 0)
+        return NULL;
+
+    playback = (upng_playback*)UPNG_MEM_ALLOC(sizeof(upng_playback));
+    if (playback == NULL)
+        return NULL;
+    playback->upng = upng;
+    playback->ends = (unsigned long long*)UPNG_MEM_ALLOC(sizeof(unsigned long long) * upng->frame_count);
+    if (playback->ends == NULL)
+    {
+        UPNG_MEM_FREE(playback);
+        return NULL;
+    }
+
+    for (i = 0; i < upng->frame_count; i++)
+    {
+        end += frame_delay_us(&upng->frames[i]);
+        playback->ends[i] = end;
+    }
+
+    upng_set_compositing(upng, 1);
+    return playback;
+}
+
+void upng_playback_free(upng_playback *playback)
+{
+    UPNG_MEM_FREE(playback->ends);
+    UPNG_MEM_FREE(playback);
+}
+
+unsigned long upng_playback_get_duration(const upng_playback *playback)
+{
+    return (unsigned long)(playback->ends[playback->upng->frame_count - 1] / 1000);
+}
+
+int upng_playback_finished(const upng_playback *playback, unsigned long time_ms)
+{
+    unsigned long long duration = playback->ends[playback->upng->frame_count - 1];
+    unsigned plays = playback->upng->play_count;
+
+    if (plays == 0)
+        return 0;
+    return duration == 0 || time_ms * 1000ull / duration >= plays;
+}
+
+unsigned upng_playback_frame_at(const upng_playback *playback, unsigned long time_ms)
+{
+    unsigned long long duration = playback->ends[playback->upng->frame_count - 1];
+    unsigned long long time;
+    unsigned low = 0, high = playback->upng->frame_count - 1;
+
+    /* the last frame stays on screen after the last play */
+    if (duration == 0 || upng_playback_finished(playback, time_ms))
+        return high;
+
+    /* first frame ending after the time, frames without delay are never shown */
+    time = time_ms * 1000ull % duration;
+    while (low < high)
+    {
+        unsigned middle = low + (high - low) / 2;
+        if (playback->ends[middle] > time)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+upng_error upng_playback_update(upng_playback *playback, unsigned long time_ms)
+{
+    upng_t *upng = playback->upng;
+    unsigned index = upng_playback_frame_at(playback, time_ms);
+
+    if (upng->composited && upng->current_frame == index)
+        return UPNG_EOK;
+    return upng_seek_frame(upng, index);
+}
@@ -0,0 +1,255 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#ifdef UPNG_USE_THREADS
+
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+    The worker thread owns the upng_t while prefetching. Frames are handed over through a
+    single-producer/single-consumer ring: the worker only advances head, the consumer only
+    advances tail. Both sides only take the mutex to sleep, and to wake the other side
+    if it announced that it is sleeping.
+*/
+
+typedef struct upng_prefetch_slot
+{
+    uint8_t *canvas;
+    unsigned frame;
+} upng_prefetch_slot;
+
+struct upng_prefetch
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    upng_prefetch_slot *slots;
+    unsigned depth;
+    unsigned long canvas_stride;
+    unsigned long canvas_size;
+
+    atomic_ulong head; // frames produced
+    atomic_ulong tail; // frames released by the consumer
+    atomic_int producer_waiting;
+    atomic_int consumer_waiting;
+    atomic_int stop; // set by the consumer
+    atomic_int done; // set by the worker after an error
+};
+
+static void wake(upng_prefetch *prefetch, atomic_int *waiting)
+{
+    if (atomic_load(waiting))
+    {
+        pthread_mutex_lock(&prefetch->mutex);
+        pthread_cond_broadcast(&prefetch->cond);
+        pthread_mutex_unlock(&prefetch->mutex);
+    }
+}
+
+static void *prefetch_worker(void *user)
+{
+    upng_t *upng = (upng_t*)user;
+    upng_prefetch *prefetch = upng->prefetch;
+
+    while (!atomic_load(&prefetch->stop))
+    {
+        unsigned long head = atomic_load(&prefetch->head);
+        upng_prefetch_slot *slot;
+        upng_error error;
+
+        /* wait for a free canvas */
+        if (head - atomic_load(&prefetch->tail) >= prefetch->depth)
+        {
+            pthread_mutex_lock(&prefetch->mutex);
+            atomic_store(&prefetch->producer_waiting, 1);
+            while (head - atomic_load(&prefetch->tail) >= prefetch->depth && !atomic_load(&prefetch->stop))
+                pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+            atomic_store(&prefetch->producer_waiting, 0);
+            pthread_mutex_unlock(&prefetch->mutex);
+            continue;
+        }
+
+        if (upng_decode_next_frame(upng) != UPNG_EOK)
+            break;
+        slot = &prefetch->slots[head % prefetch->depth];
+        /* slots are sized for an allocated canvas, a wider external one does not fit */
+        error = upng_export_canvas(upng, slot->canvas, prefetch->canvas_stride);
+        if (error != UPNG_EOK)
+        {
+            SET_ERROR(upng, error);
+            break;
+        }
+        slot->frame = upng->current_frame;
+
+        atomic_store(&prefetch->head, head + 1);
+        wake(prefetch, &prefetch->consumer_waiting);
+    }
+
+    atomic_store(&prefetch->done, 1);
+    wake(prefetch, &prefetch->consumer_waiting);
+    return NULL;
+}
+
+static void free_prefetch(upng_t *upng)
+{
+    upng_prefetch *prefetch = upng->prefetch;
+    unsigned i;
+
+    for (i = 0; i < prefetch->depth; i++)
+    {
+        if (prefetch->slots[i].canvas != NULL)
+            UPNG_MEM_FREE(prefetch->slots[i].canvas);
+    }
+    UPNG_MEM_FREE(prefetch->slots);
+    pthread_cond_destroy(&prefetch->cond);
+    pthread_mutex_destroy(&prefetch->mutex);
+    UPNG_MEM_FREE(prefetch);
+    upng->prefetch = NULL;
+}
+
+upng_error upng_prefetch_start(upng_t *upng, unsigned depth)
+{
+    upng_prefetch *prefetch;
+    upng_format format;
+    unsigned i;
+
+    CHECK_RET(upng, upng->prefetch == NULL && depth > 0, UPNG_EPARAM);
+    if (upng_header(upng) != UPNG_EOK)
+        return upng->error;
+    CHECK_RET(upng, upng->frame_count > 0, UPNG_EPARAM);
+
+    upng_set_compositing(upng, 1);
+    format = upng_get_canvas_format(upng);
+
+    prefetch = (upng_prefetch*)UPNG_MEM_ALLOC(sizeof(upng_prefetch));
+    CHECK_RET(upng, prefetch != NULL, UPNG_ENOMEM);
+    memset(prefetch, 0, sizeof(upng_prefetch));
+    upng->prefetch = prefetch;
+    pthread_mutex_init(&prefetch->mutex, NULL);
+    pthread_cond_init(&prefetch->cond, NULL);
+    atomic_init(&prefetch->head, 0);
+    atomic_init(&prefetch->tail, 0);
+    atomic_init(&prefetch->producer_waiting, 0);
+    atomic_init(&prefetch->consumer_waiting, 0);
+    atomic_init(&prefetch->stop, 0);
+    atomic_init(&prefetch->done, 0);
+
+    prefetch->slots = (upng_prefetch_slot*)UPNG_MEM_ALLOC(sizeof(upng_prefetch_slot) * depth);
+    if (prefetch->slots == NULL)
+    {
+        UPNG_MEM_FREE(prefetch);
+        upng->prefetch = NULL;
+        SET_ERROR(upng, UPNG_ENOMEM);
+        return upng->error;
+    }
+    memset(prefetch->slots, 0, sizeof(upng_prefetch_slot) * depth);
+    prefetch->depth = depth;
+
+    prefetch->canvas_stride = ((unsigned long)upng->defaultImage.rect.width * upng_format_bpp(format) + 7) / 8;
+    prefetch->canvas_size = prefetch->canvas_stride * upng->defaultImage.rect.height;
+    for (i = 0; i < depth; i++)
+    {
+        prefetch->slots[i].canvas = (uint8_t*)UPNG_MEM_ALLOC(prefetch->canvas_size);
+        CHECK_GOTO(upng, prefetch->slots[i].canvas != NULL, UPNG_ENOMEM, error);
+    }
+
+    CHECK_GOTO(upng, pthread_create(&prefetch->thread, NULL, prefetch_worker, upng) == 0, UPNG_ENOMEM, error);
+    return UPNG_EOK;
+
+error:
+    free_prefetch(upng);
+    return upng->error;
+}
+
+const uint8_t *upng_prefetch_acquire(upng_t *upng, unsigned *index, int wait)
+{
+    upng_prefetch *prefetch = upng->prefetch;
+    unsigned long tail;
+    const upng_prefetch_slot *slot;
+
+    if (prefetch == NULL)
+        return NULL;
+    tail = atomic_load(&prefetch->tail);
+
+    if (atomic_load(&prefetch->head) == tail)
+    {
+        if (!wait)
+            return NULL;
+        pthread_mutex_lock(&prefetch->mutex);
+        atomic_store(&prefetch->consumer_waiting, 1);
+        while (atomic_load(&prefetch->head) == tail && !atomic_load(&prefetch->done))
+            pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+        atomic_store(&prefetch->consumer_waiting, 0);
+        pthread_mutex_unlock(&prefetch->mutex);
+
+        /* the worker stopped because of an error, see upng_get_error */
+        if (atomic_load(&prefetch->head) == tail)
+            return NULL;
+    }
+
+    slot = &prefetch->slots[tail % prefetch->depth];
+    if (index != NULL)
+        *index = slot->frame;
+    return slot->canvas;
+}
+
+void upng_prefetch_release(upng_t *upng)
+{
+    upng_prefetch *prefetch = upng->prefetch;
+    unsigned long tail;
+
+    if (prefetch == NULL)
+        return;
+    tail = atomic_load(&prefetch->tail);
+    if (atomic_load(&prefetch->head) == tail)
+        return;
+
+    atomic_store(&prefetch->tail, tail + 1);
+    wake(prefetch, &prefetch->producer_waiting);
+}
+
+void upng_prefetch_stop(upng_t *upng)
+{
+    upng_prefetch *prefetch = upng->prefetch;
+    if (prefetch == NULL)
+        return;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    atomic_store(&prefetch->stop, 1);
+    pthread_cond_broadcast(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->mutex);
+    pthread_join(prefetch->thread, NULL);
+
+    free_prefetch(upng);
+}
+
+#endif
@@ -0,0 +1,271 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+#include "gbitmap_sequence.h"
+
+#include <string.h>
+
+/*
+    Frames are composited straight into the memory of the bitmap passed to the updates,
+    which becomes the external canvas of upng. As long as the same bitmap is passed, every
+    update only composites the frames since the last one, another bitmap starts from scratch.
+*/
+
+struct GBitmapSequence
+{
+    upng_t *upng;
+    upng_playback *playback;
+    int32_t current_frame; // -1 before the first update
+    uint32_t elapsed_ms; // at which the current frame is shown
+    uint32_t plays; // completed plays
+    uint8_t *canvas; // memory of the bitmap frames are composited into
+};
+
+#ifdef UPNG_GBITMAP_HEADER
+static unsigned long resource_read(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    return resource_load_byte_range((ResHandle)user, offset, (uint8_t*)buffer, size);
+}
+
+GBitmapSequence *gbitmap_sequence_create_with_resource(uint32_t resource_id)
+{
+    ResHandle handle = resource_get_handle(resource_id);
+    upng_source source;
+
+    upng_source_init(&source);
+    source.user = handle;
+    source.size = resource_size(handle);
+    source.read = resource_read;
+    return gbitmap_sequence_create_with_source(source);
+}
+#endif
+
+GBitmapSequence *gbitmap_sequence_create_with_source(upng_source source)
+{
+    GBitmapSequence *sequence;
+    upng_t *upng = upng_new_from_source(source);
+
+    if (upng == NULL)
+        return NULL;
+    sequence = (GBitmapSequence*)UPNG_MEM_ALLOC(sizeof(GBitmapSequence));
+    if (sequence == NULL)
+    {
+        upng_free(upng);
+        return NULL;
+    }
+    memset(sequence, 0, sizeof(GBitmapSequence));
+    sequence->upng = upng;
+    sequence->current_frame = -1;
+
+    /* only animations have frames to play */
+    sequence->playback = upng_playback_new(upng);
+    if (sequence->playback == NULL)
+    {
+        gbitmap_sequence_destroy(sequence);
+        return NULL;
+    }
+    return sequence;
+}
+
+void gbitmap_sequence_destroy(GBitmapSequence *sequence)
+{
+    if (sequence == NULL)
+        return;
+    if (sequence->playback != NULL)
+        upng_playback_free(sequence->playback);
+    upng_free(sequence->upng);
+    UPNG_MEM_FREE(sequence);
+}
+
+bool gbitmap_sequence_restart(GBitmapSequence *sequence)
+{
+    sequence->current_frame = -1;
+    sequence->elapsed_ms = 0;
+    sequence->plays = 0;
+    return true;
+}
+
+/* fills the palette of a palettized bitmap with the palette of the image */
+static void fill_palette(const upng_t *upng, GColor8 *palette, unsigned depth)
+{
+    unsigned count = upng->palette_entries < (1u << depth) ? upng->palette_entries : (1u << depth);
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+    {
+        uint8_t alpha = i < upng->alpha_entries ? upng->alpha[i] : 0xFF;
+        palette[i].argb = (uint8_t)((alpha >> 6) << 6 | (upng->palette[i].r >> 6) << 4 |
+            (upng->palette[i].g >> 6) << 2 | upng->palette[i].b >> 6);
+    }
+}
+
+/* makes the bitmap the canvas, unless it is already */
+static bool attach_bitmap(GBitmapSequence *sequence, GBitmap *bitmap)
+{
+    upng_t *upng = sequence->upng;
+    GRect bounds = gbitmap_get_bounds(bitmap);
+    unsigned long stride = gbitmap_get_bytes_per_row(bitmap);
+    upng_format format;
+    unsigned bpp;
+    uint8_t *data;
+
+    switch (gbitmap_get_format(bitmap))
+    {
+    case GBitmapFormat8Bit:
+        format = UPNG_ARGB2222;
+        break;
+    case GBitmapFormat1BitPalette:
+        format = UPNG_INDEXED1;
+        break;
+    case GBitmapFormat2BitPalette:
+        format = UPNG_INDEXED2;
+        break;
+    case GBitmapFormat4BitPalette:
+        format = UPNG_INDEXED4;
+        break;
+    default:
+        /* 1 bit bitmaps store their pixels least significant bit first, circular ones have no rows */
+        return false;
+    }
+    bpp = upng_format_bpp(format);
+
+    if (bounds.size.w < 0 || bounds.size.h < 0 || (unsigned)bounds.size.w < upng->defaultImage.rect.width ||
+        (unsigned)bounds.size.h < upng->defaultImage.rect.height || (bounds.origin.x * bpp) % 8 != 0)
+        return false;
+    data = gbitmap_get_data(bitmap) + bounds.origin.y * stride + bounds.origin.x * bpp / 8;
+    if (data == sequence->canvas && format == upng->external_format)
+        return true;
+
+    /* palettized bitmaps hold the palette indices of the image */
+    if (format != UPNG_ARGB2222 && !(upng->flags & UPNG_FLAG_INDEXED_CANVAS))
+        upng_set_indexed_compositing(upng, 1);
+    sequence->canvas = NULL;
+    if (upng_set_external_canvas(upng, data, stride, format) != UPNG_EOK)
+        return false;
+    if (format != UPNG_ARGB2222)
+        fill_palette(upng, gbitmap_get_palette(bitmap), bpp);
+    sequence->canvas = data;
+    return true;
+}
+
+static uint32_t frame_delay_ms(const upng_t *upng, unsigned index)
+{
+    unsigned numerator, denominator;
+    if (upng_get_frame_delay(upng, index, &numerator, &denominator) != UPNG_EOK)
+        return 0;
+    return (uint32_t)((numerator * 1000ul + denominator / 2) / denominator);
+}
+
+bool gbitmap_sequence_update_bitmap_next_frame(GBitmapSequence *sequence, GBitmap *bitmap, uint32_t *delay_ms)
+{
+    upng_t *upng = sequence->upng;
+    uint32_t play_count = gbitmap_sequence_get_play_count(sequence);
+    uint32_t elapsed_ms = sequence->elapsed_ms;
+    uint32_t plays = sequence->plays;
+    int32_t next = sequence->current_frame + 1;
+
+    if (sequence->current_frame >= 0)
+        elapsed_ms += frame_delay_ms(upng, (unsigned)sequence->current_frame);
+    if ((uint32_t)next == upng->frame_count)
+    {
+        if (play_count != PLAY_COUNT_INFINITE && plays + 1 >= play_count)
+            return false;
+        plays++;
+        next = 0;
+    }
+
+    if (!attach_bitmap(sequence, bitmap) || upng_seek_frame(upng, (unsigned)next) != UPNG_EOK)
+        return false;
+    sequence->current_frame = next;
+    sequence->elapsed_ms = elapsed_ms;
+    sequence->plays = plays;
+    if (delay_ms != NULL)
+        *delay_ms = frame_delay_ms(upng, (unsigned)next);
+    return true;
+}
+
+bool gbitmap_sequence_update_bitmap_by_elapsed(GBitmapSequence *sequence, GBitmap *bitmap, uint32_t elapsed_ms)
+{
+    upng_playback *playback = sequence->playback;
+    unsigned index = upng_playback_frame_at(playback, elapsed_ms);
+    unsigned long duration = upng_playback_get_duration(playback);
+
+    if (upng_playback_finished(playback, elapsed_ms) && sequence->current_frame == (int32_t)index &&
+        upng_playback_finished(playback, sequence->elapsed_ms))
+        return false;
+
+    if (!attach_bitmap(sequence, bitmap) || upng_playback_update(playback, elapsed_ms) != UPNG_EOK)
+        return false;
+    sequence->current_frame = (int32_t)index;
+    sequence->elapsed_ms = elapsed_ms;
+    sequence->plays = duration > 0 ? (uint32_t)(elapsed_ms / duration) : 0;
+    return true;
+}
+
+int32_t gbitmap_sequence_get_current_frame_idx(const GBitmapSequence *sequence)
+{
+    return sequence->current_frame;
+}
+
+uint32_t gbitmap_sequence_get_current_frame_delay_ms(const GBitmapSequence *sequence)
+{
+    if (sequence->current_frame < 0)
+        return 0;
+    return frame_delay_ms(sequence->upng, (unsigned)sequence->current_frame);
+}
+
+uint32_t gbitmap_sequence_get_elapsed_ms(const GBitmapSequence *sequence)
+{
+    return sequence->elapsed_ms;
+}
+
+uint32_t gbitmap_sequence_get_total_num_frames(const GBitmapSequence *sequence)
+{
+    return sequence->upng->frame_count;
+}
+
+uint32_t gbitmap_sequence_get_play_count(const GBitmapSequence *sequence)
+{
+    return sequence->upng->play_count == 0 ? PLAY_COUNT_INFINITE : sequence->upng->play_count;
+}
+
+void gbitmap_sequence_set_play_count(GBitmapSequence *sequence, uint32_t play_count)
+{
+    /* APNG uses 0 for infinite plays, so no plays at all are a single one */
+    if (play_count == PLAY_COUNT_INFINITE)
+        sequence->upng->play_count = 0;
+    else
+        sequence->upng->play_count = play_count == 0 ? 1 : play_count;
+}
+
+GSize gbitmap_sequence_get_bitmap_size(const GBitmapSequence *sequence)
+{
+    GSize size;
+    size.w = (int16_t)sequence->upng->defaultImage.rect.width;
+    size.h = (int16_t)sequence->upng->defaultImage.rect.height;
+    return size;
+}
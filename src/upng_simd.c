@@ -0,0 +1,378 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+#include "upng_internal.h"
+
+#ifdef UPNG_HAVE_X86_SIMD
+
+#include <string.h>
+#include <immintrin.h>
+
+/*
+    Vectorized unfilter kernels, selected by upng_cpu.c. All of them expect a previous scanline
+    and follow the same aliasing rules as the scalar versions: recon may be the same address
+    as scanline (or lie before it), every vector is loaded before the overlapping store happens.
+    sub, avg and paeth carry a dependency from pixel to pixel, so these are only vectorized
+    inside a single pixel of 3 or 4 bytes and fall back to the scalar versions otherwise.
+*/
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static SSE2 __m128i load4(const void *p)
+{
+    int32_t v;
+    memcpy(&v, p, 4);
+    return _mm_cvtsi32_si128(v);
+}
+
+static SSE2 __m128i load3(const void *p)
+{
+    int32_t v = 0;
+    memcpy(&v, p, 3);
+    return _mm_cvtsi32_si128(v);
+}
+
+static SSE2 void store4(void *p, __m128i v)
+{
+    int32_t t = _mm_cvtsi128_si32(v);
+    memcpy(p, &t, 4);
+}
+
+static SSE2 void store3(void *p, __m128i v)
+{
+    int32_t t = _mm_cvtsi128_si32(v);
+    memcpy(p, &t, 3);
+}
+
+static SSE2 __m128i load_pixel(const uint8_t *p, unsigned long bytewidth)
+{
+    return bytewidth == 4 ? load4(p) : load3(p);
+}
+
+static SSE2 void store_pixel(uint8_t *p, __m128i v, unsigned long bytewidth)
+{
+    if (bytewidth == 4)
+        store4(p, v);
+    else
+        store3(p, v);
+}
+
+SSE2 void upng_unfilter_up_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(scanline + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(precon + i));
+        _mm_storeu_si128((__m128i *)(recon + i), _mm_add_epi8(x, b));
+    }
+    upng_unfilter_up_scalar(recon + i, scanline + i, precon + i, bytewidth, length - i);
+}
+
+AVX2 void upng_unfilter_up_avx2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    unsigned long i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(scanline + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(precon + i));
+        _mm256_storeu_si256((__m256i *)(recon + i), _mm256_add_epi8(x, b));
+    }
+    upng_unfilter_up_sse2(recon + i, scanline + i, precon + i, bytewidth, length - i);
+}
+
+SSE2 void upng_unfilter_sub_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    __m128i a = _mm_setzero_si128();
+    unsigned long i;
+
+    if (bytewidth != 3 && bytewidth != 4)
+    {
+        upng_unfilter_sub_scalar(recon, scanline, precon, bytewidth, length);
+        return;
+    }
+
+    for (i = 0; i < length; i += bytewidth)
+    {
+        a = _mm_add_epi8(load_pixel(scanline + i, bytewidth), a);
+        store_pixel(recon + i, a, bytewidth);
+    }
+}
+
+SSE2 void upng_unfilter_avg_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i a = _mm_setzero_si128();
+    unsigned long i;
+
+    if (bytewidth != 3 && bytewidth != 4)
+    {
+        upng_unfilter_avg_scalar(recon, scanline, precon, bytewidth, length);
+        return;
+    }
+
+    for (i = 0; i < length; i += bytewidth)
+    {
+        __m128i b = load_pixel(precon + i, bytewidth);
+        __m128i x = load_pixel(scanline + i, bytewidth);
+
+        /* _mm_avg_epu8 rounds up, the filter rounds down */
+        __m128i avg = _mm_avg_epu8(a, b);
+        avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), one));
+
+        a = _mm_add_epi8(x, avg);
+        store_pixel(recon + i, a, bytewidth);
+    }
+}
+
+static SSE2 __m128i abs_epi16(__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static SSE2 __m128i select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+SSE2 void upng_unfilter_paeth_sse2(uint8_t *recon, const uint8_t *scanline, const uint8_t *precon, unsigned long bytewidth, unsigned long length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, c = zero;
+    unsigned long i;
+
+    if (bytewidth != 3 && bytewidth != 4)
+    {
+        upng_unfilter_paeth_scalar(recon, scanline, precon, bytewidth, length);
+        return;
+    }
+
+    /* samples are widened to 16 bit, the predictor distances do not fit into 8 bit */
+    for (i = 0; i < length; i += bytewidth)
+    {
+        __m128i b = _mm_unpacklo_epi8(load_pixel(precon + i, bytewidth), zero);
+        __m128i x = _mm_unpacklo_epi8(load_pixel(scanline + i, bytewidth), zero);
+
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+        pa = abs_epi16(pa);
+        pb = abs_epi16(pb);
+
+        __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        __m128i nearest = select_epi16(_mm_cmpeq_epi16(pa, smallest), a,
+                          select_epi16(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+        /* adding bytes keeps the upper half of every lane zero */
+        a = _mm_add_epi8(x, nearest);
+        store_pixel(recon + i, _mm_packus_epi16(a, a), bytewidth);
+        c = b;
+    }
+}
+
+/*
+    Vectorized over operator for 8 bit RGBA and luminance alpha. Vectors whose source pixels are
+    all opaque or all transparent are copied or skipped. The exact operator only reduces to a
+    single weighted sum if the destination is opaque, other vectors use the scalar version.
+    Premultiplied destinations always take the weighted sum.
+*/
+
+static upng_blend_kernel scalar_blend(unsigned pixel_bytes, int premultiplied)
+{
+    if (pixel_bytes == 4)
+        return premultiplied ? upng_blend_rgba8_premultiplied_scalar : upng_blend_rgba8_scalar;
+    return premultiplied ? upng_blend_la8_premultiplied_scalar : upng_blend_la8_scalar;
+}
+
+/* rounded x / 255 in every 16 bit lane */
+static SSE2 __m128i div255_epu16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static SSE2 __m128i broadcast_alpha(__m128i x, unsigned pixel_bytes)
+{
+    if (pixel_bytes == 4)
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+/* blends widened pixels, alpha_lanes holds 0xFF in the alpha lanes */
+static SSE2 __m128i over_epi16(__m128i s, __m128i d, __m128i alpha_lanes, unsigned pixel_bytes, int premultiplied)
+{
+    __m128i a = broadcast_alpha(s, pixel_bytes);
+    __m128i ia = _mm_sub_epi16(_mm_set1_epi16(0xFF), a);
+    if (premultiplied)
+    {
+        __m128i weight = _mm_or_si128(_mm_andnot_si128(alpha_lanes, a), alpha_lanes);
+        return _mm_add_epi16(div255_epu16(_mm_mullo_epi16(s, weight)), div255_epu16(_mm_mullo_epi16(d, ia)));
+    }
+    return div255_epu16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia)));
+}
+
+static SSE2 void blend_sse2(uint8_t *dst, const uint8_t *src, unsigned long count, unsigned pixel_bytes, int premultiplied)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = pixel_bytes == 4 ? _mm_set1_epi32((int)0xFF000000u) : _mm_set1_epi16((short)0xFF00);
+    const __m128i alpha_lanes = _mm_unpacklo_epi8(alpha, zero);
+    unsigned long i, bytes = count * pixel_bytes;
+
+    for (i = 0; i + 16 <= bytes; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i sa = _mm_and_si128(s, alpha);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(sa, alpha)) == 0xFFFF)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(sa, zero)) == 0xFFFF)
+            continue;
+        if (!premultiplied && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(d, alpha), alpha)) != 0xFFFF)
+        {
+            scalar_blend(pixel_bytes, premultiplied)(dst + i, src + i, 16 / pixel_bytes);
+            continue;
+        }
+
+        __m128i lo = over_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), alpha_lanes, pixel_bytes, premultiplied);
+        __m128i hi = over_epi16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), alpha_lanes, pixel_bytes, premultiplied);
+        __m128i result = _mm_packus_epi16(lo, hi);
+        if (!premultiplied)
+            result = _mm_or_si128(result, alpha);
+        _mm_storeu_si128((__m128i *)(dst + i), result);
+    }
+
+    scalar_blend(pixel_bytes, premultiplied)(dst + i, src + i, (bytes - i) / pixel_bytes);
+}
+
+SSE2 void upng_blend_rgba8_sse2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_sse2(dst, src, count, 4, 0);
+}
+
+SSE2 void upng_blend_la8_sse2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_sse2(dst, src, count, 2, 0);
+}
+
+SSE2 void upng_blend_rgba8_premultiplied_sse2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_sse2(dst, src, count, 4, 1);
+}
+
+SSE2 void upng_blend_la8_premultiplied_sse2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_sse2(dst, src, count, 2, 1);
+}
+
+static AVX2 __m256i div255_epu16_avx2(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static AVX2 __m256i broadcast_alpha_avx2(__m256i x, unsigned pixel_bytes)
+{
+    if (pixel_bytes == 4)
+        return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+static AVX2 __m256i over_epi16_avx2(__m256i s, __m256i d, __m256i alpha_lanes, unsigned pixel_bytes, int premultiplied)
+{
+    __m256i a = broadcast_alpha_avx2(s, pixel_bytes);
+    __m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(0xFF), a);
+    if (premultiplied)
+    {
+        __m256i weight = _mm256_or_si256(_mm256_andnot_si256(alpha_lanes, a), alpha_lanes);
+        return _mm256_add_epi16(div255_epu16_avx2(_mm256_mullo_epi16(s, weight)), div255_epu16_avx2(_mm256_mullo_epi16(d, ia)));
+    }
+    return div255_epu16_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, ia)));
+}
+
+/* unpacking and packing both work inside 128 bit halves, so pixels keep their place */
+static AVX2 void blend_avx2(uint8_t *dst, const uint8_t *src, unsigned long count, unsigned pixel_bytes, int premultiplied)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = pixel_bytes == 4 ? _mm256_set1_epi32((int)0xFF000000u) : _mm256_set1_epi16((short)0xFF00);
+    const __m256i alpha_lanes = _mm256_unpacklo_epi8(alpha, zero);
+    unsigned long i, bytes = count * pixel_bytes;
+
+    for (i = 0; i + 32 <= bytes; i += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i sa = _mm256_and_si256(s, alpha);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(sa, alpha)) == -1)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(sa, zero)) == -1)
+            continue;
+        if (!premultiplied && _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(d, alpha), alpha)) != -1)
+        {
+            scalar_blend(pixel_bytes, premultiplied)(dst + i, src + i, 32 / pixel_bytes);
+            continue;
+        }
+
+        __m256i lo = over_epi16_avx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), alpha_lanes, pixel_bytes, premultiplied);
+        __m256i hi = over_epi16_avx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), alpha_lanes, pixel_bytes, premultiplied);
+        __m256i result = _mm256_packus_epi16(lo, hi);
+        if (!premultiplied)
+            result = _mm256_or_si256(result, alpha);
+        _mm256_storeu_si256((__m256i *)(dst + i), result);
+    }
+
+    blend_sse2(dst + i, src + i, (bytes - i) / pixel_bytes, pixel_bytes, premultiplied);
+}
+
+AVX2 void upng_blend_rgba8_avx2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_avx2(dst, src, count, 4, 0);
+}
+
+AVX2 void upng_blend_la8_avx2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_avx2(dst, src, count, 2, 0);
+}
+
+AVX2 void upng_blend_rgba8_premultiplied_avx2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_avx2(dst, src, count, 4, 1);
+}
+
+AVX2 void upng_blend_la8_premultiplied_avx2(uint8_t *dst, const uint8_t *src, unsigned long count)
+{
+    blend_avx2(dst, src, count, 2, 1);
+}
+
+#endif
@@ -0,0 +1,754 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+/* pread of the async file source is POSIX, which strict C modes hide unless asked for */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "upng_internal.h"
+
+#include <string.h>
+#include <limits.h>
+
+#if defined(UPNG_USE_MMAP) || defined(UPNG_USE_THREADS)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef UPNG_USE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef UPNG_USE_THREADS
+#include <pthread.h>
+#endif
+
+/*
+    Sources of upng, the byte and file sources behind upng_new_from_bytes and upng_new_from_file,
+    and a block cache which can wrap any source. Chunk headers and small chunks are read in many
+    small pieces while parsing, which the cache turns into few aligned reads of whole blocks.
+    Sources which can map their bytes into memory are parsed and inflated from there without copies,
+    sources which read asynchronously get the next payload requested while a frame is decoded.
+    Streams are read forward only, bytes between the requested ranges are skipped.
+*/
+
+const uint8_t *upng_source_bytes(upng_t *upng, unsigned long offset, void *buffer, unsigned long size)
+{
+    if (upng->mapped != NULL)
+        return offset <= upng->source.size && size <= upng->source.size - offset ? upng->mapped + offset : NULL;
+    if (upng->source.read(upng->source.user, offset, buffer, size) != size)
+        return NULL;
+    return (const uint8_t*)buffer;
+}
+
+int upng_source_copy(upng_t *upng, unsigned long offset, void *buffer, unsigned long size)
+{
+    const uint8_t *bytes = upng_source_bytes(upng, offset, buffer, size);
+    if (bytes != NULL && bytes != buffer)
+        memcpy(buffer, bytes, size);
+    return bytes != NULL;
+}
+
+int upng_source_read_spans(upng_t *upng, const upng_frame *frame, uint8_t *buffer)
+{
+    const upng_source_span *spans = upng->spans + frame->first_span;
+    unsigned long done = 0;
+    unsigned i;
+
+    if (frame->data_chunks == 0)
+        return 1;
+    if (upng->mapped == NULL && upng->source.readv != NULL)
+        return upng->source.readv(upng->source.user, spans, frame->data_chunks, buffer) == frame->compressed_size;
+    for (i = 0; i < frame->data_chunks; i++)
+    {
+        if (!upng_source_copy(upng, spans[i].offset, buffer + done, spans[i].size))
+            return 0;
+        done += spans[i].size;
+    }
+    return 1;
+}
+
+typedef struct upng_byte_source_context
+{
+    uint8_t* buffer;
+    unsigned long size;
+} upng_byte_source_context;
+
+static unsigned long upng_byte_source_read(void* user, unsigned long offset, void* out_buffer, unsigned long read_size)
+{
+    upng_byte_source_context* context = (upng_byte_source_context*)user;
+    if (offset >= context->size)
+        return 0;
+
+    unsigned long bytes_to_copy = read_size;
+    if (offset + bytes_to_copy > context->size)
+        bytes_to_copy = context->size - offset;
+
+    memcpy(out_buffer, context->buffer + offset, bytes_to_copy);
+    return bytes_to_copy;
+}
+
+static const void* upng_byte_source_map(void* user, unsigned long offset, unsigned long size)
+{
+    upng_byte_source_context* context = (upng_byte_source_context*)user;
+    if (offset > context->size || size > context->size - offset)
+        return NULL;
+    return context->buffer + offset;
+}
+
+static void upng_byte_source_free(void* user)
+{
+    UPNG_MEM_FREE(user);
+}
+
+void upng_source_init(upng_source *source)
+{
+    memset(source, 0, sizeof(upng_source));
+    source->version = UPNG_SOURCE_VERSION;
+}
+
+void upng_source_check_version(upng_source *source)
+{
+    /* the optional members of sources filled in without upng_source_init may hold anything */
+    if (source->version == UPNG_SOURCE_VERSION)
+        return;
+    source->version = UPNG_SOURCE_VERSION;
+    source->map = NULL;
+    source->readv = NULL;
+    source->submit = NULL;
+    source->complete = NULL;
+    source->sequential = 0;
+}
+
+upng_error upng_source_from_bytes(upng_source *source, uint8_t *buffer, unsigned long size)
+{
+    upng_byte_source_context* context = (upng_byte_source_context*)UPNG_MEM_ALLOC(sizeof(upng_byte_source_context));
+    if (context == NULL)
+        return UPNG_ENOMEM;
+    context->buffer = buffer;
+    context->size = size;
+
+    upng_source_init(source);
+    source->user = context;
+    source->size = size;
+    source->read = upng_byte_source_read;
+    source->map = upng_byte_source_map;
+    source->free = upng_byte_source_free;
+    return UPNG_EOK;
+}
+
+#ifdef UPNG_USE_STDIO
+typedef struct upng_file_source_context
+{
+    FILE* fp;
+    unsigned long size;
+    unsigned long position; // of the file pointer, reads from there need no seek
+} upng_file_source_context;
+
+static unsigned long upng_file_source_read(void* user, unsigned long offset, void* out_buffer, unsigned long read_size)
+{
+    upng_file_source_context* context = (upng_file_source_context*)user;
+    unsigned long bytes_read;
+    if (offset >= context->size)
+        return 0;
+
+    unsigned long bytes_to_read = read_size;
+    if (offset + bytes_to_read > context->size)
+        bytes_to_read = context->size - offset;
+
+    if (offset != context->position && fseek(context->fp, (long)offset, SEEK_SET) != 0)
+    {
+        context->position = ULONG_MAX;
+        return 0;
+    }
+    bytes_read = fread(out_buffer, 1, bytes_to_read, context->fp);
+    context->position = offset + bytes_read;
+    return bytes_read;
+}
+
+/* spans of one frame are a few bytes apart, the chunk boundaries between them are read over instead of seeking */
+static unsigned long upng_file_source_readv(void* user, const upng_source_span* spans, unsigned count, void* buffer)
+{
+    upng_file_source_context* context = (upng_file_source_context*)user;
+    uint8_t* out = (uint8_t*)buffer;
+    uint8_t gap[64];
+    unsigned long done = 0;
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned long offset = spans[i].offset, got;
+        if (offset > context->position && offset - context->position <= sizeof(gap))
+        {
+            unsigned long skip = offset - context->position;
+            if (fread(gap, 1, skip, context->fp) != skip)
+            {
+                context->position = ULONG_MAX;
+                break;
+            }
+            context->position = offset;
+        }
+        got = upng_file_source_read(user, offset, out + done, spans[i].size);
+        done += got;
+        if (got != spans[i].size)
+            break;
+    }
+    return done;
+}
+
+static void upng_file_source_free(void* user)
+{
+    upng_file_source_context* context = (upng_file_source_context*)user;
+    fclose(context->fp);
+    UPNG_MEM_FREE(context);
+}
+
+upng_error upng_source_new_file(const char *path, upng_source *source)
+{
+    upng_file_source_context* context;
+    long size;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return UPNG_ENOTFOUND;
+
+    /* the size is only determined once */
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+    {
+        fclose(fp);
+        return UPNG_EREAD;
+    }
+    context = (upng_file_source_context*)UPNG_MEM_ALLOC(sizeof(upng_file_source_context));
+    if (context == NULL)
+    {
+        fclose(fp);
+        return UPNG_ENOMEM;
+    }
+    context->fp = fp;
+    context->size = (unsigned long)size;
+    context->position = (unsigned long)size;
+
+    upng_source_init(source);
+    source->user = context;
+    source->size = (unsigned long)size;
+    source->read = upng_file_source_read;
+    source->readv = upng_file_source_readv;
+    source->free = upng_file_source_free;
+    return UPNG_EOK;
+}
+#endif
+
+#ifdef UPNG_USE_MMAP
+static void upng_mapped_file_free(void* user)
+{
+    upng_byte_source_context* context = (upng_byte_source_context*)user;
+    if (context->size > 0)
+        munmap(context->buffer, context->size);
+    UPNG_MEM_FREE(context);
+}
+
+upng_error upng_source_new_mapped_file(const char *path, upng_source *source)
+{
+    upng_byte_source_context* context;
+    struct stat info;
+    void* data = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return UPNG_ENOTFOUND;
+
+    /* the mapping stays valid after closing, empty files cannot be mapped but have nothing to read either */
+    if (fstat(fd, &info) != 0 || (info.st_size > 0 &&
+        (data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+    {
+        close(fd);
+        return UPNG_EREAD;
+    }
+    close(fd);
+
+    context = (upng_byte_source_context*)UPNG_MEM_ALLOC(sizeof(upng_byte_source_context));
+    if (context == NULL)
+    {
+        if (data != NULL)
+            munmap(data, (size_t)info.st_size);
+        return UPNG_ENOMEM;
+    }
+    context->buffer = (uint8_t*)data;
+    context->size = (unsigned long)info.st_size;
+
+    upng_source_init(source);
+    source->user = context;
+    source->size = context->size;
+    source->read = upng_byte_source_read;
+    source->map = upng_byte_source_map;
+    source->free = upng_mapped_file_free;
+    return UPNG_EOK;
+}
+#endif
+
+#ifdef UPNG_USE_THREADS
+typedef struct upng_async_read
+{
+    struct upng_async_read *next; // in the queue
+    unsigned long offset;
+    unsigned long size;
+    void *buffer;
+    unsigned long result;
+    int done;
+} upng_async_read;
+
+typedef struct upng_async_file
+{
+    int fd;
+    unsigned long size;
+    pthread_mutex_t mutex;
+    pthread_cond_t queued; // reads were queued or the pool stops
+    pthread_cond_t done; // a read finished
+    upng_async_read *head, *tail; // reads not started yet, in submission order
+    int stop;
+    unsigned thread_count;
+    pthread_t *threads;
+} upng_async_file;
+
+/* positioned reads need no file pointer, so the workers and the decoding thread read concurrently */
+static unsigned long read_at(const upng_async_file *file, unsigned long offset, void *buffer, unsigned long size)
+{
+    unsigned long done = 0;
+    if (offset >= file->size)
+        return 0;
+    if (size > file->size - offset)
+        size = file->size - offset;
+    while (done < size)
+    {
+        ssize_t got = pread(file->fd, (uint8_t*)buffer + done, size - done, (off_t)(offset + done));
+        if (got <= 0)
+            break;
+        done += (unsigned long)got;
+    }
+    return done;
+}
+
+static void *async_file_worker(void *arg)
+{
+    upng_async_file *file = (upng_async_file*)arg;
+    pthread_mutex_lock(&file->mutex);
+    while (!file->stop)
+    {
+        upng_async_read *read = file->head;
+        if (read == NULL)
+        {
+            pthread_cond_wait(&file->queued, &file->mutex);
+            continue;
+        }
+        file->head = read->next;
+        if (file->head == NULL)
+            file->tail = NULL;
+
+        pthread_mutex_unlock(&file->mutex);
+        read->result = read_at(file, read->offset, read->buffer, read->size);
+        pthread_mutex_lock(&file->mutex);
+        read->done = 1;
+        pthread_cond_broadcast(&file->done);
+    }
+    pthread_mutex_unlock(&file->mutex);
+    return NULL;
+}
+
+static unsigned long async_file_read(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    return read_at((upng_async_file*)user, offset, buffer, size);
+}
+
+/* all spans are read in one call on the calling thread, the workers keep serving prefetches */
+static unsigned long async_file_readv(void *user, const upng_source_span *spans, unsigned count, void *buffer)
+{
+    const upng_async_file *file = (const upng_async_file*)user;
+    unsigned long done = 0;
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned long got = read_at(file, spans[i].offset, (uint8_t*)buffer + done, spans[i].size);
+        done += got;
+        if (got != spans[i].size)
+            break;
+    }
+    return done;
+}
+
+static void *async_file_submit(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    upng_async_file *file = (upng_async_file*)user;
+    upng_async_read *read = (upng_async_read*)UPNG_MEM_ALLOC(sizeof(upng_async_read));
+    if (read == NULL)
+        return NULL;
+    read->next = NULL;
+    read->offset = offset;
+    read->size = size;
+    read->buffer = buffer;
+    read->result = 0;
+    read->done = 0;
+
+    pthread_mutex_lock(&file->mutex);
+    if (file->tail != NULL)
+        file->tail->next = read;
+    else
+        file->head = read;
+    file->tail = read;
+    pthread_cond_signal(&file->queued);
+    pthread_mutex_unlock(&file->mutex);
+    return read;
+}
+
+static unsigned long async_file_complete(void *user, void *request)
+{
+    upng_async_file *file = (upng_async_file*)user;
+    upng_async_read *read = (upng_async_read*)request;
+    unsigned long result;
+
+    pthread_mutex_lock(&file->mutex);
+    while (!read->done)
+        pthread_cond_wait(&file->done, &file->mutex);
+    pthread_mutex_unlock(&file->mutex);
+    result = read->result;
+    UPNG_MEM_FREE(read);
+    return result;
+}
+
+/* stops the threads which were started, every submitted read was completed before */
+static void async_file_stop(upng_async_file *file, unsigned started)
+{
+    unsigned i;
+    pthread_mutex_lock(&file->mutex);
+    file->stop = 1;
+    pthread_cond_broadcast(&file->queued);
+    pthread_mutex_unlock(&file->mutex);
+    for (i = 0; i < started; i++)
+        pthread_join(file->threads[i], NULL);
+
+    pthread_cond_destroy(&file->done);
+    pthread_cond_destroy(&file->queued);
+    pthread_mutex_destroy(&file->mutex);
+    close(file->fd);
+    UPNG_MEM_FREE(file);
+}
+
+static void async_file_free(void *user)
+{
+    upng_async_file *file = (upng_async_file*)user;
+    async_file_stop(file, file->thread_count);
+}
+
+upng_error upng_source_new_async_file(const char *path, unsigned threads, upng_source *source)
+{
+    upng_async_file *file;
+    struct stat info;
+    unsigned i;
+    int fd;
+
+    if (threads == 0)
+        return UPNG_EPARAM;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return UPNG_ENOTFOUND;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return UPNG_EREAD;
+    }
+
+    file = (upng_async_file*)UPNG_MEM_ALLOC(sizeof(upng_async_file) + sizeof(pthread_t) * threads);
+    if (file == NULL)
+    {
+        close(fd);
+        return UPNG_ENOMEM;
+    }
+    memset(file, 0, sizeof(upng_async_file));
+    file->fd = fd;
+    file->size = (unsigned long)info.st_size;
+    file->threads = (pthread_t*)(file + 1);
+    pthread_mutex_init(&file->mutex, NULL);
+    pthread_cond_init(&file->queued, NULL);
+    pthread_cond_init(&file->done, NULL);
+    for (i = 0; i < threads; i++)
+    {
+        if (pthread_create(&file->threads[i], NULL, async_file_worker, file) != 0)
+        {
+            async_file_stop(file, i);
+            return UPNG_ENOMEM;
+        }
+    }
+    file->thread_count = threads;
+
+    upng_source_init(source);
+    source->user = file;
+    source->size = file->size;
+    source->read = async_file_read;
+    source->readv = async_file_readv;
+    source->submit = async_file_submit;
+    source->complete = async_file_complete;
+    source->free = async_file_free;
+    return UPNG_EOK;
+}
+#endif
+
+typedef struct upng_stream_source_context
+{
+    upng_stream_read_cb read;
+    void *user;
+    unsigned long position; // bytes taken from the stream so far
+} upng_stream_source_context;
+
+/* reads until size bytes arrived or the stream ended */
+static unsigned long stream_take(upng_stream_source_context *context, void *buffer, unsigned long size)
+{
+    unsigned long done = 0, got;
+
+    while (done < size)
+    {
+        got = context->read(context->user, (uint8_t*)buffer + done, size - done);
+        if (got == 0)
+            break;
+        done += got;
+    }
+    context->position += done;
+    return done;
+}
+
+static unsigned long stream_source_read(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    upng_stream_source_context *context = (upng_stream_source_context*)user;
+    uint8_t skipped[512];
+
+    /* bytes before offset are skipped, bytes before the position are gone */
+    if (offset < context->position)
+        return 0;
+    while (context->position < offset)
+    {
+        unsigned long count = offset - context->position < sizeof(skipped) ? offset - context->position : sizeof(skipped);
+        if (stream_take(context, skipped, count) != count)
+            return 0;
+    }
+    return stream_take(context, buffer, size);
+}
+
+static void stream_source_free(void *user)
+{
+    UPNG_MEM_FREE(user);
+}
+
+upng_error upng_source_new_stream(upng_stream_read_cb read, void *user, upng_source *source)
+{
+    upng_stream_source_context *context = (upng_stream_source_context*)UPNG_MEM_ALLOC(sizeof(upng_stream_source_context));
+    if (context == NULL)
+        return UPNG_ENOMEM;
+    context->read = read;
+    context->user = user;
+    context->position = 0;
+
+    upng_source_init(source);
+    source->user = context;
+    source->size = ULONG_MAX;
+    source->read = stream_source_read;
+    source->free = stream_source_free;
+    source->sequential = 1;
+    return UPNG_EOK;
+}
+
+typedef struct upng_block
+{
+    unsigned long offset; // in the source, ULONG_MAX for unused blocks
+    unsigned long length; // shorter than the block size at the end of the source
+    unsigned long last_use;
+} upng_block;
+
+typedef struct upng_block_cache
+{
+    upng_source source;
+    unsigned long block_size;
+    unsigned count;
+    unsigned read_ahead;
+    unsigned long clock;
+    upng_block *blocks;
+    uint8_t *data; // count blocks
+    uint8_t *staging; // a missing block and the blocks read ahead with it
+} upng_block_cache;
+
+static upng_block *find_block(upng_block_cache *cache, unsigned long offset)
+{
+    unsigned i;
+    for (i = 0; i < cache->count; i++)
+    {
+        if (cache->blocks[i].offset == offset)
+            return &cache->blocks[i];
+    }
+    return NULL;
+}
+
+static upng_block *least_recent_block(upng_block_cache *cache)
+{
+    upng_block *victim = &cache->blocks[0];
+    unsigned i;
+    for (i = 1; i < cache->count; i++)
+    {
+        if (cache->blocks[i].last_use < victim->last_use)
+            victim = &cache->blocks[i];
+    }
+    return victim;
+}
+
+/* reads the block at offset and the ones after it with a single read of the source */
+static upng_block *load_blocks(upng_block_cache *cache, unsigned long offset)
+{
+    unsigned long length = cache->block_size * (cache->read_ahead + 1), got, i;
+    upng_block *first = NULL;
+
+    if (length > cache->source.size - offset)
+        length = cache->source.size - offset;
+    got = cache->source.read(cache->source.user, offset, cache->staging, length);
+
+    for (i = 0; i < got; i += cache->block_size)
+    {
+        upng_block *block = find_block(cache, offset + i);
+        if (block == NULL)
+        {
+            block = least_recent_block(cache);
+            block->offset = offset + i;
+            block->length = got - i < cache->block_size ? got - i : cache->block_size;
+            memcpy(cache->data + (block - cache->blocks) * cache->block_size, cache->staging + i, block->length);
+        }
+        block->last_use = ++cache->clock;
+        if (first == NULL)
+            first = block;
+    }
+    return first;
+}
+
+static unsigned long block_cache_read(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    uint8_t *out = (uint8_t*)buffer;
+    unsigned long done = 0;
+
+    if (offset >= cache->source.size)
+        return 0;
+    if (size > cache->source.size - offset)
+        size = cache->source.size - offset;
+
+    /* large reads like frame payloads gain nothing from blocks */
+    if (size >= cache->block_size)
+        return cache->source.read(cache->source.user, offset, buffer, size);
+
+    while (done < size)
+    {
+        unsigned long start = (offset + done) & ~(cache->block_size - 1);
+        unsigned long skip = offset + done - start, count;
+        upng_block *block = find_block(cache, start);
+
+        if (block != NULL)
+            block->last_use = ++cache->clock;
+        else
+            block = load_blocks(cache, start);
+        if (block == NULL || block->length <= skip)
+            break;
+
+        count = block->length - skip < size - done ? block->length - skip : size - done;
+        memcpy(out + done, cache->data + (block - cache->blocks) * cache->block_size + skip, count);
+        done += count;
+    }
+    return done;
+}
+
+static const void *block_cache_map(void *user, unsigned long offset, unsigned long size)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    return cache->source.map(cache->source.user, offset, size);
+}
+
+/* vectored and asynchronous reads are only made for payloads, which bypass the cache anyway */
+static unsigned long block_cache_readv(void *user, const upng_source_span *spans, unsigned count, void *buffer)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    return cache->source.readv(cache->source.user, spans, count, buffer);
+}
+
+static void *block_cache_submit(void *user, unsigned long offset, void *buffer, unsigned long size)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    return cache->source.submit(cache->source.user, offset, buffer, size);
+}
+
+static unsigned long block_cache_complete(void *user, void *request)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    return cache->source.complete(cache->source.user, request);
+}
+
+static void block_cache_free(void *user)
+{
+    upng_block_cache *cache = (upng_block_cache*)user;
+    if (cache->source.free != NULL)
+        cache->source.free(cache->source.user);
+    UPNG_MEM_FREE(cache);
+}
+
+upng_error upng_source_add_block_cache(upng_source *source, unsigned long block_size, unsigned blocks, unsigned read_ahead)
+{
+    upng_block_cache *cache;
+    unsigned i;
+
+    upng_source_check_version(source);
+    /* blocks read ahead must not evict the block they were read with, nor can blocks be read again from streams */
+    if (block_size == 0 || (block_size & (block_size - 1)) != 0 || blocks == 0 || read_ahead >= blocks || source->sequential)
+        return UPNG_EPARAM;
+
+    /* a single allocation holds the bookkeeping, the blocks and the staging area */
+    cache = (upng_block_cache*)UPNG_MEM_ALLOC(sizeof(upng_block_cache) + sizeof(upng_block) * blocks +
+        block_size * (blocks + read_ahead + 1));
+    if (cache == NULL)
+        return UPNG_ENOMEM;
+    memset(cache, 0, sizeof(upng_block_cache));
+    cache->source = *source;
+    cache->block_size = block_size;
+    cache->count = blocks;
+    cache->read_ahead = read_ahead;
+    cache->blocks = (upng_block*)(cache + 1);
+    cache->data = (uint8_t*)(cache->blocks + blocks);
+    cache->staging = cache->data + block_size * blocks;
+    for (i = 0; i < blocks; i++)
+    {
+        cache->blocks[i].offset = ULONG_MAX;
+        cache->blocks[i].length = 0;
+        cache->blocks[i].last_use = 0;
+    }
+
+    source->user = cache;
+    source->read = block_cache_read;
+    source->map = cache->source.map != NULL ? block_cache_map : NULL;
+    source->readv = cache->source.readv != NULL ? block_cache_readv : NULL;
+    source->submit = cache->source.submit != NULL ? block_cache_submit : NULL;
+    source->complete = cache->source.submit != NULL ? block_cache_complete : NULL;
+    source->free = block_cache_free;
+    return UPNG_EOK;
+}
@@ -0,0 +1,342 @@
+/*
+auPNG -- derived from LodePNG version 20100808
+
+Copyright (c) 2005-2010 Lode Vandevenne
+Copyright (c) 2010 Sean Middleditch
+Copyright (c) 2019 Helco
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+                1. The origin of this software must not be misrepresented; you must not
+                claim that you wrote the original software. If you use this software
+                in a product, an acknowledgment in the product documentation would be
+                appreciated but is not required.
+
+                2. Altered source versions must be plainly marked as such, and must not be
+                misrepresented as being the original software.
+
+                3. This notice may not be removed or altered from any source
+                distribution.
+*/
+
+#include "upng_internal.h"
+
+#include <string.h>
+
+/*
+    Tiled canvases are split into UPNG_TILE_SIZE square tiles which are only allocated
+    once something is blended onto them, so memory scales with the animated area.
+    Tiles are reference counted: saving a rect for PREVIOUS only references the tiles
+    it covers and restoring puts them back, writes copy a tile first if it is shared.
+    Tiles written by a frame are hashed afterwards and replaced by an identical tile
+    anywhere on the canvas or in the saved state, so repeated content is kept once.
+*/
+
+static unsigned long tile_size(const upng_canvas *canvas)
+{
+    return canvas->tile_stride * UPNG_TILE_SIZE;
+}
+
+/* removes the tile from the table, moving back the entries probed past it */
+static void unhash_tile(upng_canvas *canvas, upng_tile *tile)
+{
+    unsigned long mask = canvas->table_size - 1, i = (unsigned long)tile->hash & mask, j;
+
+    while (canvas->table[i] != tile)
+        i = (i + 1) & mask;
+    canvas->table[i] = NULL;
+    for (j = (i + 1) & mask; canvas->table[j] != NULL; j = (j + 1) & mask)
+    {
+        unsigned long home = (unsigned long)canvas->table[j]->hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            canvas->table[i] = canvas->table[j];
+            canvas->table[j] = NULL;
+            i = j;
+        }
+    }
+    tile->hashed = 0;
+}
+
+static void release_tile(upng_canvas *canvas, upng_tile *tile)
+{
+    if (tile == NULL || --tile->refs > 0)
+        return;
+    if (tile->hashed)
+        unhash_tile(canvas, tile);
+    UPNG_MEM_FREE(tile);
+}
+
+/* range of tiles covered by a rect, the ends are exclusive */
+static void tile_range(const upng_rect *rect, unsigned *x0, unsigned *y0, unsigned *x1, unsigned *y1)
+{
+    *x0 = (unsigned)rect->x_offset / UPNG_TILE_SIZE;
+    *y0 = (unsigned)rect->y_offset / UPNG_TILE_SIZE;
+    *x1 = ((unsigned)rect->x_offset + rect->width + UPNG_TILE_SIZE - 1) / UPNG_TILE_SIZE;
+    *y1 = ((unsigned)rect->y_offset + rect->height + UPNG_TILE_SIZE - 1) / UPNG_TILE_SIZE;
+}
+
+upng_error upng_tiles_alloc(upng_t *upng)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned long count, saved, live;
+
+    canvas->tiles_x = (upng->defaultImage.rect.width + UPNG_TILE_SIZE - 1) / UPNG_TILE_SIZE;
+    canvas->tiles_y = (upng->defaultImage.rect.height + UPNG_TILE_SIZE - 1) / UPNG_TILE_SIZE;
+    canvas->tile_stride = (unsigned long)UPNG_TILE_SIZE * canvas->bpp / 8;
+    count = (unsigned long)canvas->tiles_x * canvas->tiles_y;
+    canvas->tiles = (upng_tile**)UPNG_MEM_ALLOC(sizeof(upng_tile*) * count);
+    CHECK_RET(upng, canvas->tiles != NULL, UPNG_ENOMEM);
+    memset(canvas->tiles, 0, sizeof(upng_tile*) * count);
+
+    /* sized for the largest PREVIOUS rect at any position, so saving never allocates */
+    saved = (unsigned long)(upng->save_width / UPNG_TILE_SIZE + 2) * (upng->save_height / UPNG_TILE_SIZE + 2);
+    if (upng->save_width > 0)
+    {
+        upng->saved_tiles = (upng_tile**)UPNG_MEM_ALLOC(sizeof(upng_tile*) * saved);
+        CHECK_RET(upng, upng->saved_tiles != NULL, UPNG_ENOMEM);
+    }
+    upng->saved_count = 0;
+
+    /* every live tile is on the canvas or saved, the table has room for twice as many */
+    live = count + (upng->save_width > 0 ? saved : 0);
+    for (canvas->table_size = 1; canvas->table_size < 2 * live; canvas->table_size *= 2);
+    canvas->table = (upng_tile**)UPNG_MEM_ALLOC(sizeof(upng_tile*) * canvas->table_size);
+    CHECK_RET(upng, canvas->table != NULL, UPNG_ENOMEM);
+    memset(canvas->table, 0, sizeof(upng_tile*) * canvas->table_size);
+    return UPNG_EOK;
+}
+
+static void release_saved(upng_t *upng)
+{
+    unsigned long i;
+    for (i = 0; i < upng->saved_count; i++)
+        release_tile(&upng->canvas, upng->saved_tiles[i]);
+    upng->saved_count = 0;
+}
+
+void upng_tiles_free(upng_t *upng)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned long i;
+
+    if (upng->saved_tiles != NULL)
+    {
+        release_saved(upng);
+        UPNG_MEM_FREE(upng->saved_tiles);
+        upng->saved_tiles = NULL;
+    }
+    if (canvas->tiles != NULL)
+    {
+        for (i = 0; i < (unsigned long)canvas->tiles_x * canvas->tiles_y; i++)
+            release_tile(canvas, canvas->tiles[i]);
+        UPNG_MEM_FREE(canvas->tiles);
+        canvas->tiles = NULL;
+    }
+    if (canvas->table != NULL)
+    {
+        UPNG_MEM_FREE(canvas->table);
+        canvas->table = NULL;
+    }
+}
+
+/* writable row y of the tile holding pixel x, starting at the left edge of the tile */
+uint8_t *upng_tile_row(upng_t *upng, unsigned x, unsigned y)
+{
+    upng_canvas *canvas = &upng->canvas;
+    upng_tile **slot = &canvas->tiles[(y / UPNG_TILE_SIZE) * canvas->tiles_x + x / UPNG_TILE_SIZE];
+    upng_tile *tile = *slot;
+
+    if (tile == NULL || tile->refs > 1)
+    {
+        tile = (upng_tile*)UPNG_MEM_ALLOC(sizeof(upng_tile) + tile_size(canvas));
+        if (tile == NULL)
+        {
+            SET_ERROR(upng, UPNG_ENOMEM);
+            return NULL;
+        }
+        if (*slot == NULL)
+            memset(tile->data, canvas->clear, tile_size(canvas));
+        else
+        {
+            memcpy(tile->data, (*slot)->data, tile_size(canvas));
+            (*slot)->refs--;
+        }
+        tile->refs = 1;
+        tile->hashed = 0;
+        *slot = tile;
+    }
+    else if (tile->hashed)
+        unhash_tile(canvas, tile);
+    return tile->data + (y % UPNG_TILE_SIZE) * canvas->tile_stride;
+}
+
+upng_error upng_tiles_clear(upng_t *upng, const upng_rect *rect)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned right = (unsigned)rect->x_offset + rect->width, bottom = (unsigned)rect->y_offset + rect->height;
+    unsigned tx0, ty0, tx1, ty1, tx, ty, x0, x1, y0, y1, y;
+
+    tile_range(rect, &tx0, &ty0, &tx1, &ty1);
+    for (ty = ty0; ty < ty1; ty++)
+    {
+        for (tx = tx0; tx < tx1; tx++)
+        {
+            upng_tile **slot = &canvas->tiles[ty * canvas->tiles_x + tx];
+            if (*slot == NULL)
+                continue;
+
+            x0 = tx * UPNG_TILE_SIZE > (unsigned)rect->x_offset ? tx * UPNG_TILE_SIZE : (unsigned)rect->x_offset;
+            y0 = ty * UPNG_TILE_SIZE > (unsigned)rect->y_offset ? ty * UPNG_TILE_SIZE : (unsigned)rect->y_offset;
+            x1 = (tx + 1) * UPNG_TILE_SIZE < right ? (tx + 1) * UPNG_TILE_SIZE : right;
+            y1 = (ty + 1) * UPNG_TILE_SIZE < bottom ? (ty + 1) * UPNG_TILE_SIZE : bottom;
+
+            /* tiles cleared up to the canvas edge are dropped */
+            if (x0 == tx * UPNG_TILE_SIZE && y0 == ty * UPNG_TILE_SIZE &&
+                (x1 == (tx + 1) * UPNG_TILE_SIZE || x1 == upng->defaultImage.rect.width) &&
+                (y1 == (ty + 1) * UPNG_TILE_SIZE || y1 == upng->defaultImage.rect.height))
+            {
+                release_tile(canvas, *slot);
+                *slot = NULL;
+                continue;
+            }
+            for (y = y0; y < y1; y++)
+            {
+                uint8_t *row = upng_tile_row(upng, x0, y);
+                if (row == NULL)
+                    return upng->error;
+                upng_fill_bits(row, (unsigned long)(x0 - tx * UPNG_TILE_SIZE) * canvas->bpp,
+                    (unsigned long)(x1 - x0) * canvas->bpp, canvas->clear);
+            }
+        }
+    }
+    upng_tiles_share(upng, rect);
+    return UPNG_EOK;
+}
+
+/*
+    only the frame saved for is blended before it is restored, so whole tiles can be
+    saved and restored although the rect covers them partially
+*/
+upng_error upng_tiles_save(upng_t *upng, const upng_rect *rect)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned tx0, ty0, tx1, ty1, tx, ty;
+
+    CHECK_RET(upng, rect->width <= upng->save_width && rect->height <= upng->save_height, UPNG_EPARAM);
+    release_saved(upng);
+    tile_range(rect, &tx0, &ty0, &tx1, &ty1);
+    for (ty = ty0; ty < ty1; ty++)
+    {
+        for (tx = tx0; tx < tx1; tx++)
+        {
+            upng_tile *tile = canvas->tiles[ty * canvas->tiles_x + tx];
+            if (tile != NULL)
+                tile->refs++;
+            upng->saved_tiles[upng->saved_count++] = tile;
+        }
+    }
+    return UPNG_EOK;
+}
+
+static int tile_clear(const upng_canvas *canvas, const upng_tile *tile)
+{
+    unsigned long i;
+    for (i = 0; i < tile_size(canvas); i++)
+    {
+        if (tile->data[i] != canvas->clear)
+            return 0;
+    }
+    return 1;
+}
+
+/* replaces the tiles written within rect by identical hashed ones, clear tiles are dropped */
+void upng_tiles_share(upng_t *upng, const upng_rect *rect)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned long mask = canvas->table_size - 1, i;
+    unsigned tx0, ty0, tx1, ty1, tx, ty;
+
+    tile_range(rect, &tx0, &ty0, &tx1, &ty1);
+    for (ty = ty0; ty < ty1; ty++)
+    {
+        for (tx = tx0; tx < tx1; tx++)
+        {
+            upng_tile **slot = &canvas->tiles[ty * canvas->tiles_x + tx];
+            upng_tile *tile = *slot;
+            if (tile == NULL || tile->hashed)
+                continue;
+            if (tile_clear(canvas, tile))
+            {
+                release_tile(canvas, tile);
+                *slot = NULL;
+                continue;
+            }
+
+            tile->hash = upng_content_hash(tile->data, tile_size(canvas));
+            for (i = (unsigned long)tile->hash & mask; canvas->table[i] != NULL; i = (i + 1) & mask)
+            {
+                if (canvas->table[i]->hash == tile->hash && memcmp(canvas->table[i]->data, tile->data, tile_size(canvas)) == 0)
+                    break;
+            }
+            if (canvas->table[i] == NULL)
+            {
+                tile->hashed = 1;
+                canvas->table[i] = tile;
+                continue;
+            }
+            canvas->table[i]->refs++;
+            *slot = canvas->table[i];
+            release_tile(canvas, tile);
+        }
+    }
+}
+
+void upng_tiles_restore(upng_t *upng, const upng_rect *rect)
+{
+    upng_canvas *canvas = &upng->canvas;
+    unsigned tx0, ty0, tx1, ty1, tx, ty;
+    unsigned long i = 0;
+
+    tile_range(rect, &tx0, &ty0, &tx1, &ty1);
+    if (upng->saved_count != (unsigned long)(tx1 - tx0) * (ty1 - ty0))
+        return;
+    for (ty = ty0; ty < ty1; ty++)
+    {
+        for (tx = tx0; tx < tx1; tx++)
+        {
+            upng_tile **slot = &canvas->tiles[ty * canvas->tiles_x + tx];
+            release_tile(canvas, *slot);
+            *slot = upng->saved_tiles[i++];
+        }
+    }
+    /* the references moved back onto the canvas */
+    upng->saved_count = 0;
+}
+
+void upng_tiles_export(const upng_t *upng, uint8_t *out, unsigned long stride)
+{
+    const upng_canvas *canvas = &upng->canvas;
+    unsigned width = upng->defaultImage.rect.width, x, y;
+
+    for (y = 0; y < upng->defaultImage.rect.height; y++, out += stride)
+    {
+        upng_tile *const *tiles = canvas->tiles + (y / UPNG_TILE_SIZE) * canvas->tiles_x;
+        for (x = 0; x < width; x += UPNG_TILE_SIZE)
+        {
+            const upng_tile *tile = tiles[x / UPNG_TILE_SIZE];
+            /* the last tile fills the padding of the row like the linear canvas */
+            unsigned long bits = width - x > UPNG_TILE_SIZE ? (unsigned long)UPNG_TILE_SIZE * canvas->bpp : canvas->stride * 8 - (unsigned long)x * canvas->bpp;
+            if (tile == NULL)
+                upng_fill_bits(out, (unsigned long)x * canvas->bpp, bits, canvas->clear);
+            else
+                upng_copy_bits(out, (unsigned long)x * canvas->bpp, tile->data + (y % UPNG_TILE_SIZE) * canvas->tile_stride, 0, bits);
+        }
+    }
+}
@@ -1,20 +1,25 @@
 #include "DebugAllocator.hpp"
 #include <exception>
 #include <algorithm>
+#include <mutex>
 
 namespace
 {
     static DebugAllocator global_debug_allocator;
+    // frames may be decoded on several threads
+    static std::mutex global_debug_mutex;
 }
 extern "C"
 {
     void* test_upng_malloc(unsigned size, const char* file, int line)
     {
+        std::lock_guard<std::mutex> lock(global_debug_mutex);
         return global_debug_allocator.allocate(static_cast<size_t>(size), file, line);
     }
 
     void test_upng_free(void* ptr)
     {
+        std::lock_guard<std::mutex> lock(global_debug_mutex);
         return global_debug_allocator.deallocate(ptr);
     }
 }
@@ -1,5 +1,10 @@
 #pragma once
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
 #include "DebugAllocator.hpp"
 extern "C" {
 #include "../src/upng.h"
@@ -13,3 +18,39 @@ static bool operator == (const upng_rect& a, const upng_rect& b)
         a.width == b.width && 
         a.height == b.height;
 }
+
+// a memory source over the bytes of a file, which counts the reads through it
+struct MemorySource
+{
+    std::vector<uint8_t> bytes;
+    unsigned long reads = 0;
+    unsigned long end = 0; // of the furthest read
+    unsigned frees = 0;
+
+    explicit MemorySource(const char* path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    upng_source source()
+    {
+        upng_source source;
+        upng_source_init(&source);
+        source.user = this;
+        source.size = bytes.size();
+        source.free = [](void* user) { ((MemorySource*)user)->frees++; };
+        source.read = [](void* user, unsigned long offset, void* buffer, unsigned long size) -> unsigned long {
+            MemorySource* self = (MemorySource*)user;
+            self->reads++;
+            self->end = std::max(self->end, offset + size);
+            if (offset >= self->bytes.size())
+                return 0;
+            if (size > self->bytes.size() - offset)
+                size = self->bytes.size() - offset;
+            memcpy(buffer, self->bytes.data() + offset, size);
+            return size;
+        };
+        return source;
+    }
+};
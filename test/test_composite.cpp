@@ -0,0 +1,623 @@
+#include "test_common.hpp"
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+
+class Composite : public ::testing::Test {
+protected:
+    upng_t* expected = nullptr;
+
+    void TearDown() override {
+        if (expected != nullptr)
+            upng_free(expected);
+        upng_set_cpu_features(~0u);
+    }
+
+    // the expected canvases are stacked vertically into a single image of the canvas format
+    const uint8_t* expectedFrame(const char* path, unsigned index, unsigned width, unsigned height, unsigned pixel_bytes = 4)
+    {
+        if (expected == nullptr)
+        {
+            expected = upng_new_from_file(path);
+            EXPECT_EQ(UPNG_EOK, upng_decode_default(expected));
+        }
+        return upng_get_frame_buffer(expected) + index * width * height * pixel_bytes;
+    }
+
+    static std::vector<uint8_t> compositeAll(const char* path, upng_blend_mode mode)
+    {
+        upng_t* upng = upng_new_from_file(path);
+        EXPECT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_blend_mode(upng, mode);
+        EXPECT_EQ(UPNG_EOK, upng_header(upng));
+
+        std::vector<uint8_t> canvases;
+        for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        {
+            EXPECT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            upng_rect rect;
+            upng_get_rect(upng, &rect);
+            const uint8_t* buffer = upng_get_frame_buffer(upng);
+            canvases.insert(canvases.end(), buffer, buffer + rect.width * rect.height * upng_get_bpp(upng) / 8);
+        }
+        upng_free(upng);
+        return canvases;
+    }
+};
+
+TEST_F(Composite, RGBA)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(UPNG_RGBA8, upng_get_canvas_format(upng));
+
+    for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/compose_rgba_expected.png", i, 8, 8), upng_get_frame_buffer(upng), 8 * 8 * 4)) << "frame " << i;
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, IndexedAsRGBA)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_indexed.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(UPNG_RGBA8, upng_get_canvas_format(upng));
+
+    for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/compose_indexed_expected.png", i, 7, 5), upng_get_frame_buffer(upng), 7 * 5 * 4)) << "frame " << i;
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, ReplayAfterMove)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    test_upng_free(upng_move_frame_buffer(upng));
+
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(2, upng_get_frame_index(upng));
+    ASSERT_EQ(0, memcmp(expectedFrame("test/resources/compose_rgba_expected.png", 2, 8, 8), upng_get_frame_buffer(upng), 8 * 8 * 4));
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, BlendKernels)
+{
+    for (unsigned features : { 0u, (unsigned)UPNG_CPU_SSE2, ~0u })
+    {
+        upng_set_cpu_features(features);
+        auto rgba = compositeAll("test/resources/blend_rgba.png", UPNG_BLEND_EXACT);
+        auto la = compositeAll("test/resources/blend_la.png", UPNG_BLEND_EXACT);
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/blend_rgba_expected.png", 0, 32, 4), rgba.data(), rgba.size())) << "features " << features;
+        upng_free(expected);
+        expected = nullptr;
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/blend_la_expected.png", 0, 32, 4, 2), la.data(), la.size())) << "features " << features;
+        upng_free(expected);
+        expected = nullptr;
+    }
+}
+
+TEST_F(Composite, Premultiplied)
+{
+    upng_set_cpu_features(0);
+    auto scalar = compositeAll("test/resources/blend_rgba.png", UPNG_BLEND_PREMULTIPLIED);
+    upng_set_cpu_features(~0u);
+    auto simd = compositeAll("test/resources/blend_rgba.png", UPNG_BLEND_PREMULTIPLIED);
+    ASSERT_EQ(scalar, simd);
+
+    // premultiplying rounds every blend, so only compare approximately to the exact result
+    const uint8_t* exact = expectedFrame("test/resources/blend_rgba_expected.png", 0, 32, 4);
+    for (size_t i = 0; i < simd.size(); i += 4)
+    {
+        for (size_t c = 0; c < 3; c++)
+            ASSERT_NEAR((exact[i + c] * exact[i + 3] + 127) / 255, simd[i + c], 2) << "byte " << i + c;
+        ASSERT_EQ(exact[i + 3], simd[i + 3]) << "byte " << i + 3;
+    }
+}
+
+TEST_F(Composite, Keyframes)
+{
+    upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EOK, upng_scan_chunks(upng));
+
+    for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        ASSERT_EQ(i == 0 || i == 4 || i == 8, upng_is_keyframe(upng, i) != 0) << "frame " << i;
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, Seek)
+{
+    const unsigned order[] = { 11, 3, 5, 4, 9, 0, 7, 6, 10, 2, 8, 1, 5, 6, 7, 11 };
+
+    for (unsigned long budget : { 0ul, 3ul * 12 * 10 * 4 })
+    {
+        upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_snapshot_budget(upng, budget);
+
+        // sequential decoding leaves snapshots behind
+        for (unsigned i = 0; i < 12; i++)
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+
+        for (unsigned index : order)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, index));
+            ASSERT_EQ(index, upng_get_frame_index(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/seek_rgba_expected.png", index, 12, 10), upng_get_frame_buffer(upng), 12 * 10 * 4)) << "frame " << index << " budget " << budget;
+        }
+
+        ASSERT_EQ(UPNG_EPARAM, upng_seek_frame(upng, 12));
+        upng_free(upng);
+    }
+}
+
+TEST_F(Composite, FrameCache)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_frame_cache(upng, 1 << 20);
+
+    for (unsigned loop = 0; loop < 3; loop++)
+    {
+        for (unsigned i = 0; i < 6; i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/compose_rgba_expected.png", i, 8, 8), upng_get_frame_buffer(upng), 8 * 8 * 4)) << "frame " << i << " loop " << loop;
+        }
+    }
+
+    upng_cache_stats stats;
+    upng_get_frame_cache_stats(upng, &stats);
+    EXPECT_EQ(12, stats.hits);
+    EXPECT_EQ(6, stats.misses);
+    EXPECT_EQ(0, stats.evictions);
+    EXPECT_GT(stats.bytes, 0);
+    EXPECT_LE(stats.bytes, 6 * 8 * 8 * 4);
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, FrameCacheEviction)
+{
+    const unsigned order[] = { 11, 3, 5, 4, 9, 0, 7, 6, 10, 2, 8, 1, 5, 6, 7, 11 };
+
+    upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_frame_cache(upng, 3 * 12 * 10 * 4);
+
+    for (unsigned loop = 0; loop < 2; loop++)
+    {
+        for (unsigned i = 0; i < 12; i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/seek_rgba_expected.png", i, 12, 10), upng_get_frame_buffer(upng), 12 * 10 * 4)) << "frame " << i << " loop " << loop;
+        }
+    }
+    for (unsigned index : order)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, index));
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/seek_rgba_expected.png", index, 12, 10), upng_get_frame_buffer(upng), 12 * 10 * 4)) << "frame " << index;
+    }
+
+    upng_cache_stats stats;
+    upng_get_frame_cache_stats(upng, &stats);
+    EXPECT_GT(stats.evictions, 0);
+    EXPECT_LE(stats.bytes, 3 * 12 * 10 * 4);
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, FrameCacheAfterSkippedFrame)
+{
+    // seeking from 0 to 3 skips the BACKGROUND frames in between, the canvas never held them for deltas
+    const unsigned order[] = { 0, 3, 0, 1, 2, 3 };
+
+    upng_t* cached = upng_new_from_file("test/resources/seek_rgba.png");
+    upng_t* uncached = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, cached);
+    ASSERT_NE(nullptr, uncached);
+    upng_set_compositing(cached, 1);
+    upng_set_compositing(uncached, 1);
+    upng_set_frame_cache(cached, 1 << 20);
+
+    for (unsigned index : order)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(cached, index));
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(uncached, index));
+        ASSERT_EQ(0, memcmp(upng_get_frame_buffer(uncached), upng_get_frame_buffer(cached), 12 * 10 * 4)) << "frame " << index;
+    }
+
+    upng_free(cached);
+    upng_free(uncached);
+}
+
+TEST_F(Composite, DirtyRects)
+{
+    // rects and dispose ops of seek_rgba.png
+    const upng_rect rects[] = {
+        { 0, 0, 12, 10 }, { 2, 2, 4, 3 }, { 5, 1, 6, 6 }, { 1, 4, 7, 5 }, { 0, 0, 12, 10 }, { 3, 3, 5, 5 },
+        { 0, 6, 9, 4 }, { 0, 0, 12, 10 }, { 4, 0, 8, 4 }, { 2, 5, 6, 5 }, { 7, 2, 5, 8 }, { 0, 0, 12, 10 }
+    };
+    const bool disposed[] = { false, false, true, true, true, false, false, true, false, true, false, false };
+
+    for (int tight : { 0, 1 })
+    {
+        upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_tight_dirty_rects(upng, tight);
+
+        upng_rect dirty;
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        ASSERT_EQ(UPNG_EOK, upng_get_dirty_rect(upng, &dirty));
+        ASSERT_EQ(rects[0], dirty);
+
+        for (unsigned i = 1; i < 12; i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(UPNG_EOK, upng_get_dirty_rect(upng, &dirty));
+
+            const uint8_t* before = expectedFrame("test/resources/seek_rgba_expected.png", i - 1, 12, 10);
+            const uint8_t* after = expectedFrame("test/resources/seek_rgba_expected.png", i, 12, 10);
+            int min_x = 12, min_y = 10, max_x = 0, max_y = 0;
+            for (int y = 0; y < 10; y++)
+            {
+                for (int x = 0; x < 12; x++)
+                {
+                    bool changed = memcmp(before + (y * 12 + x) * 4, after + (y * 12 + x) * 4, 4) != 0;
+                    // nothing may change outside of the dirty rect
+                    bool inside = x >= dirty.x_offset && x < dirty.x_offset + (int)dirty.width &&
+                        y >= dirty.y_offset && y < dirty.y_offset + (int)dirty.height;
+                    ASSERT_TRUE(inside || !changed) << "frame " << i << " pixel " << x << "," << y;
+                    if (changed)
+                    {
+                        min_x = std::min(min_x, x);
+                        min_y = std::min(min_y, y);
+                        max_x = std::max(max_x, x + 1);
+                        max_y = std::max(max_y, y + 1);
+                    }
+                }
+            }
+
+            if (tight)
+            {
+                upng_rect expected = { min_x, min_y, (unsigned)std::max(0, max_x - min_x), (unsigned)std::max(0, max_y - min_y) };
+                if (max_x == 0)
+                    expected = { 0, 0, 0, 0 };
+                ASSERT_EQ(expected, dirty) << "frame " << i;
+            }
+            else
+            {
+                // union of the disposed rect before and the frame rect
+                int x0 = rects[i].x_offset, y0 = rects[i].y_offset;
+                int x1 = x0 + rects[i].width, y1 = y0 + rects[i].height;
+                if (disposed[i - 1])
+                {
+                    x0 = std::min(x0, rects[i - 1].x_offset);
+                    y0 = std::min(y0, rects[i - 1].y_offset);
+                    x1 = std::max(x1, rects[i - 1].x_offset + (int)rects[i - 1].width);
+                    y1 = std::max(y1, rects[i - 1].y_offset + (int)rects[i - 1].height);
+                }
+                upng_rect expected = { x0, y0, (unsigned)(x1 - x0), (unsigned)(y1 - y0) };
+                ASSERT_EQ(expected, dirty) << "frame " << i;
+            }
+        }
+
+        // seeking back does not know what is on screen relative to the frames in between
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 3));
+        ASSERT_EQ(UPNG_EOK, upng_get_dirty_rect(upng, &dirty));
+        ASSERT_EQ(rects[0], dirty);
+
+        upng_free(upng);
+    }
+}
+
+TEST_F(Composite, IndexedAsIndices)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_indexed2.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_indexed_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(UPNG_INDEXED2, upng_get_canvas_format(upng));
+
+    std::vector<uint8_t> rgba(11 * 7 * 4);
+    for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        ASSERT_EQ(UPNG_EOK, upng_get_frame_rgba8(upng, rgba.data()));
+
+        // transparent pixels keep the color of their palette entry
+        const uint8_t* expectedPixels = expectedFrame("test/resources/compose_indexed2_expected.png", i, 11, 7);
+        for (size_t p = 0; p < rgba.size(); p += 4)
+        {
+            ASSERT_EQ(expectedPixels[p + 3], rgba[p + 3]) << "frame " << i << " pixel " << p / 4;
+            if (rgba[p + 3] != 0)
+            {
+                ASSERT_EQ(0, memcmp(expectedPixels + p, rgba.data() + p, 3)) << "frame " << i << " pixel " << p / 4;
+            }
+        }
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, IndexedWithPartialAlpha)
+{
+    // blending partially transparent palette entries produces colors outside of the palette
+    upng_t* upng = upng_new_from_file("test/resources/compose_indexed.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_indexed_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(UPNG_RGBA8, upng_get_canvas_format(upng));
+    upng_free(upng);
+}
+
+TEST_F(Composite, TiledCanvas)
+{
+    const unsigned order[] = { 0, 1, 2, 3, 4, 5, 6, 7, 4, 1, 7, 6 };
+    for (int analytics = 0; analytics < 2; analytics++)
+    {
+        upng_t* linear = upng_new_from_file("test/resources/tiles_rgba.png");
+        upng_t* tiled = upng_new_from_file("test/resources/tiles_rgba.png");
+        ASSERT_NE(nullptr, linear);
+        ASSERT_NE(nullptr, tiled);
+        upng_set_compositing(linear, 1);
+        upng_set_compositing(tiled, 1);
+        upng_set_tiled_canvas(tiled, 1);
+        upng_set_analytics(linear, analytics);
+        upng_set_analytics(tiled, analytics);
+
+        std::vector<uint8_t> canvas(512 * 384 * 4);
+        for (unsigned i : order)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_seek_frame(linear, i));
+            ASSERT_EQ(UPNG_EOK, upng_seek_frame(tiled, i));
+            ASSERT_EQ(nullptr, upng_get_frame_buffer(tiled));
+            ASSERT_EQ(UPNG_EOK, upng_export_canvas(tiled, canvas.data(), 512 * 4));
+            ASSERT_EQ(0, memcmp(upng_get_frame_buffer(linear), canvas.data(), canvas.size())) << "frame " << i;
+        }
+        ASSERT_EQ(UPNG_EPARAM, upng_export_canvas(tiled, canvas.data(), 512 * 4 - 1));
+
+        upng_free(linear);
+        upng_free(tiled);
+    }
+}
+
+TEST_F(Composite, SharedTiles)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    // the uniform tiles of the first frame are kept once instead of in each of the 8x6 tiles
+    upng_t* tiled = upng_new_from_file("test/resources/tiles_rgba.png");
+    ASSERT_NE(nullptr, tiled);
+    upng_set_compositing(tiled, 1);
+    upng_set_tiled_canvas(tiled, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(tiled));
+    ASSERT_LT(allocator.allocationCount(), 8u * 6);
+    for (unsigned i = 1; i < upng_get_frame_count(tiled); i++)
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(tiled));
+    ASSERT_LT(allocator.allocationCount(), 8u * 6);
+    upng_free(tiled);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Composite, TiledIndexedCanvas)
+{
+    upng_t* linear = upng_new_from_file("test/resources/compose_indexed2.png");
+    upng_t* tiled = upng_new_from_file("test/resources/compose_indexed2.png");
+    ASSERT_NE(nullptr, linear);
+    ASSERT_NE(nullptr, tiled);
+    upng_set_compositing(linear, 1);
+    upng_set_compositing(tiled, 1);
+    upng_set_indexed_compositing(linear, 1);
+    upng_set_indexed_compositing(tiled, 1);
+    upng_set_tiled_canvas(tiled, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(tiled));
+    ASSERT_EQ(UPNG_INDEXED2, upng_get_canvas_format(tiled));
+
+    // rows of 11 2 bit pixels take 3 bytes, the exported rows are padded
+    std::vector<uint8_t> canvas(7 * 4);
+    for (unsigned i = 0; i < upng_get_frame_count(tiled); i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(linear));
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(tiled));
+        ASSERT_EQ(UPNG_EOK, upng_export_canvas(tiled, canvas.data(), 4));
+        for (unsigned y = 0; y < 7; y++)
+            ASSERT_EQ(0, memcmp(upng_get_frame_buffer(linear) + y * 3, canvas.data() + y * 4, 3)) << "frame " << i << " row " << y;
+    }
+
+    upng_free(linear);
+    upng_free(tiled);
+}
+
+TEST_F(Composite, DuplicateFrames)
+{
+    upng_t* upng = upng_new_from_file("test/resources/dup_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+
+    for (unsigned loop = 0; loop < 2; loop++)
+    {
+        for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/dup_rgba_expected.png", i, 16, 12), upng_get_frame_buffer(upng), 16 * 12 * 4)) << "frame " << i;
+        }
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Composite, SolidFrames)
+{
+    // solid frames with every filter type, blended over, copied, transparent, translucent, and one almost solid frame
+    for (int analytics = 0; analytics < 2; analytics++)
+    {
+        upng_t* upng = upng_new_from_file("test/resources/solid_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_analytics(upng, analytics);
+        ASSERT_EQ(UPNG_EOK, upng_header(upng));
+
+        for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/solid_rgba_expected.png", i, 16, 12), upng_get_frame_buffer(upng), 16 * 12 * 4)) << "frame " << i;
+        }
+        upng_free(upng);
+    }
+
+    // filled frames are still complete frame buffers
+    upng_t* upng = upng_new_from_file("test/resources/solid_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_analytics(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 1));
+    const uint8_t red[4] = { 250, 10, 20, 255 };
+    for (unsigned i = 0; i < 5 * 4; i++)
+        ASSERT_EQ(0, memcmp(red, upng_get_frame_buffer(upng) + i * 4, 4)) << "pixel " << i;
+
+    upng_analytics analytics;
+    ASSERT_EQ(UPNG_EOK, upng_get_analytics(upng, &analytics));
+    ASSERT_TRUE(analytics.opaque);
+    ASSERT_TRUE(analytics.single_color);
+    ASSERT_EQ(0, memcmp(red, analytics.average, 4));
+    upng_rect bounds = { 0, 0, 5, 4 };
+    ASSERT_EQ(bounds, analytics.bounds);
+
+    ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 2));
+    ASSERT_EQ(UPNG_EOK, upng_get_analytics(upng, &analytics));
+    ASSERT_FALSE(analytics.opaque);
+    ASSERT_EQ(0u, analytics.bounds.width);
+    upng_free(upng);
+
+    upng = upng_new_from_file("test/resources/solid_gray2.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(upng));
+    for (unsigned i = 0; i < 2 * 5; i++)
+        ASSERT_EQ(0xAA, upng_get_frame_buffer(upng)[i]) << "byte " << i;
+    upng_free(upng);
+}
+
+TEST_F(Composite, SolidFrames16)
+{
+    // solid 16 bit frames blended over with alpha 0xFF00 and 0x0100, which the high bytes alone take as opaque and transparent
+    const double frames[][4] = { { 0, 0, 0, 0xFFFF }, { 0xFFFF, 0xFFFF, 0xFFFF, 0xFF00 }, { 0xFFFF, 0, 0, 0x0100 } };
+    for (int analytics = 0; analytics < 2; analytics++)
+    {
+        upng_t* upng = upng_new_from_file("test/resources/solid_rgba16.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_analytics(upng, analytics);
+        ASSERT_EQ(UPNG_EOK, upng_header(upng));
+        ASSERT_EQ(UPNG_RGBA16, upng_get_canvas_format(upng));
+
+        double expected[4] = { 0, 0, 0, 0xFFFF };
+        for (unsigned i = 0; i < 3; i++)
+        {
+            double alpha = frames[i][3] / 0xFFFF;
+            for (unsigned c = 0; c < 3; c++)
+                expected[c] = frames[i][c] * alpha + expected[c] * (1 - alpha);
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            const uint8_t* canvas = upng_get_frame_buffer(upng);
+            for (unsigned p = 0; p < 4 * 2; p++)
+            {
+                for (unsigned c = 0; c < 4; c++)
+                    ASSERT_NEAR(expected[c], canvas[p * 8 + c * 2] << 8 | canvas[p * 8 + c * 2 + 1], 1) << "frame " << i << " pixel " << p << " analytics " << analytics;
+            }
+
+            upng_analytics result;
+            if (analytics)
+            {
+                ASSERT_EQ(UPNG_EOK, upng_get_analytics(upng, &result));
+                ASSERT_EQ(i == 0, result.opaque) << "frame " << i;
+                ASSERT_EQ(4u, result.bounds.width) << "frame " << i;
+            }
+        }
+        upng_free(upng);
+    }
+}
+
+TEST_F(Composite, ColorKey)
+{
+    // a red frame, then one blended over whose left half has the green colour key of the tRNS chunk
+    const uint8_t green[3] = { 0, 255, 0 }, blue[3] = { 0, 0, 255 };
+    for (int analytics = 0; analytics < 2; analytics++)
+    {
+        // the RGB canvas has no alpha, keyed pixels are copied like any other
+        upng_t* upng = upng_new_from_file("test/resources/keyed_rgb.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_analytics(upng, analytics);
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 1));
+        ASSERT_EQ(UPNG_RGB8, upng_get_canvas_format(upng));
+        for (unsigned p = 0; p < 4 * 2; p++)
+            ASSERT_EQ(0, memcmp(p % 4 < 2 ? green : blue, upng_get_frame_buffer(upng) + p * 3, 3)) << "pixel " << p << " analytics " << analytics;
+
+        upng_analytics result;
+        if (analytics)
+        {
+            upng_rect bounds = { 2, 0, 2, 2 };
+            ASSERT_EQ(UPNG_EOK, upng_get_analytics(upng, &result));
+            ASSERT_FALSE(result.opaque);
+            ASSERT_EQ(bounds, result.bounds);
+        }
+        upng_free(upng);
+
+        // a canvas with alpha keeps the red frame where the key is
+        std::vector<uint8_t> canvas(4 * 2);
+        upng = upng_new_from_file("test/resources/keyed_rgb.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        upng_set_analytics(upng, analytics);
+        ASSERT_EQ(UPNG_EOK, upng_set_external_canvas(upng, canvas.data(), 4, UPNG_ARGB2222));
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 1));
+        for (unsigned p = 0; p < 4 * 2; p++)
+            ASSERT_EQ(p % 4 < 2 ? 0xF0 : 0xC3, canvas[p]) << "pixel " << p << " analytics " << analytics;
+        upng_free(upng);
+    }
+}
+
+TEST_F(Composite, FrameOutsideCanvas)
+{
+    std::ifstream file("test/resources/dup_rgba.png", std::ios::binary);
+    const std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    // offsets and sizes of the fcTL of frame 1 at 894 whose sums wrap around
+    for (unsigned field : { 0u, 4u })
+    {
+        std::vector<uint8_t> broken = bytes;
+        const uint8_t offset[4] = { 0x7f, 0xff, 0xff, 0xff }, size[4] = { 0x80, 0x00, 0x00, 0x02 };
+        memcpy(broken.data() + 894 + 12 + field, size, 4);
+        memcpy(broken.data() + 894 + 20 + field, offset, 4);
+
+        upng_t* upng = upng_new_from_bytes(broken.data(), broken.size(), nullptr);
+        ASSERT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        ASSERT_EQ(UPNG_EMALFORMED, upng_decode_next_frame(upng)) << "field " << field;
+        upng_free(upng);
+    }
+}
@@ -0,0 +1,53 @@
+#include "test_common.hpp"
+#include <vector>
+
+class Cpu : public ::testing::Test {
+protected:
+    unsigned features;
+
+    void SetUp() override {
+        features = upng_get_cpu_features();
+    }
+
+    void TearDown() override {
+        upng_set_cpu_features(~0u);
+    }
+
+    static std::vector<uint8_t> decode(const char* path)
+    {
+        upng_t* png = upng_new_from_file(path);
+        EXPECT_NE(nullptr, png);
+        EXPECT_EQ(UPNG_EOK, upng_decode_default(png));
+
+        upng_rect rect;
+        upng_get_rect(png, &rect);
+        const uint8_t* buffer = upng_get_frame_buffer(png);
+        std::vector<uint8_t> pixels(buffer, buffer + rect.width * upng_get_bpp(png) / 8 * rect.height);
+        upng_free(png);
+        return pixels;
+    }
+};
+
+TEST_F(Cpu, ForceScalar)
+{
+    upng_set_cpu_features(0);
+    ASSERT_EQ(0, upng_get_cpu_features());
+    upng_set_cpu_features(~0u);
+    ASSERT_EQ(features, upng_get_cpu_features());
+}
+
+TEST_F(Cpu, UnfilterKernels)
+{
+    for (const char* name : { "filters_rgba", "filters_rgb" })
+    {
+        std::string path = std::string("test/resources/") + name;
+        auto expected = decode((path + "_unfiltered.png").c_str());
+
+        upng_set_cpu_features(0);
+        ASSERT_EQ(expected, decode((path + ".png").c_str()));
+        upng_set_cpu_features(UPNG_CPU_SSE2);
+        ASSERT_EQ(expected, decode((path + ".png").c_str()));
+        upng_set_cpu_features(~0u);
+        ASSERT_EQ(expected, decode((path + ".png").c_str()));
+    }
+}
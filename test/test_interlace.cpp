@@ -0,0 +1,50 @@
+#include "test_common.hpp"
+#include <vector>
+
+class Interlace : public ::testing::Test {
+protected:
+    static std::vector<uint8_t> decode(const char* path)
+    {
+        upng_t* png = upng_new_from_file(path);
+        EXPECT_NE(nullptr, png);
+        EXPECT_EQ(UPNG_EOK, upng_decode_default(png));
+
+        upng_rect rect;
+        upng_get_rect(png, &rect);
+        size_t size = (rect.width * upng_get_bpp(png) + 7) / 8 * rect.height;
+        const uint8_t* buffer = upng_get_frame_buffer(png);
+        std::vector<uint8_t> pixels(buffer, buffer + size);
+        upng_free(png);
+        return pixels;
+    }
+};
+
+TEST_F(Interlace, MatchesProgressiveRGBA)
+{
+    ASSERT_EQ(decode("test/resources/gradient_rgba.png"), decode("test/resources/gradient_rgba_adam7.png"));
+}
+
+TEST_F(Interlace, MatchesProgressive1Bit)
+{
+    ASSERT_EQ(decode("test/resources/gradient_1bit.png"), decode("test/resources/gradient_1bit_adam7.png"));
+}
+
+TEST_F(Interlace, ProgressCallback)
+{
+    std::vector<unsigned> passes;
+    upng_t* png = upng_new_from_file("test/resources/gradient_rgba_adam7.png");
+    ASSERT_NE(nullptr, png);
+    upng_set_progress_callback(png, [](void* user, const upng_t* upng, unsigned pass) {
+        static_cast<std::vector<unsigned>*>(user)->push_back(pass);
+        // after the first pass the preview is made of 8x8 blocks
+        if (pass == 1)
+        {
+            const uint8_t* buffer = upng_get_frame_buffer(upng);
+            ASSERT_EQ(0, memcmp(buffer, buffer + 4 * 7, 4));
+            ASSERT_EQ(0, memcmp(buffer, buffer + 13 * 4 * 7, 4));
+        }
+    }, &passes);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(png));
+    ASSERT_EQ(std::vector<unsigned>({ 1, 2, 3, 4, 5, 6, 7 }), passes);
+    upng_free(png);
+}
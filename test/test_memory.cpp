@@ -42,3 +42,43 @@ TEST_F(Memory, MoveBuffer)
 
     allocator->deallocate(buffer);
 }
+
+TEST_F(Memory, CompositingAllocatesUpFront)
+{
+    upng_t *png = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, png);
+    upng_set_compositing(png, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(png));
+
+    // the save buffer for PREVIOUS was sized for the largest rect with the canvas
+    {
+        DebugAllocator frames(DebugAllocator::GetGlobalInstance());
+        for (unsigned i = 1; i < 24; i++)
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(png));
+        ASSERT_EQ(0, frames.allocationCount());
+    }
+
+    upng_free(png);
+    ASSERT_EQ(0, allocator->allocationCount());
+}
+
+TEST_F(Memory, TiledCanvasIsSparse)
+{
+    // only tiles something was blended onto are allocated, a linear canvas takes 512 * 384 * 4 bytes
+    size_t used[2];
+    for (int tiled = 0; tiled < 2; tiled++)
+    {
+        upng_t *png = upng_new_from_file("test/resources/tiles_rgba.png");
+        ASSERT_NE(nullptr, png);
+        upng_set_compositing(png, 1);
+        upng_set_tiled_canvas(png, tiled);
+        upng_set_analytics(png, 1);
+        ASSERT_EQ(UPNG_EOK, upng_header(png));
+        for (unsigned i = 0; i < upng_get_frame_count(png); i++)
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(png));
+        used[tiled] = allocator->allocationSize();
+        upng_free(png);
+    }
+    ASSERT_LT(used[1] + 512 * 384 * 4 / 2, used[0]);
+    ASSERT_EQ(0, allocator->allocationCount());
+}
@@ -1,4 +1,5 @@
 #include "test_common.hpp"
+#include <vector>
 
 class MultipleFrames : public ::testing::Test {};
 
@@ -58,3 +59,111 @@ TEST_F(MultipleFrames, FramesWrapAround)
 
     upng_free(upng);
 }
+
+TEST_F(MultipleFrames, Duplicates)
+{
+    upng_t* upng = upng_new_from_file("test/resources/dup_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_analytics(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(7, upng_get_frame_count(upng));
+    ASSERT_EQ(UPNG_EOK, upng_scan_chunks(upng));
+
+    // frame 4 is split into two chunks, frame 5 has the pixels of frame 1 compressed differently
+    const unsigned duplicates[] = { 0, 1, 1, 3, 1, 5, 3 };
+    for (unsigned i = 0; i < 7; i++)
+        ASSERT_EQ(duplicates[i], upng_get_duplicate_frame(upng, i)) << "frame " << i;
+
+    // starting with a duplicate retains its frame for the earlier one as well
+    std::vector<uint8_t> pixels[7];
+    upng_analytics analytics[7];
+    for (unsigned i : { 4, 5, 1, 2, 6, 3 })
+    {
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, i));
+        ASSERT_EQ(UPNG_EOK, upng_get_analytics(upng, &analytics[i]));
+        const uint8_t* buffer = upng_get_frame_buffer(upng);
+        pixels[i].assign(buffer, buffer + 6 * 6 * 4);
+    }
+    for (unsigned i : { 1, 2, 4 })
+    {
+        ASSERT_EQ(pixels[5], pixels[i]) << "frame " << i;
+        ASSERT_EQ(analytics[5].bounds, analytics[i].bounds) << "frame " << i;
+    }
+    ASSERT_EQ(pixels[3], pixels[6]);
+    ASSERT_NE(pixels[1], pixels[3]);
+
+    upng_free(upng);
+}
+
+TEST_F(MultipleFrames, PayloadCache)
+{
+    MemorySource counting("test/resources/seek_rgba.png");
+    upng_t* upng = upng_new_from_source(counting.source());
+    ASSERT_NE(nullptr, upng);
+    upng_set_payload_cache(upng, 1 << 20, 0);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    unsigned count = upng_get_frame_count(upng);
+
+    for (unsigned i = 0; i < count; i++)
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    std::vector<uint8_t> last(upng_get_frame_buffer(upng), upng_get_frame_buffer(upng) + 12 * 10 * 4);
+
+    // the second loop does not touch the source
+    unsigned long reads = counting.reads;
+    for (unsigned i = 0; i < count; i++)
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(reads, counting.reads);
+    ASSERT_EQ(0, memcmp(last.data(), upng_get_frame_buffer(upng), last.size()));
+
+    upng_cache_stats stats;
+    upng_get_payload_cache_stats(upng, &stats);
+    ASSERT_EQ(count, stats.hits);
+    ASSERT_EQ(count, stats.misses);
+    ASSERT_EQ(0, stats.evictions);
+    ASSERT_LT(0, stats.bytes);
+
+    upng_free(upng);
+}
+
+TEST_F(MultipleFrames, PayloadCacheBudget)
+{
+    // a budget for about half of the payloads
+    unsigned long budget;
+    {
+        upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_payload_cache(upng, 1 << 20, 0);
+        for (unsigned i = 0; i < 12; i++)
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        upng_cache_stats stats;
+        upng_get_payload_cache_stats(upng, &stats);
+        budget = stats.bytes / 2;
+        upng_free(upng);
+    }
+
+    for (int pin = 0; pin < 2; pin++)
+    {
+        upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        upng_set_payload_cache(upng, budget, pin);
+        for (unsigned i = 0; i < 3 * 12; i++)
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+
+        // least recently used payloads are never in the cache again when looping, pinned ones stay
+        upng_cache_stats stats;
+        upng_get_payload_cache_stats(upng, &stats);
+        ASSERT_GE(budget, stats.bytes);
+        if (pin)
+        {
+            ASSERT_EQ(0, stats.evictions);
+            ASSERT_LT(0, stats.hits);
+            ASSERT_EQ(3 * 12, stats.hits + stats.misses);
+        }
+        else
+        {
+            ASSERT_LT(0, stats.evictions);
+            ASSERT_EQ(0, stats.hits);
+        }
+        upng_free(upng);
+    }
+}
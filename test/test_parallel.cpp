@@ -0,0 +1,127 @@
+#include "test_common.hpp"
+
+class Parallel : public ::testing::Test {
+protected:
+    upng_t* expected = nullptr;
+
+    void TearDown() override {
+        if (expected != nullptr)
+            upng_free(expected);
+    }
+
+    // the expected canvases are stacked vertically into a single RGBA8 image
+    const uint8_t* expectedFrame(const char* path, unsigned index, unsigned width, unsigned height)
+    {
+        if (expected == nullptr)
+        {
+            expected = upng_new_from_file(path);
+            EXPECT_EQ(UPNG_EOK, upng_decode_default(expected));
+        }
+        return upng_get_frame_buffer(expected) + index * width * height * 4;
+    }
+};
+
+TEST_F(Parallel, Frames)
+{
+    expectedFrame("test/resources/compose_rgba_expected.png", 0, 8, 8);
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    for (unsigned threads : { 1u, 2u, 4u })
+    {
+        for (unsigned max_in_flight : { 1u, 3u, 8u })
+        {
+            upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+            ASSERT_NE(nullptr, upng);
+            upng_set_compositing(upng, 1);
+            ASSERT_EQ(UPNG_EOK, upng_set_parallel_decode(upng, threads, max_in_flight));
+
+            // wraps around twice
+            for (unsigned i = 0; i < 15; i++)
+            {
+                ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+                ASSERT_EQ(i % 6, upng_get_frame_index(upng));
+                ASSERT_EQ(0, memcmp(expectedFrame("test/resources/compose_rgba_expected.png", i % 6, 8, 8), upng_get_frame_buffer(upng), 8 * 8 * 4))
+                    << "frame " << i << " threads " << threads << " in flight " << max_in_flight;
+            }
+
+            // freeing stops the pool
+            upng_free(upng);
+        }
+    }
+
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Parallel, Interlaced)
+{
+    upng_t* upng = upng_new_from_file("test/resources/adam7_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_analytics(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_set_parallel_decode(upng, 3, 4));
+
+    for (unsigned i = 0; i < 12; i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/adam7_rgba_expected.png", i % 6, 20, 14), upng_get_frame_buffer(upng), 20 * 14 * 4)) << "frame " << i;
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Parallel, Seek)
+{
+    const unsigned order[] = { 11, 3, 5, 4, 9, 0, 7, 6, 10, 2, 8, 1, 5, 6, 7, 11 };
+
+    upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    upng_set_payload_cache(upng, 1024, 0);
+    ASSERT_EQ(UPNG_EOK, upng_set_parallel_decode(upng, 2, 3));
+
+    // seeking discards the frames decoded ahead
+    for (unsigned index : order)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, index));
+        ASSERT_EQ(0, memcmp(expectedFrame("test/resources/seek_rgba_expected.png", index, 12, 10), upng_get_frame_buffer(upng), 12 * 10 * 4)) << "frame " << index;
+    }
+
+    // as does stopping the pool
+    ASSERT_EQ(UPNG_EOK, upng_set_parallel_decode(upng, 0, 0));
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(0, memcmp(expectedFrame("test/resources/seek_rgba_expected.png", 0, 12, 10), upng_get_frame_buffer(upng), 12 * 10 * 4));
+
+    upng_free(upng);
+}
+
+TEST_F(Parallel, DuplicateFrames)
+{
+    upng_t* upng = upng_new_from_file("test/resources/dup_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_set_parallel_decode(upng, 2, 2));
+
+    for (unsigned loop = 0; loop < 2; loop++)
+    {
+        for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        {
+            ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            ASSERT_EQ(0, memcmp(expectedFrame("test/resources/dup_rgba_expected.png", i, 16, 12), upng_get_frame_buffer(upng), 16 * 12 * 4)) << "frame " << i;
+        }
+    }
+
+    upng_free(upng);
+}
+
+TEST_F(Parallel, Errors)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EPARAM, upng_set_parallel_decode(upng, 2, 0));
+    upng_free(upng);
+
+    upng = upng_new_from_file("test/resources/checker_24bit.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EPARAM, upng_set_parallel_decode(upng, 2, 2));
+    upng_free(upng);
+}
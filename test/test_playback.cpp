@@ -0,0 +1,69 @@
+#include "test_common.hpp"
+
+class Playback : public ::testing::Test {};
+
+TEST_F(Playback, FrameDelay)
+{
+    upng_t* upng = upng_new_from_file("test/resources/playback.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EOK, upng_scan_chunks(upng));
+
+    unsigned numerator, denominator;
+    ASSERT_EQ(UPNG_EOK, upng_get_frame_delay(upng, 0, &numerator, &denominator));
+    ASSERT_EQ(1, numerator);
+    ASSERT_EQ(10, denominator);
+    ASSERT_EQ(UPNG_EOK, upng_get_frame_delay(upng, 1, &numerator, &denominator));
+    ASSERT_EQ(1, numerator);
+    ASSERT_EQ(100, denominator);
+    ASSERT_EQ(UPNG_EPARAM, upng_get_frame_delay(upng, 4, &numerator, &denominator));
+
+    upng_free(upng);
+}
+
+TEST_F(Playback, FrameAt)
+{
+    upng_t* upng = upng_new_from_file("test/resources/playback.png");
+    ASSERT_NE(nullptr, upng);
+    upng_playback* playback = upng_playback_new(upng);
+    ASSERT_NE(nullptr, playback);
+    ASSERT_EQ(140, upng_playback_get_duration(playback));
+
+    // delays of 100ms, 10ms, 30ms and 0ms played twice
+    const std::pair<unsigned long, unsigned> expected[] = {
+        { 0, 0 }, { 99, 0 }, { 100, 1 }, { 109, 1 }, { 110, 2 }, { 139, 2 },
+        { 140, 0 }, { 240, 1 }, { 279, 2 }, { 280, 3 }, { 100000, 3 }
+    };
+    for (auto& [time, frame] : expected)
+    {
+        ASSERT_EQ(frame, upng_playback_frame_at(playback, time)) << "time " << time;
+        ASSERT_EQ(time >= 280, upng_playback_finished(playback, time) != 0) << "time " << time;
+    }
+
+    upng_playback_free(playback);
+    upng_free(upng);
+}
+
+TEST_F(Playback, Update)
+{
+    upng_t* expected = upng_new_from_file("test/resources/seek_rgba_expected.png");
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(expected));
+    upng_t* upng = upng_new_from_file("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_playback* playback = upng_playback_new(upng);
+    ASSERT_NE(nullptr, playback);
+
+    // falls behind, skips ahead, loops and goes back in time
+    for (unsigned long time : { 0ul, 50ul, 150ul, 550ul, 560ul, 860ul, 1199ul, 1250ul, 2350ul, 2999ul, 3000ul, 1500ul })
+    {
+        unsigned frame = (time / 100) % 12;
+        ASSERT_EQ(frame, upng_playback_frame_at(playback, time));
+        ASSERT_EQ(UPNG_EOK, upng_playback_update(playback, time));
+        ASSERT_EQ(frame, upng_get_frame_index(upng));
+        ASSERT_EQ(0, memcmp(upng_get_frame_buffer(expected) + frame * 12 * 10 * 4, upng_get_frame_buffer(upng), 12 * 10 * 4)) << "time " << time;
+    }
+    ASSERT_FALSE(upng_playback_finished(playback, 1000000));
+
+    upng_playback_free(playback);
+    upng_free(upng);
+    upng_free(expected);
+}
@@ -0,0 +1,89 @@
+#include "test_common.hpp"
+#include <thread>
+#include <vector>
+
+class Prefetch : public ::testing::Test {
+protected:
+    upng_t* expected = nullptr;
+
+    void SetUp() override {
+        expected = upng_new_from_file("test/resources/compose_rgba_expected.png");
+        ASSERT_EQ(UPNG_EOK, upng_decode_default(expected));
+    }
+
+    void TearDown() override {
+        upng_free(expected);
+    }
+
+    const uint8_t* expectedFrame(unsigned index)
+    {
+        return upng_get_frame_buffer(expected) + index * 8 * 8 * 4;
+    }
+};
+
+TEST_F(Prefetch, Frames)
+{
+    for (unsigned depth : { 1u, 2u, 4u })
+    {
+        upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+        ASSERT_NE(nullptr, upng);
+        ASSERT_EQ(UPNG_EOK, upng_prefetch_start(upng, depth));
+
+        // wraps around twice
+        for (unsigned i = 0; i < 15; i++)
+        {
+            unsigned index;
+            const uint8_t* canvas = upng_prefetch_acquire(upng, &index, 1);
+            ASSERT_NE(nullptr, canvas);
+            ASSERT_EQ(i % 6, index);
+            ASSERT_EQ(0, memcmp(expectedFrame(index), canvas, 8 * 8 * 4)) << "frame " << i << " depth " << depth;
+            upng_prefetch_release(upng);
+        }
+
+        upng_prefetch_stop(upng);
+        upng_free(upng);
+    }
+}
+
+TEST_F(Prefetch, Poll)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EOK, upng_prefetch_start(upng, 3));
+
+    unsigned index = ~0u;
+    const uint8_t* canvas;
+    while ((canvas = upng_prefetch_acquire(upng, &index, 0)) == nullptr)
+        std::this_thread::yield();
+    ASSERT_EQ(0, index);
+    ASSERT_EQ(0, memcmp(expectedFrame(0), canvas, 8 * 8 * 4));
+
+    // freeing stops the worker
+    upng_free(upng);
+}
+
+TEST_F(Prefetch, Errors)
+{
+    upng_t* upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EPARAM, upng_prefetch_start(upng, 0));
+    upng_free(upng);
+
+    upng = upng_new_from_file("test/resources/checker_24bit.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EPARAM, upng_prefetch_start(upng, 2));
+    ASSERT_EQ(nullptr, upng_prefetch_acquire(upng, nullptr, 1));
+    upng_free(upng);
+
+    // canvases which do not fit into the slots fail the worker instead of publishing stale pixels
+    std::vector<uint8_t> canvas(8 * 64);
+    upng = upng_new_from_file("test/resources/compose_rgba.png");
+    ASSERT_NE(nullptr, upng);
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_set_external_canvas(upng, canvas.data(), 64, UPNG_RGBA8));
+    ASSERT_EQ(UPNG_EOK, upng_prefetch_start(upng, 2));
+    ASSERT_EQ(nullptr, upng_prefetch_acquire(upng, nullptr, 1));
+    upng_prefetch_stop(upng);
+    ASSERT_EQ(UPNG_EPARAM, upng_get_error(upng));
+    upng_free(upng);
+}
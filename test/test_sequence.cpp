@@ -0,0 +1,186 @@
+#include "test_common.hpp"
+#include <memory>
+#include <vector>
+extern "C" {
+#include "../src/gbitmap_sequence.h"
+}
+
+class Sequence : public ::testing::Test {
+protected:
+    upng_t* expected = nullptr;
+    std::unique_ptr<MemorySource> memory;
+
+    void TearDown() override {
+        if (expected != nullptr)
+            upng_free(expected);
+    }
+
+    GBitmapSequence* create(const char* path)
+    {
+        memory.reset(new MemorySource(path));
+        return gbitmap_sequence_create_with_source(memory->source());
+    }
+
+    // the expected canvases are stacked vertically into a single image
+    const uint8_t* expectedFrame(const char* path, unsigned index, unsigned frameSize)
+    {
+        if (expected == nullptr)
+        {
+            expected = upng_new_from_file(path);
+            EXPECT_EQ(UPNG_EOK, upng_decode_default(expected));
+        }
+        return upng_get_frame_buffer(expected) + index * frameSize;
+    }
+
+    static uint8_t argb2222(const uint8_t* rgba)
+    {
+        return (uint8_t)((rgba[3] >> 6) << 6 | (rgba[0] >> 6) << 4 | (rgba[1] >> 6) << 2 | rgba[2] >> 6);
+    }
+
+    // compares the 12x10 image of seek_rgba.png, leaving the padding of the rows alone
+    void expectFrame(const std::vector<uint8_t>& data, unsigned index)
+    {
+        const uint8_t* expectedPixels = expectedFrame("test/resources/seek_rgba_argb2222.png", index, 12 * 10);
+        for (unsigned y = 0; y < 10; y++)
+        {
+            ASSERT_EQ(0, memcmp(expectedPixels + y * 12, data.data() + y * 16, 12)) << "frame " << index << " row " << y;
+            for (unsigned x = 12; x < 16; x++)
+                ASSERT_EQ(0xEE, data[y * 16 + x]);
+        }
+    }
+
+    static GBitmap bitmap(std::vector<uint8_t>& data, GBitmapFormat format, uint16_t stride, int16_t width, int16_t height, GColor8* palette = nullptr)
+    {
+        GBitmap bitmap;
+        bitmap.addr = data.data();
+        bitmap.row_size_bytes = stride;
+        bitmap.format = format;
+        bitmap.bounds = GRect{ GPoint{ 0, 0 }, GSize{ width, height } };
+        bitmap.palette = palette;
+        return bitmap;
+    }
+};
+
+TEST_F(Sequence, NextFrame)
+{
+    expectedFrame("test/resources/seek_rgba_argb2222.png", 0, 0);
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    GBitmapSequence* sequence = create("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, sequence);
+    ASSERT_EQ(12u, gbitmap_sequence_get_total_num_frames(sequence));
+    ASSERT_EQ(PLAY_COUNT_INFINITE, gbitmap_sequence_get_play_count(sequence));
+    ASSERT_EQ(12, gbitmap_sequence_get_bitmap_size(sequence).w);
+    ASSERT_EQ(10, gbitmap_sequence_get_bitmap_size(sequence).h);
+    ASSERT_EQ(-1, gbitmap_sequence_get_current_frame_idx(sequence));
+
+    std::vector<uint8_t> data(16 * 10, 0xEE);
+    GBitmap target = bitmap(data, GBitmapFormat8Bit, 16, 12, 10);
+    gbitmap_sequence_set_play_count(sequence, 2);
+    ASSERT_EQ(2u, gbitmap_sequence_get_play_count(sequence));
+
+    for (unsigned i = 0; i < 24; i++)
+    {
+        uint32_t delay = 0;
+        ASSERT_TRUE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, &delay));
+        ASSERT_EQ(100u, delay);
+        ASSERT_EQ((int32_t)(i % 12), gbitmap_sequence_get_current_frame_idx(sequence));
+        ASSERT_EQ(i * 100, gbitmap_sequence_get_elapsed_ms(sequence));
+        expectFrame(data, i % 12);
+    }
+
+    // all plays are done
+    ASSERT_FALSE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+    ASSERT_EQ(11, gbitmap_sequence_get_current_frame_idx(sequence));
+
+    ASSERT_TRUE(gbitmap_sequence_restart(sequence));
+    ASSERT_TRUE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+    ASSERT_EQ(0, gbitmap_sequence_get_current_frame_idx(sequence));
+    expectFrame(data, 0);
+
+    gbitmap_sequence_destroy(sequence);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Sequence, ByElapsed)
+{
+    GBitmapSequence* sequence = create("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, sequence);
+
+    std::vector<uint8_t> data(16 * 10, 0xEE);
+    GBitmap target = bitmap(data, GBitmapFormat8Bit, 16, 12, 10);
+
+    for (uint32_t time : { 0u, 50u, 420u, 430u, 1150u, 1320u, 2050u, 250u })
+    {
+        ASSERT_TRUE(gbitmap_sequence_update_bitmap_by_elapsed(sequence, &target, time));
+        ASSERT_EQ((int32_t)(time / 100 % 12), gbitmap_sequence_get_current_frame_idx(sequence));
+        expectFrame(data, time / 100 % 12);
+    }
+
+    // the last frame stays once the only play is over
+    gbitmap_sequence_set_play_count(sequence, 1);
+    ASSERT_TRUE(gbitmap_sequence_update_bitmap_by_elapsed(sequence, &target, 1300));
+    ASSERT_EQ(11, gbitmap_sequence_get_current_frame_idx(sequence));
+    expectFrame(data, 11);
+    ASSERT_FALSE(gbitmap_sequence_update_bitmap_by_elapsed(sequence, &target, 1400));
+
+    gbitmap_sequence_destroy(sequence);
+}
+
+TEST_F(Sequence, Palettized)
+{
+    GBitmapSequence* sequence = create("test/resources/compose_indexed2.png");
+    ASSERT_NE(nullptr, sequence);
+
+    GColor8 palette[4];
+    std::vector<uint8_t> data(4 * 7, 0);
+    GBitmap target = bitmap(data, GBitmapFormat2BitPalette, 4, 11, 7, palette);
+
+    for (unsigned i = 0; i < gbitmap_sequence_get_total_num_frames(sequence); i++)
+    {
+        ASSERT_TRUE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+        const uint8_t* expectedPixels = expectedFrame("test/resources/compose_indexed2_expected.png", i, 11 * 7 * 4);
+        for (unsigned y = 0; y < 7; y++)
+        {
+            for (unsigned x = 0; x < 11; x++)
+            {
+                unsigned index = (data[y * 4 + x / 4] >> (6 - 2 * (x % 4))) & 3;
+                // cleared pixels are the transparent entry of the palette instead of transparent black
+                uint8_t expectedColor = argb2222(expectedPixels + (y * 11 + x) * 4);
+                if ((expectedColor >> 6) == 0)
+                {
+                    ASSERT_EQ(0, palette[index].argb >> 6) << "frame " << i << " at " << x << ", " << y;
+                }
+                else
+                {
+                    ASSERT_EQ(expectedColor, palette[index].argb) << "frame " << i << " at " << x << ", " << y;
+                }
+            }
+        }
+    }
+
+    gbitmap_sequence_destroy(sequence);
+}
+
+TEST_F(Sequence, Errors)
+{
+    GBitmapSequence* sequence = create("test/resources/seek_rgba.png");
+    ASSERT_NE(nullptr, sequence);
+
+    std::vector<uint8_t> data(16 * 10, 0);
+    GBitmap target = bitmap(data, GBitmapFormat1Bit, 4, 12, 10);
+    ASSERT_FALSE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+
+    target = bitmap(data, GBitmapFormat8Bit, 16, 11, 10);
+    ASSERT_FALSE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+
+    // RGBA images have no palette indices
+    GColor8 palette[16];
+    target = bitmap(data, GBitmapFormat4BitPalette, 8, 12, 10, palette);
+    ASSERT_FALSE(gbitmap_sequence_update_bitmap_next_frame(sequence, &target, nullptr));
+    ASSERT_EQ(-1, gbitmap_sequence_get_current_frame_idx(sequence));
+    gbitmap_sequence_destroy(sequence);
+
+    // still images are no sequences
+    ASSERT_EQ(nullptr, create("test/resources/checker_24bit.png"));
+}
@@ -113,3 +113,42 @@ TEST_F(SinglePicture, TextChunks)
 
     upng_free(png);
 }
+
+TEST_F(SinglePicture, AnalyticsOpaque)
+{
+    upng_t *png = upng_new_from_file("test/resources/checker_24bit.png");
+    ASSERT_NE(nullptr, png);
+    upng_analytics analytics;
+    ASSERT_EQ(UPNG_EPARAM, upng_get_analytics(png, &analytics));
+
+    upng_set_analytics(png, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(png));
+    ASSERT_EQ(UPNG_EOK, upng_get_analytics(png, &analytics));
+    ASSERT_TRUE(analytics.opaque);
+    ASSERT_FALSE(analytics.single_color);
+    ASSERT_EQ(128, analytics.average[0]);
+    ASSERT_EQ(128, analytics.average[1]);
+    ASSERT_EQ(64, analytics.average[2]);
+    ASSERT_EQ(255, analytics.average[3]);
+    upng_rect expected = { 0, 0, 2, 2 };
+    ASSERT_EQ(expected, analytics.bounds);
+
+    upng_free(png);
+}
+
+TEST_F(SinglePicture, AnalyticsBounds)
+{
+    upng_t *png = upng_new_from_file("test/resources/trim_rgba.png");
+    ASSERT_NE(nullptr, png);
+    upng_set_analytics(png, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(png));
+
+    upng_analytics analytics;
+    ASSERT_EQ(UPNG_EOK, upng_get_analytics(png, &analytics));
+    ASSERT_FALSE(analytics.opaque);
+    ASSERT_FALSE(analytics.single_color);
+    upng_rect expected = { 1, 1, 2, 2 };
+    ASSERT_EQ(expected, analytics.bounds);
+
+    upng_free(png);
+}
@@ -0,0 +1,565 @@
+#include "test_common.hpp"
+#include <random>
+#include <vector>
+
+class Source : public ::testing::Test {
+protected:
+    // the memory source with the optional callbacks
+    struct CountingSource : MemorySource
+    {
+        unsigned long submits = 0, completes = 0;
+        unsigned long readvs = 0, max_spans = 0;
+        bool mappable = false;
+        bool async = false;
+        bool vectored = false;
+
+        using MemorySource::MemorySource;
+
+        upng_source source()
+        {
+            upng_source source = MemorySource::source();
+            if (vectored)
+            {
+                source.readv = [](void* user, const upng_source_span* spans, unsigned count, void* buffer) -> unsigned long {
+                    CountingSource* self = (CountingSource*)user;
+                    unsigned long done = 0;
+                    self->readvs++;
+                    self->max_spans = std::max<unsigned long>(self->max_spans, count);
+                    for (unsigned i = 0; i < count; i++)
+                    {
+                        if (spans[i].offset + spans[i].size > self->bytes.size())
+                            break;
+                        memcpy((uint8_t*)buffer + done, self->bytes.data() + spans[i].offset, spans[i].size);
+                        done += spans[i].size;
+                    }
+                    return done;
+                };
+            }
+            if (async)
+            {
+                // reads right away, the request holds the result
+                source.submit = [](void* user, unsigned long offset, void* buffer, unsigned long size) -> void* {
+                    CountingSource* self = (CountingSource*)user;
+                    unsigned long reads = self->reads;
+                    unsigned long* request = new unsigned long(self->source().read(user, offset, buffer, size));
+                    self->reads = reads;
+                    self->submits++;
+                    return request;
+                };
+                source.complete = [](void* user, void* request) -> unsigned long {
+                    ((CountingSource*)user)->completes++;
+                    unsigned long result = *(unsigned long*)request;
+                    delete (unsigned long*)request;
+                    return result;
+                };
+            }
+            if (mappable)
+            {
+                source.map = [](void* user, unsigned long offset, unsigned long size) -> const void* {
+                    CountingSource* self = (CountingSource*)user;
+                    return offset + size <= self->bytes.size() ? self->bytes.data() + offset : nullptr;
+                };
+            }
+            return source;
+        }
+
+        // reads the bytes like a pipe, which hands out at most 100 bytes at once
+        upng_source stream()
+        {
+            upng_source source;
+            EXPECT_EQ(UPNG_EOK, upng_source_new_stream([](void* user, void* buffer, unsigned long size) -> unsigned long {
+                CountingSource* self = (CountingSource*)user;
+                self->reads++;
+                size = std::min({ size, 100ul, self->bytes.size() - self->end });
+                memcpy(buffer, self->bytes.data() + self->end, size);
+                self->end += size;
+                return size;
+            }, this, &source));
+            return source;
+        }
+    };
+
+    // forwards to a built-in source and counts the calls made to it
+    struct ForwardingSource
+    {
+        upng_source inner;
+        unsigned long reads = 0, readvs = 0, max_spans = 0;
+
+        upng_source source()
+        {
+            upng_source source = inner;
+            source.user = this;
+            source.read = [](void* user, unsigned long offset, void* buffer, unsigned long size) -> unsigned long {
+                ForwardingSource* self = (ForwardingSource*)user;
+                self->reads++;
+                return self->inner.read(self->inner.user, offset, buffer, size);
+            };
+            source.readv = [](void* user, const upng_source_span* spans, unsigned count, void* buffer) -> unsigned long {
+                ForwardingSource* self = (ForwardingSource*)user;
+                self->readvs++;
+                self->max_spans = std::max<unsigned long>(self->max_spans, count);
+                return self->inner.readv(self->inner.user, spans, count, buffer);
+            };
+            if (inner.submit != NULL)
+            {
+                source.submit = [](void* user, unsigned long offset, void* buffer, unsigned long size) -> void* {
+                    ForwardingSource* self = (ForwardingSource*)user;
+                    return self->inner.submit(self->inner.user, offset, buffer, size);
+                };
+                source.complete = [](void* user, void* request) -> unsigned long {
+                    ForwardingSource* self = (ForwardingSource*)user;
+                    return self->inner.complete(self->inner.user, request);
+                };
+            }
+            source.free = [](void* user) {
+                ForwardingSource* self = (ForwardingSource*)user;
+                self->inner.free(self->inner.user);
+            };
+            return source;
+        }
+    };
+
+    static std::vector<uint8_t> decodeAll(upng_source source, const std::vector<uint8_t>& index = {})
+    {
+        upng_t* upng = index.empty() ? upng_new_from_source(source) : upng_new_from_index(source, index.data(), index.size());
+        EXPECT_NE(nullptr, upng);
+        upng_set_compositing(upng, 1);
+        EXPECT_EQ(UPNG_EOK, upng_header(upng));
+
+        std::vector<uint8_t> canvases;
+        for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+        {
+            EXPECT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+            const uint8_t* buffer = upng_get_frame_buffer(upng);
+            canvases.insert(canvases.end(), buffer, buffer + 16 * 12 * 4);
+        }
+        upng_free(upng);
+        return canvases;
+    }
+};
+
+TEST_F(Source, BlockCacheReads)
+{
+    CountingSource counting("test/resources/tiles_rgba.png");
+    upng_source source = counting.source();
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&source, 64, 4, 1));
+    ASSERT_EQ(counting.bytes.size(), source.size);
+
+    // reads within blocks, across blocks, past the end and bypassing the cache
+    std::mt19937 random(44);
+    std::vector<uint8_t> buffer(512);
+    for (unsigned i = 0; i < 2000; i++)
+    {
+        // small sequential reads like those of chunk headers mostly hit
+        if (i == 1000)
+        {
+            ASSERT_LT(counting.reads, 100u);
+        }
+
+        unsigned long size = i % 50 == 0 ? 100 + random() % 400 : 1 + random() % 40;
+        unsigned long offset = (i < 1000 ? i * 8 : random()) % (counting.bytes.size() + 32);
+        unsigned long expected = offset >= counting.bytes.size() ? 0 : std::min(size, counting.bytes.size() - offset);
+        ASSERT_EQ(expected, source.read(source.user, offset, buffer.data(), size)) << "offset " << offset << " size " << size;
+        ASSERT_EQ(0, memcmp(counting.bytes.data() + offset, buffer.data(), expected)) << "offset " << offset << " size " << size;
+    }
+
+    source.free(source.user);
+    ASSERT_EQ(1u, counting.frees);
+}
+
+TEST_F(Source, BlockCacheDecoding)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource cached("test/resources/dup_rgba.png");
+    upng_source source = cached.source();
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&source, 256, 4, 2));
+
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+    ASSERT_LT(cached.reads, direct.reads);
+    ASSERT_EQ(1u, cached.frees);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Source, BlockCacheParameters)
+{
+    CountingSource counting("test/resources/dup_rgba.png");
+    upng_source source = counting.source();
+
+    // the source stays unchanged
+    ASSERT_EQ(UPNG_EPARAM, upng_source_add_block_cache(&source, 0, 4, 1));
+    ASSERT_EQ(UPNG_EPARAM, upng_source_add_block_cache(&source, 100, 4, 1));
+    ASSERT_EQ(UPNG_EPARAM, upng_source_add_block_cache(&source, 64, 0, 0));
+    ASSERT_EQ(UPNG_EPARAM, upng_source_add_block_cache(&source, 64, 2, 2));
+    ASSERT_EQ((void*)&counting, source.user);
+}
+
+TEST_F(Source, File)
+{
+    upng_source source;
+    ASSERT_EQ(UPNG_ENOTFOUND, upng_source_new_file("test/resources/missing.png", &source));
+
+    CountingSource expected("test/resources/dup_rgba.png");
+    ASSERT_EQ(UPNG_EOK, upng_source_new_file("test/resources/dup_rgba.png", &source));
+    ASSERT_EQ(expected.bytes.size(), source.size);
+
+    // sequential and random reads
+    std::vector<uint8_t> buffer(expected.bytes.size());
+    for (unsigned long offset = 0; offset < 100; offset += 10)
+        ASSERT_EQ(10u, source.read(source.user, offset, buffer.data() + offset, 10));
+    ASSERT_EQ(expected.bytes.size() - 100, source.read(source.user, 100, buffer.data() + 100, expected.bytes.size()));
+    ASSERT_EQ(expected.bytes, buffer);
+    ASSERT_EQ(20u, source.read(source.user, 30, buffer.data(), 20));
+    ASSERT_EQ(0, memcmp(expected.bytes.data() + 30, buffer.data(), 20));
+    ASSERT_EQ(0u, source.read(source.user, source.size, buffer.data(), 1));
+    source.free(source.user);
+
+    upng_t* upng = upng_new_from_file("test/resources/missing.png");
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_ENOTFOUND, upng_get_error(upng));
+    upng_free(upng);
+}
+
+TEST_F(Source, Mapped)
+{
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource mapped("test/resources/dup_rgba.png");
+    mapped.mappable = true;
+
+    // chunks are parsed and payloads inflated from the mapped bytes, through the block cache as well
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(mapped.source()));
+    ASSERT_EQ(0u, mapped.reads);
+
+    upng_source source = mapped.source();
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&source, 64, 2, 1));
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+    ASSERT_EQ(0u, mapped.reads);
+
+    // upng_new_from_bytes maps its buffer
+    upng_t* upng = upng_new_from_bytes(direct.bytes.data(), direct.bytes.size(), nullptr);
+    ASSERT_NE(nullptr, upng);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(upng));
+    upng_free(upng);
+}
+
+TEST_F(Source, WithoutVersion)
+{
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource legacy("test/resources/dup_rgba.png");
+    legacy.mappable = true;
+
+    // members after read hold garbage in sources filled in without upng_source_init, they are not called
+    upng_source source = legacy.source();
+    upng_source filled;
+    memset(&filled, 0xA5, sizeof(filled));
+    filled.user = source.user;
+    filled.size = source.size;
+    filled.free = source.free;
+    filled.read = source.read;
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(filled));
+    ASSERT_LT(0u, legacy.reads);
+
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&filled, 64, 2, 1));
+    ASSERT_EQ(UPNG_SOURCE_VERSION, filled.version);
+    ASSERT_EQ(nullptr, filled.map);
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(filled));
+}
+
+TEST_F(Source, LazyScan)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    // the default image only needs the chunks up to the fcTL after its IDAT at 894
+    CountingSource counting("test/resources/dup_rgba.png");
+    upng_t* upng = upng_new_from_source(counting.source());
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(894u + 8, counting.end);
+
+    // frames are scanned as far as they are decoded
+    ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 1));
+    ASSERT_EQ(1109u + 8, counting.end);
+    unsigned numerator, denominator;
+    ASSERT_EQ(UPNG_EPARAM, upng_get_frame_delay(upng, 2, &numerator, &denominator));
+    ASSERT_EQ(2u, upng_get_duplicate_frame(upng, 2));
+
+    // the default image is decoded before the remaining chunks are scanned for texts
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(upng));
+    ASSERT_EQ(counting.bytes.size() - 4, counting.end);
+    ASSERT_EQ(UPNG_EOK, upng_get_frame_delay(upng, 2, &numerator, &denominator));
+    ASSERT_EQ(1u, upng_get_duplicate_frame(upng, 2));
+    upng_free(upng);
+
+    // a broken sequence number in the fdAT of frame 3 only fails the frames from there on
+    CountingSource broken("test/resources/dup_rgba.png");
+    broken.bytes[1362 + 11]++;
+    upng = upng_new_from_source(broken.source());
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(upng));
+    for (unsigned i = 0; i < 3; i++)
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng)) << "frame " << i;
+    ASSERT_EQ(UPNG_EMALFORMED, upng_decode_next_frame(upng));
+    upng_free(upng);
+
+    upng = upng_new_from_source(broken.source());
+    ASSERT_EQ(UPNG_EMALFORMED, upng_scan_chunks(upng));
+    upng_free(upng);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Source, Index)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    CountingSource counting("test/resources/dup_rgba.png");
+    upng_t* scanned = upng_new_from_source(counting.source());
+    uint8_t* data;
+    unsigned long size;
+    ASSERT_EQ(UPNG_EOK, upng_save_index(scanned, &data, &size));
+    std::vector<uint8_t> index(data, data + size);
+    test_upng_free(data);
+
+    // only the header and the bytes identifying the source are read, the CRCs of the data chunks in one call
+    CountingSource indexed("test/resources/dup_rgba.png");
+    indexed.vectored = true;
+    upng_t* upng = upng_new_from_index(indexed.source(), index.data(), index.size());
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    ASSERT_EQ(3u, indexed.reads);
+    ASSERT_EQ(1u, indexed.readvs);
+    ASSERT_EQ(8u, indexed.max_spans);
+    ASSERT_EQ(upng_get_frame_count(scanned), upng_get_frame_count(upng));
+    ASSERT_EQ(upng_get_plays(scanned), upng_get_plays(upng));
+    for (unsigned i = 0; i < upng_get_frame_count(upng); i++)
+    {
+        unsigned numerator, denominator, expected_numerator, expected_denominator;
+        ASSERT_EQ(UPNG_EOK, upng_get_frame_delay(scanned, i, &expected_numerator, &expected_denominator));
+        ASSERT_EQ(UPNG_EOK, upng_get_frame_delay(upng, i, &numerator, &denominator));
+        ASSERT_EQ(expected_numerator, numerator) << "frame " << i;
+        ASSERT_EQ(expected_denominator, denominator) << "frame " << i;
+        ASSERT_EQ(upng_get_duplicate_frame(scanned, i), upng_get_duplicate_frame(upng, i)) << "frame " << i;
+        ASSERT_EQ(upng_is_keyframe(scanned, i), upng_is_keyframe(upng, i)) << "frame " << i;
+    }
+    ASSERT_EQ(3u, indexed.reads);
+    upng_free(upng);
+    upng_free(scanned);
+    indexed.reads = 0;
+    ASSERT_EQ(decodeAll(counting.source()), decodeAll(indexed.source(), index));
+    unsigned long reads = indexed.reads;
+
+    // a changed source or a corrupt index is scanned instead
+    CountingSource changed("test/resources/dup_rgba.png");
+    changed.vectored = true;
+    changed.bytes.back() ^= 1;
+    ASSERT_EQ(decodeAll(counting.source()), decodeAll(changed.source(), index));
+    ASSERT_LT(reads, changed.reads);
+
+    // as is one with an edited data chunk in the middle, which changes the CRC of the chunk
+    CountingSource edited("test/resources/dup_rgba.png");
+    edited.vectored = true;
+    edited.bytes[1147 + 8 + 165] ^= 1;
+    ASSERT_EQ(decodeAll(counting.source()), decodeAll(edited.source(), index));
+    ASSERT_LT(reads, edited.reads);
+
+    std::vector<uint8_t> corrupt = index;
+    corrupt[40] ^= 1;
+    indexed.reads = 0;
+    ASSERT_EQ(decodeAll(counting.source()), decodeAll(indexed.source(), corrupt));
+    ASSERT_LT(reads, indexed.reads);
+
+    // texts are read together with the index
+    CountingSource texts("test/resources/hidden_texts.png");
+    upng = upng_new_from_source(texts.source());
+    ASSERT_EQ(UPNG_EOK, upng_save_index(upng, &data, &size));
+    upng_free(upng);
+    upng = upng_new_from_index(texts.source(), data, size);
+    test_upng_free(data);
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(upng));
+    const char* content;
+    ASSERT_STREQ("Description", upng_get_text(upng, &content, 1));
+    ASSERT_STREQ("This is a aupng test image", content);
+    ASSERT_EQ(nullptr, upng_get_text(upng, &content, 3));
+    upng_free(upng);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Source, Stream)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource stream("test/resources/dup_rgba.png");
+    std::vector<uint8_t> expected = decodeAll(direct.source());
+    ASSERT_EQ(expected, decodeAll(stream.stream()));
+    ASSERT_EQ(stream.bytes.size() - 4, stream.end); // but the CRC of IEND
+
+    // frames are decoded as soon as the next chunk arrived, the first one with the default image
+    stream.end = 0;
+    upng_t* upng = upng_new_from_source(stream.stream());
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(894u + 8, stream.end);
+    ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng));
+    ASSERT_EQ(1109u + 8, stream.end);
+
+    // the data chunks of frames decoded already are kept for seeking back
+    ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, 0));
+    ASSERT_EQ(0, memcmp(expected.data(), upng_get_frame_buffer(upng), 16 * 12 * 4));
+    upng_free(upng);
+
+    // and for looping past the last frame
+    stream.end = 0;
+    upng = upng_new_from_source(stream.stream());
+    upng_set_compositing(upng, 1);
+    ASSERT_EQ(UPNG_EOK, upng_header(upng));
+    for (unsigned i = 0; i < 2 * upng_get_frame_count(upng) + 1; i++)
+    {
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng)) << "frame " << i;
+        ASSERT_EQ(0, memcmp(expected.data() + i % upng_get_frame_count(upng) * 16 * 12 * 4, upng_get_frame_buffer(upng), 16 * 12 * 4)) << "frame " << i;
+    }
+    ASSERT_EQ(stream.bytes.size() - 4, stream.end);
+    uint8_t* index;
+    unsigned long size;
+    ASSERT_EQ(UPNG_ENOSEEK, upng_save_index(upng, &index, &size));
+    upng_free(upng);
+
+    stream.end = 0;
+    upng = upng_new_from_source(stream.stream());
+    ASSERT_EQ(UPNG_EOK, upng_scan_chunks(upng));
+    upng_free(upng);
+
+    // a stream ending early fails the frames after it
+    stream.end = 0;
+    stream.bytes.resize(1400);
+    upng = upng_new_from_source(stream.stream());
+    upng_set_compositing(upng, 1);
+    for (unsigned i = 0; i < 3; i++)
+        ASSERT_EQ(UPNG_EOK, upng_decode_next_frame(upng)) << "frame " << i;
+    ASSERT_EQ(UPNG_EREAD, upng_decode_next_frame(upng));
+    upng_free(upng);
+
+    upng_source source = stream.stream();
+    ASSERT_EQ(UPNG_EPARAM, upng_source_add_block_cache(&source, 64, 2, 1));
+    source.free(source.user);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Source, VectoredReads)
+{
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource vectored("test/resources/dup_rgba.png");
+    vectored.vectored = true;
+
+    // every payload is one call, fdAT sequence numbers are not part of the spans
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(vectored.source()));
+    ASSERT_LT(0u, vectored.readvs);
+    ASSERT_EQ(2u, vectored.max_spans);
+
+    // which saves a read for the frame with two data chunks, no chunk headers are read again
+    ASSERT_EQ(direct.reads, vectored.reads + vectored.readvs + 1);
+
+    // through the block cache as well
+    upng_source source = vectored.source();
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&source, 64, 2, 1));
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+}
+
+TEST_F(Source, AsyncReads)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    CountingSource direct("test/resources/dup_rgba.png");
+    CountingSource async("test/resources/dup_rgba.png");
+    async.async = true;
+
+    // payloads of the next frames are submitted while decoding and not read again
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(async.source()));
+    ASSERT_LT(0u, async.submits);
+    ASSERT_EQ(async.submits, async.completes);
+    ASSERT_LT(async.reads, direct.reads);
+
+    // through the block cache as well
+    upng_source source = async.source();
+    ASSERT_EQ(UPNG_EOK, upng_source_add_block_cache(&source, 64, 2, 1));
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+    ASSERT_EQ(async.submits, async.completes);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+
+TEST_F(Source, FileVectoredReads)
+{
+    CountingSource direct("test/resources/dup_rgba.png");
+    ForwardingSource file;
+    ASSERT_EQ(UPNG_EOK, upng_source_new_file("test/resources/dup_rgba.png", &file.inner));
+    ASSERT_NE(nullptr, file.inner.readv);
+
+    // the frame with two data chunks is one call, the spans are read in full
+    upng_source_span spans[2] = { { 33, 4 }, { 0, 8 } };
+    std::vector<uint8_t> buffer(12);
+    ASSERT_EQ(12u, file.inner.readv(file.inner.user, spans, 2, buffer.data()));
+    ASSERT_EQ(0, memcmp(direct.bytes.data() + 33, buffer.data(), 4));
+    ASSERT_EQ(0, memcmp(direct.bytes.data(), buffer.data() + 4, 8));
+    spans[1].offset = direct.bytes.size() - 4;
+    ASSERT_EQ(8u, file.inner.readv(file.inner.user, spans, 2, buffer.data()));
+
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(file.source()));
+    ASSERT_LT(0u, file.readvs);
+    ASSERT_EQ(2u, file.max_spans);
+    ASSERT_EQ(direct.reads, file.reads + file.readvs + 1);
+}
+
+#ifdef UPNG_USE_THREADS
+TEST_F(Source, AsyncFile)
+{
+    upng_source source;
+    ASSERT_EQ(UPNG_ENOTFOUND, upng_source_new_async_file("test/resources/missing.png", 2, &source));
+    ASSERT_EQ(UPNG_EPARAM, upng_source_new_async_file("test/resources/dup_rgba.png", 0, &source));
+
+    CountingSource direct("test/resources/dup_rgba.png");
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+    for (unsigned threads : { 1u, 3u })
+    {
+        ASSERT_EQ(UPNG_EOK, upng_source_new_async_file("test/resources/dup_rgba.png", threads, &source));
+        ASSERT_EQ(direct.bytes.size(), source.size);
+        ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+    }
+
+    // payloads which are not prefetched are read in one call
+    ForwardingSource vectored;
+    ASSERT_EQ(UPNG_EOK, upng_source_new_async_file("test/resources/dup_rgba.png", 2, &vectored.inner));
+    ASSERT_NE(nullptr, vectored.inner.readv);
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(vectored.source()));
+    ASSERT_EQ(2u, vectored.max_spans);
+
+    // seeking discards reads of frames which are not decoded next
+    upng_t* expected = upng_new_from_file("test/resources/seek_rgba_expected.png");
+    ASSERT_EQ(UPNG_EOK, upng_decode_default(expected));
+    ASSERT_EQ(UPNG_EOK, upng_source_new_async_file("test/resources/seek_rgba.png", 2, &source));
+    upng_t* upng = upng_new_from_source(source);
+    upng_set_compositing(upng, 1);
+    for (unsigned index : { 0u, 1u, 2u, 7u, 8u, 3u, 11u, 0u, 1u })
+    {
+        ASSERT_EQ(UPNG_EOK, upng_seek_frame(upng, index));
+        ASSERT_EQ(0, memcmp(upng_get_frame_buffer(expected) + index * 12 * 10 * 4, upng_get_frame_buffer(upng), 12 * 10 * 4)) << "frame " << index;
+    }
+    upng_free(upng);
+    upng_free(expected);
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+#endif
+
+#ifdef UPNG_USE_MMAP
+TEST_F(Source, MappedFile)
+{
+    DebugAllocator allocator(DebugAllocator::GetGlobalInstance());
+
+    upng_source source;
+    ASSERT_EQ(UPNG_ENOTFOUND, upng_source_new_mapped_file("test/resources/missing.png", &source));
+
+    CountingSource direct("test/resources/dup_rgba.png");
+    ASSERT_EQ(UPNG_EOK, upng_source_new_mapped_file("test/resources/dup_rgba.png", &source));
+    ASSERT_EQ(direct.bytes.size(), source.size);
+    ASSERT_EQ(0, memcmp(direct.bytes.data(), source.map(source.user, 0, source.size), source.size));
+    ASSERT_EQ(nullptr, source.map(source.user, 1, source.size));
+    ASSERT_EQ(decodeAll(direct.source()), decodeAll(source));
+    ASSERT_EQ(0, allocator.allocationCount());
+}
+#endif